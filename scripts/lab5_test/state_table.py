@@ -18,7 +18,9 @@ class StateTable(object):
         self._init_reg()
         self._string_index = 0
         self._construct_string(string_table)
-        self._heap_address = 0x100000
+        # Far above the strings and the stack growing down from 0x200000, so
+        # deep recursion and large heaps never run into each other
+        self._heap_address = 0x100000000
         self._mem_table[0x200000] = -1
         self._current_func = 'tigermain'
 
@@ -64,6 +64,7 @@ public:
   AbsynTree &operator=(AbsynTree &&absyn_tree) = delete;
   ~AbsynTree();
 
+  [[nodiscard]] absyn::Exp *Root() const { return root_; }
   void Print(FILE *out) const;
   void SemAnalyze(env::VEnvPtr venv, env::TEnvPtr tenv,
                   err::ErrorMsg *errormsg) const;
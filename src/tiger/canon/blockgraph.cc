@@ -0,0 +1,128 @@
+#include "tiger/canon/blockgraph.h"
+
+#include <algorithm>
+
+namespace canon {
+
+temp::Label *BlockLabel(tree::StmList *block) {
+  return static_cast<tree::LabelStm *>(block->GetList().front())->label_;
+}
+
+std::vector<temp::Label *> BlockTargets(tree::StmList *block) {
+  tree::Stm *last = block->GetList().back();
+  if (typeid(*last) == typeid(tree::JumpStm))
+    return *static_cast<tree::JumpStm *>(last)->jumps_;
+  if (typeid(*last) == typeid(tree::CjumpStm)) {
+    auto *cjump = static_cast<tree::CjumpStm *>(last);
+    return {cjump->true_label_, cjump->false_label_};
+  }
+  return {};
+}
+
+BlockGraph::BlockGraph(StmListList *stm_lists) {
+  BuildGraph(stm_lists);
+  FindDominators();
+  FindFrontiers();
+}
+
+tree::StmList *BlockGraph::BlockOf(temp::Label *label) {
+  auto it = block_of_.find(label);
+  return it == block_of_.end() ? nullptr : it->second;
+}
+
+bool BlockGraph::Dominates(tree::StmList *a, tree::StmList *b) {
+  return dominators_[b].count(a) > 0;
+}
+
+void BlockGraph::BuildGraph(StmListList *stm_lists) {
+  if (stm_lists->GetList().empty())
+    return;
+  std::map<temp::Label *, tree::StmList *> labels;
+  for (tree::StmList *block : stm_lists->GetList())
+    labels[BlockLabel(block)] = block;
+
+  // Blocks the entry never reaches would be dominated by everything
+  std::set<tree::StmList *> reachable;
+  std::vector<tree::StmList *> worklist = {stm_lists->GetList().front()};
+  while (!worklist.empty()) {
+    tree::StmList *block = worklist.back();
+    worklist.pop_back();
+    if (!reachable.insert(block).second)
+      continue;
+    for (temp::Label *target : BlockTargets(block))
+      if (labels.count(target))
+        worklist.push_back(labels[target]);
+  }
+
+  for (tree::StmList *block : stm_lists->GetList()) {
+    if (!reachable.count(block))
+      continue;
+    blocks_.push_back(block);
+    block_of_[BlockLabel(block)] = block;
+  }
+  for (tree::StmList *block : blocks_) {
+    for (temp::Label *target : BlockTargets(block)) {
+      // The exit label has no block
+      tree::StmList *succ = BlockOf(target);
+      if (!succ || std::count(succs_[block].begin(), succs_[block].end(), succ))
+        continue;
+      succs_[block].push_back(succ);
+      preds_[succ].push_back(block);
+    }
+  }
+}
+
+void BlockGraph::FindDominators() {
+  if (blocks_.empty())
+    return;
+  tree::StmList *entry = blocks_.front();
+  std::set<tree::StmList *> all(blocks_.begin(), blocks_.end());
+  for (tree::StmList *block : blocks_)
+    dominators_[block] =
+        block == entry ? std::set<tree::StmList *>{entry} : all;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (tree::StmList *block : blocks_) {
+      if (block == entry)
+        continue;
+      std::set<tree::StmList *> dominators = all;
+      for (tree::StmList *pred : preds_[block]) {
+        std::set<tree::StmList *> common;
+        std::set_intersection(dominators.begin(), dominators.end(),
+                              dominators_[pred].begin(),
+                              dominators_[pred].end(),
+                              std::inserter(common, common.begin()));
+        dominators.swap(common);
+      }
+      dominators.insert(block);
+      if (dominators != dominators_[block]) {
+        dominators_[block] = dominators;
+        changed = true;
+      }
+    }
+  }
+
+  // The strict dominator dominated by all the others
+  for (tree::StmList *block : blocks_) {
+    idom_[block] = nullptr;
+    for (tree::StmList *dominator : dominators_[block])
+      if (dominator != block &&
+          dominators_[dominator].size() + 1 == dominators_[block].size())
+        idom_[block] = dominator;
+  }
+}
+
+void BlockGraph::FindFrontiers() {
+  for (tree::StmList *block : blocks_) {
+    if (preds_[block].size() < 2)
+      continue;
+    for (tree::StmList *pred : preds_[block])
+      for (tree::StmList *runner = pred; runner != idom_[block];
+           runner = idom_[runner])
+        frontier_[runner].insert(block);
+  }
+}
+
+} // namespace canon
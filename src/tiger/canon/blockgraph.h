@@ -0,0 +1,67 @@
+#ifndef TIGER_CANON_BLOCKGRAPH_H_
+#define TIGER_CANON_BLOCKGRAPH_H_
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "tiger/canon/canon.h"
+
+namespace canon {
+
+temp::Label *BlockLabel(tree::StmList *block);
+
+// The labels a block may continue at, a block always ends with a jump
+std::vector<temp::Label *> BlockTargets(tree::StmList *block);
+
+class BlockGraph {
+public:
+  /**
+   * The control flow between the basic blocks the entry reaches, with their
+   * dominators and dominance frontiers
+   * @param stm_lists basic blocks, the first one is the entry
+   */
+  explicit BlockGraph(StmListList *stm_lists);
+
+  // Reachable blocks in the order of the list, the entry first
+  [[nodiscard]] const std::vector<tree::StmList *> &Blocks() const {
+    return blocks_;
+  }
+  // nullptr for the exit label and for unreachable blocks
+  [[nodiscard]] tree::StmList *BlockOf(temp::Label *label);
+  [[nodiscard]] const std::vector<tree::StmList *> &
+  Succs(tree::StmList *block) {
+    return succs_[block];
+  }
+  [[nodiscard]] const std::vector<tree::StmList *> &
+  Preds(tree::StmList *block) {
+    return preds_[block];
+  }
+
+  [[nodiscard]] bool Dominates(tree::StmList *a, tree::StmList *b);
+  // nullptr for the entry
+  [[nodiscard]] tree::StmList *ImmediateDominator(tree::StmList *block) {
+    return idom_[block];
+  }
+  [[nodiscard]] const std::set<tree::StmList *> &
+  Frontier(tree::StmList *block) {
+    return frontier_[block];
+  }
+
+private:
+  std::vector<tree::StmList *> blocks_;
+  std::map<temp::Label *, tree::StmList *> block_of_;
+  std::map<tree::StmList *, std::vector<tree::StmList *>> succs_;
+  std::map<tree::StmList *, std::vector<tree::StmList *>> preds_;
+  std::map<tree::StmList *, std::set<tree::StmList *>> dominators_;
+  std::map<tree::StmList *, tree::StmList *> idom_;
+  std::map<tree::StmList *, std::set<tree::StmList *>> frontier_;
+
+  void BuildGraph(StmListList *stm_lists);
+  void FindDominators();
+  void FindFrontiers();
+};
+
+} // namespace canon
+
+#endif
@@ -111,7 +111,10 @@ void Canon::Trace(std::list<tree::Stm *> &stms) {
 
   if (typeid(*last) == typeid(tree::JumpStm)) {
     auto jumpstm = static_cast<tree::JumpStm *>(last);
-    auto target = block_env_->Look(jumpstm->jumps_->front());
+    // An indirect jump goes on at no particular target
+    auto target = typeid(*jumpstm->exp_) == typeid(tree::NameExp)
+                      ? block_env_->Look(jumpstm->jumps_->front())
+                      : nullptr;
     if (target) {
       Trace(target->stm_list_);
       stms.pop_back();
@@ -142,7 +145,10 @@ void Canon::Trace(std::list<tree::Stm *> &stms) {
       stms.insert(stms.end(), truelist->stm_list_.begin(),
                   truelist->stm_list_.end());
     } else {
-      temp::Label *falselabel = temp::LabelFactory::NewLabel();
+      // Named after its block, so that the labels made later do not depend
+      // on the layout a profile chose
+      temp::Label *falselabel =
+          temp::LabelFactory::NamedLabel(lab->label_->Name() + "_false");
       stms.pop_back();
       std::list<tree::Stm *> tmp_stm_list = {
           new tree::CjumpStm(cjumpstm->op_, cjumpstm->left_, cjumpstm->right_,
@@ -244,6 +250,22 @@ tree::StmList *Canon::TraceSchedule() {
 }
 
 Traces::~Traces() { delete stm_list_; }
+
+std::vector<tree::Exp **> Operands(tree::Stm *stm) {
+  if (typeid(*stm) == typeid(tree::MoveStm)) {
+    auto *move = static_cast<tree::MoveStm *>(stm);
+    if (typeid(*move->dst_) == typeid(tree::MemExp))
+      return {&static_cast<tree::MemExp *>(move->dst_)->exp_, &move->src_};
+    return {&move->src_};
+  }
+  if (typeid(*stm) == typeid(tree::ExpStm))
+    return {&static_cast<tree::ExpStm *>(stm)->exp_};
+  if (typeid(*stm) == typeid(tree::CjumpStm)) {
+    auto *cjump = static_cast<tree::CjumpStm *>(stm);
+    return {&cjump->left_, &cjump->right_};
+  }
+  return {};
+}
 } // namespace canon
 
 namespace tree {
@@ -255,11 +277,23 @@ Stm *SeqStm::Canon() { return tree::Stm::Seq(left_->Canon(), right_->Canon()); }
 Stm *LabelStm::Canon() { return this; }
 
 Stm *JumpStm::Canon() {
-  return tree::Stm::Seq(ExpRefList((tree::Exp *&)exp_).Reorder(), this);
+  return tree::Stm::Seq(ExpRefList(exp_).Reorder(), this);
 }
 
 Stm *CjumpStm::Canon() {
-  return tree::Stm::Seq(ExpRefList(left_, right_).Reorder(), this);
+  Stm *reordered = ExpRefList(left_, right_).Reorder();
+  // Hoisting the ESEQs may leave two constants, the branch is then decided
+  if (typeid(*left_) == typeid(ConstExp) &&
+      typeid(*right_) == typeid(ConstExp)) {
+    temp::Label *target = EvalRel(op_, static_cast<ConstExp *>(left_)->consti_,
+                                  static_cast<ConstExp *>(right_)->consti_)
+                              ? true_label_
+                              : false_label_;
+    return tree::Stm::Seq(
+        reordered, new JumpStm(new NameExp(target),
+                               new std::vector<temp::Label *>({target})));
+  }
+  return tree::Stm::Seq(reordered, this);
 }
 
 Stm *MoveStm::Canon() {
@@ -288,7 +322,8 @@ Stm *ExpStm::Canon() {
 }
 
 canon::StmAndExp BinopExp::Canon() {
-  return {ExpRefList(left_, right_).Reorder(), this};
+  Stm *reordered = ExpRefList(left_, right_).Reorder();
+  return {reordered, Binop(op_, left_, right_)};
 }
 
 canon::StmAndExp MemExp::Canon() { return {ExpRefList(exp_).Reorder(), this}; }
@@ -32,6 +32,7 @@ public:
   [[nodiscard]] const std::list<tree::StmList *> &GetList() const {
     return stmlist_list_;
   }
+  std::list<tree::StmList *> &GetNonConstList() { return stmlist_list_; }
 
 private:
   std::list<tree::StmList *> stmlist_list_;
@@ -152,5 +153,12 @@ private:
   void Trace(std::list<tree::Stm *> &stms);
 };
 
+/**
+ * The expressions a canonical statement evaluates. The destination of a
+ * store is only evaluated through its address
+ * @return references to rewrite the expressions in place
+ */
+std::vector<tree::Exp **> Operands(tree::Stm *stm);
+
 } // namespace canon
 #endif
@@ -0,0 +1,219 @@
+#include "tiger/canon/constprop.h"
+
+namespace canon {
+
+void ConstantPropagation::Optimize() {
+  SSA ssa(stm_lists_);
+  ssa_ = &ssa;
+  values_.assign(ssa.ValueCount(), Lattice());
+  users_.assign(ssa.ValueCount(), {});
+  for (tree::StmList *block : ssa.Graph().Blocks()) {
+    for (tree::Stm *stm : block->GetList())
+      for (tree::Exp **operand : Operands(stm))
+        FindUsers(*operand, {block, stm, -1});
+    std::vector<Phi> &phis = ssa.Phis(block);
+    for (size_t i = 0; i < phis.size(); ++i)
+      for (auto &[pred, arg] : phis[i].args_)
+        if (arg != SSA::NO_VALUE)
+          users_[arg].push_back({block, nullptr, static_cast<int>(i)});
+  }
+
+  Propagate();
+  Rewrite();
+  RemoveUnreachable();
+  ssa_ = nullptr;
+}
+
+void ConstantPropagation::FindUsers(tree::Exp *exp, const Site &site) {
+  if (typeid(*exp) == typeid(tree::TempExp)) {
+    int value = ssa_->ValueOf(static_cast<tree::TempExp *>(exp));
+    if (value != SSA::NO_VALUE)
+      users_[value].push_back(site);
+  } else if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    FindUsers(binop->left_, site);
+    FindUsers(binop->right_, site);
+  } else if (typeid(*exp) == typeid(tree::MemExp)) {
+    FindUsers(static_cast<tree::MemExp *>(exp)->exp_, site);
+  } else if (typeid(*exp) == typeid(tree::CallExp)) {
+    for (tree::Exp *arg : static_cast<tree::CallExp *>(exp)->args_->GetList())
+      FindUsers(arg, site);
+  }
+}
+
+void ConstantPropagation::Propagate() {
+  if (ssa_->Graph().Blocks().empty())
+    return;
+  flow_worklist_.push_back({nullptr, ssa_->Graph().Blocks().front()});
+
+  // A block is only evaluated once some edge into it may run, and then a
+  // statement again whenever a value it reads drops in the lattice
+  while (!flow_worklist_.empty() || !ssa_worklist_.empty()) {
+    if (!flow_worklist_.empty()) {
+      Edge edge = flow_worklist_.back();
+      flow_worklist_.pop_back();
+      if (!executable_edges_.insert(edge).second)
+        continue;
+      tree::StmList *block = edge.second;
+      for (size_t i = 0; i < ssa_->Phis(block).size(); ++i)
+        VisitPhi(block, static_cast<int>(i));
+      if (executable_blocks_.insert(block).second)
+        for (tree::Stm *stm : block->GetList())
+          VisitStm(block, stm);
+      continue;
+    }
+
+    int value = ssa_worklist_.back();
+    ssa_worklist_.pop_back();
+    for (const Site &site : users_[value]) {
+      if (!executable_blocks_.count(site.block_))
+        continue;
+      if (site.stm_)
+        VisitStm(site.block_, site.stm_);
+      else
+        VisitPhi(site.block_, site.phi_);
+    }
+  }
+}
+
+void ConstantPropagation::VisitStm(tree::StmList *block, tree::Stm *stm) {
+  int def = ssa_->DefinedBy(stm);
+  if (def != SSA::NO_VALUE) {
+    tree::Exp *src = static_cast<tree::MoveStm *>(stm)->src_;
+    Lower(def, typeid(*src) == typeid(tree::CallExp) ? Lattice{BOTTOM, 0}
+                                                      : Evaluate(src));
+  } else if (typeid(*stm) == typeid(tree::JumpStm)) {
+    for (temp::Label *label : *static_cast<tree::JumpStm *>(stm)->jumps_)
+      Follow(block, label);
+  } else if (typeid(*stm) == typeid(tree::CjumpStm)) {
+    auto *cjump = static_cast<tree::CjumpStm *>(stm);
+    Lattice left = Evaluate(cjump->left_);
+    Lattice right = Evaluate(cjump->right_);
+    if (left.level_ == CONSTANT && right.level_ == CONSTANT) {
+      Follow(block, tree::EvalRel(cjump->op_, left.value_, right.value_)
+                        ? cjump->true_label_
+                        : cjump->false_label_);
+    } else if (left.level_ == BOTTOM || right.level_ == BOTTOM) {
+      Follow(block, cjump->true_label_);
+      Follow(block, cjump->false_label_);
+    }
+  }
+}
+
+void ConstantPropagation::VisitPhi(tree::StmList *block, int phi) {
+  Phi &node = ssa_->Phis(block)[phi];
+  Lattice result;
+  for (auto &[pred, arg] : node.args_)
+    if (executable_edges_.count({pred, block}))
+      result = Meet(result, ValueLattice(arg));
+  Lower(node.value_, result);
+}
+
+void ConstantPropagation::Follow(tree::StmList *block, temp::Label *label) {
+  // The exit label has no block
+  tree::StmList *succ = ssa_->Graph().BlockOf(label);
+  if (succ)
+    flow_worklist_.push_back({block, succ});
+}
+
+ConstantPropagation::Lattice ConstantPropagation::Meet(Lattice a, Lattice b) {
+  if (a.level_ == TOP)
+    return b;
+  if (b.level_ == TOP)
+    return a;
+  if (a.level_ == CONSTANT && b.level_ == CONSTANT && a.value_ == b.value_)
+    return a;
+  return {BOTTOM, 0};
+}
+
+void ConstantPropagation::Lower(int value, Lattice lattice) {
+  Lattice lowered = Meet(values_[value], lattice);
+  if (lowered.level_ == values_[value].level_)
+    return;
+  values_[value] = lowered;
+  ssa_worklist_.push_back(value);
+}
+
+ConstantPropagation::Lattice ConstantPropagation::Evaluate(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::ConstExp))
+    return {CONSTANT, static_cast<tree::ConstExp *>(exp)->consti_};
+  if (typeid(*exp) == typeid(tree::TempExp))
+    return ValueLattice(ssa_->ValueOf(static_cast<tree::TempExp *>(exp)));
+  if (typeid(*exp) != typeid(tree::BinopExp))
+    return {BOTTOM, 0};
+
+  auto *binop = static_cast<tree::BinopExp *>(exp);
+  Lattice left = Evaluate(binop->left_);
+  Lattice right = Evaluate(binop->right_);
+  if (left.level_ == BOTTOM || right.level_ == BOTTOM)
+    return {BOTTOM, 0};
+  if (left.level_ == TOP || right.level_ == TOP)
+    return {TOP, 0};
+  int result;
+  if (!tree::EvalBinop(binop->op_, left.value_, right.value_, &result))
+    return {BOTTOM, 0};
+  return {CONSTANT, result};
+}
+
+ConstantPropagation::Lattice ConstantPropagation::ValueLattice(int value) {
+  // Reads before any definition may see anything
+  if (value == SSA::NO_VALUE)
+    return {BOTTOM, 0};
+  return values_[value];
+}
+
+void ConstantPropagation::Rewrite() {
+  for (tree::StmList *block : ssa_->Graph().Blocks()) {
+    if (!executable_blocks_.count(block))
+      continue;
+    for (tree::Stm *&stm : block->GetNonConstList()) {
+      for (tree::Exp **operand : Operands(stm))
+        *operand = Substitute(*operand);
+      if (typeid(*stm) != typeid(tree::CjumpStm))
+        continue;
+      auto *cjump = static_cast<tree::CjumpStm *>(stm);
+      if (typeid(*cjump->left_) != typeid(tree::ConstExp) ||
+          typeid(*cjump->right_) != typeid(tree::ConstExp))
+        continue;
+      temp::Label *target =
+          tree::EvalRel(cjump->op_,
+                        static_cast<tree::ConstExp *>(cjump->left_)->consti_,
+                        static_cast<tree::ConstExp *>(cjump->right_)->consti_)
+              ? cjump->true_label_
+              : cjump->false_label_;
+      stm = new tree::JumpStm(new tree::NameExp(target),
+                              new std::vector<temp::Label *>({target}));
+    }
+  }
+}
+
+tree::Exp *ConstantPropagation::Substitute(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::TempExp)) {
+    Lattice lattice =
+        ValueLattice(ssa_->ValueOf(static_cast<tree::TempExp *>(exp)));
+    if (lattice.level_ == CONSTANT)
+      return new tree::ConstExp(lattice.value_);
+  } else if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    return tree::Binop(binop->op_, Substitute(binop->left_),
+                       Substitute(binop->right_));
+  } else if (typeid(*exp) == typeid(tree::MemExp)) {
+    auto *mem = static_cast<tree::MemExp *>(exp);
+    mem->exp_ = Substitute(mem->exp_);
+  } else if (typeid(*exp) == typeid(tree::CallExp)) {
+    for (tree::Exp *&arg :
+         static_cast<tree::CallExp *>(exp)->args_->GetNonConstList())
+      arg = Substitute(arg);
+  }
+  return exp;
+}
+
+void ConstantPropagation::RemoveUnreachable() {
+  BlockGraph graph(stm_lists_);
+  std::set<tree::StmList *> reachable(graph.Blocks().begin(),
+                                      graph.Blocks().end());
+  stm_lists_->GetNonConstList().remove_if(
+      [&reachable](tree::StmList *block) { return !reachable.count(block); });
+}
+
+} // namespace canon
@@ -0,0 +1,67 @@
+#ifndef TIGER_CANON_CONSTPROP_H_
+#define TIGER_CANON_CONSTPROP_H_
+
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "tiger/canon/canon.h"
+#include "tiger/canon/ssa.h"
+
+namespace canon {
+
+class ConstantPropagation {
+public:
+  /**
+   * @param stm_lists basic blocks of canonical trees, rewritten in place
+   */
+  explicit ConstantPropagation(StmListList *stm_lists)
+      : stm_lists_(stm_lists) {}
+
+  /**
+   * Sparse conditional constant propagation over the SSA values: replace
+   * the uses of constant values, turn branches on them into jumps and drop
+   * the blocks no jump reaches any more
+   */
+  void Optimize();
+
+private:
+  enum Level { TOP, CONSTANT, BOTTOM };
+  struct Lattice {
+    Level level_ = TOP;
+    int value_ = 0;
+  };
+  // A statement or the phi with the index reading a value
+  struct Site {
+    tree::StmList *block_;
+    tree::Stm *stm_;
+    int phi_;
+  };
+  using Edge = std::pair<tree::StmList *, tree::StmList *>;
+
+  StmListList *stm_lists_;
+  SSA *ssa_ = nullptr;
+  std::vector<Lattice> values_;
+  std::vector<std::vector<Site>> users_;
+  std::set<tree::StmList *> executable_blocks_;
+  std::set<Edge> executable_edges_;
+  std::vector<Edge> flow_worklist_;
+  std::vector<int> ssa_worklist_;
+
+  void FindUsers(tree::Exp *exp, const Site &site);
+  void Propagate();
+  void VisitStm(tree::StmList *block, tree::Stm *stm);
+  void VisitPhi(tree::StmList *block, int phi);
+  void Follow(tree::StmList *block, temp::Label *label);
+  static Lattice Meet(Lattice a, Lattice b);
+  void Lower(int value, Lattice lattice);
+  Lattice Evaluate(tree::Exp *exp);
+  Lattice ValueLattice(int value);
+  void Rewrite();
+  tree::Exp *Substitute(tree::Exp *exp);
+  void RemoveUnreachable();
+};
+
+} // namespace canon
+
+#endif
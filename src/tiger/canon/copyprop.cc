@@ -0,0 +1,93 @@
+#include "tiger/canon/copyprop.h"
+
+namespace canon {
+
+void CopyPropagation::Optimize() {
+  SSA ssa(stm_lists_);
+  ssa_ = &ssa;
+  FindCopies();
+  for (tree::StmList *block : ssa.Graph().Blocks())
+    if (ssa.Graph().ImmediateDominator(block))
+      children_[ssa.Graph().ImmediateDominator(block)].push_back(block);
+  if (!ssa.Graph().Blocks().empty())
+    Walk(ssa.Graph().Blocks().front());
+  ssa_ = nullptr;
+}
+
+void CopyPropagation::FindCopies() {
+  for (tree::StmList *block : ssa_->Graph().Blocks()) {
+    for (tree::Stm *stm : block->GetList()) {
+      int def = ssa_->DefinedBy(stm);
+      if (def == SSA::NO_VALUE)
+        continue;
+      tree::Exp *src = static_cast<tree::MoveStm *>(stm)->src_;
+      if (typeid(*src) != typeid(tree::TempExp))
+        continue;
+      // Machine registers and reads before any definition have no value
+      // to check the source against
+      auto *use = static_cast<tree::TempExp *>(src);
+      if (ssa_->ValueOf(use) != SSA::NO_VALUE)
+        copies_[def] = {use->temp_, ssa_->ValueOf(use)};
+    }
+  }
+}
+
+void CopyPropagation::Walk(tree::StmList *block) {
+  // Track the value every temporary holds the same way the renaming did
+  std::vector<temp::Temp *> pushed;
+  for (Phi &phi : ssa_->Phis(block)) {
+    stacks_[phi.temp_].push_back(phi.value_);
+    pushed.push_back(phi.temp_);
+  }
+  for (tree::Stm *stm : block->GetList()) {
+    for (tree::Exp **operand : Operands(stm))
+      *operand = Propagate(*operand);
+    int def = ssa_->DefinedBy(stm);
+    if (def == SSA::NO_VALUE)
+      continue;
+    temp::Temp *temp =
+        static_cast<tree::TempExp *>(static_cast<tree::MoveStm *>(stm)->dst_)
+            ->temp_;
+    stacks_[temp].push_back(def);
+    pushed.push_back(temp);
+  }
+
+  for (tree::StmList *child : children_[block])
+    Walk(child);
+
+  for (temp::Temp *temp : pushed)
+    stacks_[temp].pop_back();
+}
+
+tree::Exp *CopyPropagation::Propagate(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::TempExp)) {
+    auto *use = static_cast<tree::TempExp *>(exp);
+    temp::Temp *temp = use->temp_;
+    int value = ssa_->ValueOf(use);
+    // Follow chains of copies while each source is still unchanged
+    for (auto it = copies_.find(value); it != copies_.end();
+         it = copies_.find(value)) {
+      std::vector<int> &stack = stacks_[it->second.src_];
+      if (stack.empty() || stack.back() != it->second.value_)
+        break;
+      temp = it->second.src_;
+      value = it->second.value_;
+    }
+    if (temp != use->temp_)
+      return new tree::TempExp(temp);
+  } else if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    binop->left_ = Propagate(binop->left_);
+    binop->right_ = Propagate(binop->right_);
+  } else if (typeid(*exp) == typeid(tree::MemExp)) {
+    auto *mem = static_cast<tree::MemExp *>(exp);
+    mem->exp_ = Propagate(mem->exp_);
+  } else if (typeid(*exp) == typeid(tree::CallExp)) {
+    for (tree::Exp *&arg :
+         static_cast<tree::CallExp *>(exp)->args_->GetNonConstList())
+      arg = Propagate(arg);
+  }
+  return exp;
+}
+
+} // namespace canon
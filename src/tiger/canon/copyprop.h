@@ -0,0 +1,46 @@
+#ifndef TIGER_CANON_COPYPROP_H_
+#define TIGER_CANON_COPYPROP_H_
+
+#include <map>
+#include <vector>
+
+#include "tiger/canon/canon.h"
+#include "tiger/canon/ssa.h"
+
+namespace canon {
+
+class CopyPropagation {
+public:
+  /**
+   * @param stm_lists basic blocks of canonical trees, rewritten in place
+   */
+  explicit CopyPropagation(StmListList *stm_lists) : stm_lists_(stm_lists) {}
+
+  /**
+   * Read the source of a move between temporaries wherever the copy is used
+   * and the source still holds the value it copied, so the copy is left
+   * dead for the instructions to drop
+   */
+  void Optimize();
+
+private:
+  // The temporary a value was copied from and its value at the copy
+  struct Copy {
+    temp::Temp *src_;
+    int value_;
+  };
+
+  StmListList *stm_lists_;
+  SSA *ssa_ = nullptr;
+  std::map<int, Copy> copies_;
+  std::map<tree::StmList *, std::vector<tree::StmList *>> children_;
+  std::map<temp::Temp *, std::vector<int>> stacks_;
+
+  void FindCopies();
+  void Walk(tree::StmList *block);
+  tree::Exp *Propagate(tree::Exp *exp);
+};
+
+} // namespace canon
+
+#endif
@@ -0,0 +1,132 @@
+#include "tiger/canon/ifconvert.h"
+
+#include "tiger/frame/frame.h"
+
+extern frame::RegManager *reg_manager;
+
+namespace {
+
+// Tree nodes both arms may take together
+constexpr int CONVERSION_BUDGET = 6;
+
+// The tree nodes of an expression that may run even when its value is not
+// needed, -1 when it may fault
+int Cost(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::ConstExp) ||
+      typeid(*exp) == typeid(tree::NameExp) ||
+      typeid(*exp) == typeid(tree::TempExp))
+    return 1;
+  if (typeid(*exp) != typeid(tree::BinopExp))
+    return -1;
+  auto *binop = static_cast<tree::BinopExp *>(exp);
+  if (binop->op_ == tree::DIV_OP)
+    return -1;
+  int left = Cost(binop->left_);
+  int right = Cost(binop->right_);
+  return left < 0 || right < 0 ? -1 : 1 + left + right;
+}
+
+bool Reads(tree::Exp *exp, temp::Temp *temp) {
+  if (typeid(*exp) == typeid(tree::TempExp))
+    return static_cast<tree::TempExp *>(exp)->temp_ == temp;
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    return Reads(binop->left_, temp) || Reads(binop->right_, temp);
+  }
+  if (typeid(*exp) == typeid(tree::MemExp))
+    return Reads(static_cast<tree::MemExp *>(exp)->exp_, temp);
+  return false;
+}
+
+// A temporary other than the one the arms move to
+bool IsOtherTemp(tree::Exp *exp, temp::Temp *dst) {
+  return typeid(*exp) == typeid(tree::TempExp) &&
+         static_cast<tree::TempExp *>(exp)->temp_ != dst;
+}
+
+// The move of an arm made of a label, a move to a temporary and a jump
+tree::MoveStm *ArmMove(tree::StmList *block, temp::Label **join) {
+  const std::list<tree::Stm *> &stms = block->GetList();
+  if (stms.size() != 3)
+    return nullptr;
+  tree::Stm *move = *std::next(stms.begin());
+  tree::Stm *jump = stms.back();
+  if (typeid(*move) != typeid(tree::MoveStm) ||
+      typeid(*jump) != typeid(tree::JumpStm) ||
+      static_cast<tree::JumpStm *>(jump)->jumps_->size() != 1)
+    return nullptr;
+  auto *arm = static_cast<tree::MoveStm *>(move);
+  if (typeid(*arm->dst_) != typeid(tree::TempExp))
+    return nullptr;
+  *join = static_cast<tree::JumpStm *>(jump)->jumps_->front();
+  return arm;
+}
+
+} // namespace
+
+namespace canon {
+
+void IfConversion::Optimize() {
+  BlockGraph graph(stm_lists_);
+  for (tree::StmList *block : graph.Blocks())
+    if (!removed_.count(block))
+      Convert(graph, block);
+  stm_lists_->GetNonConstList().remove_if(
+      [this](tree::StmList *block) { return removed_.count(block); });
+}
+
+void IfConversion::Convert(BlockGraph &graph, tree::StmList *block) {
+  tree::Stm *last = block->GetList().back();
+  if (typeid(*last) != typeid(tree::CjumpStm))
+    return;
+  auto *cjump = static_cast<tree::CjumpStm *>(last);
+  tree::StmList *trues = graph.BlockOf(cjump->true_label_);
+  tree::StmList *falses = graph.BlockOf(cjump->false_label_);
+  if (!trues || !falses || trues == falses ||
+      graph.Preds(trues).size() != 1 || graph.Preds(falses).size() != 1)
+    return;
+
+  // Both arms set the same temporary and meet again
+  temp::Label *join;
+  temp::Label *falseJoin;
+  tree::MoveStm *trueMove = ArmMove(trues, &join);
+  tree::MoveStm *falseMove = ArmMove(falses, &falseJoin);
+  if (!trueMove || !falseMove || join != falseJoin)
+    return;
+  temp::Temp *dst = static_cast<tree::TempExp *>(trueMove->dst_)->temp_;
+  if (typeid(*falseMove->dst_) != typeid(tree::TempExp) ||
+      static_cast<tree::TempExp *>(falseMove->dst_)->temp_ != dst ||
+      reg_manager->temp_map_->Look(dst) || Reads(cjump->left_, dst) ||
+      Reads(cjump->right_, dst))
+    return;
+  int trueCost = Cost(trueMove->src_);
+  int falseCost = Cost(falseMove->src_);
+  if (trueCost < 0 || falseCost < 0 ||
+      trueCost + falseCost > CONVERSION_BUDGET)
+    return;
+
+  // The arm left behind moves a temporary, computed before the other arm
+  // overwrites the destination
+  bool keepTrue = IsOtherTemp(trueMove->src_, dst) ||
+                  !IsOtherTemp(falseMove->src_, dst);
+  tree::StmList *kept = keepTrue ? trues : falses;
+  tree::MoveStm *keptMove = keepTrue ? trueMove : falseMove;
+  std::list<tree::Stm *> &stms = block->GetNonConstList();
+  stms.pop_back();
+  if (!IsOtherTemp(keptMove->src_, dst)) {
+    temp::Temp *value = temp::TempFactory::NewTemp();
+    stms.push_back(new tree::MoveStm(new tree::TempExp(value), keptMove->src_));
+    keptMove->src_ = new tree::TempExp(value);
+  }
+  stms.push_back(keepTrue ? falseMove : trueMove);
+
+  // The kept arm runs when the branch falls through
+  if (keepTrue)
+    cjump->op_ = tree::NotRel(cjump->op_);
+  cjump->true_label_ = join;
+  cjump->false_label_ = BlockLabel(kept);
+  stms.push_back(cjump);
+  removed_.insert(keepTrue ? falses : trues);
+}
+
+} // namespace canon
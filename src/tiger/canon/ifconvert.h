@@ -0,0 +1,35 @@
+#ifndef TIGER_CANON_IFCONVERT_H_
+#define TIGER_CANON_IFCONVERT_H_
+
+#include <set>
+
+#include "tiger/canon/blockgraph.h"
+#include "tiger/canon/canon.h"
+
+namespace canon {
+
+class IfConversion {
+public:
+  /**
+   * @param stm_lists basic blocks of canonical trees, rewritten in place
+   */
+  explicit IfConversion(StmListList *stm_lists) : stm_lists_(stm_lists) {}
+
+  /**
+   * Compute both values of a temporary chosen by a branch before the branch
+   * when the arms are cheap and cannot fault, so that a single move is left
+   * for the branch to jump over. The backend emits that as a conditional
+   * move
+   */
+  void Optimize();
+
+private:
+  StmListList *stm_lists_;
+  std::set<tree::StmList *> removed_;
+
+  void Convert(BlockGraph &graph, tree::StmList *block);
+};
+
+} // namespace canon
+
+#endif
@@ -0,0 +1,300 @@
+#include "tiger/canon/induction.h"
+
+#include <algorithm>
+
+#include "tiger/frame/frame.h"
+
+extern frame::RegManager *reg_manager;
+
+namespace {
+
+// t * c or c * t
+bool IsScaled(tree::Exp *exp, temp::Temp **counter, int *scale) {
+  if (typeid(*exp) != typeid(tree::BinopExp))
+    return false;
+  auto *binop = static_cast<tree::BinopExp *>(exp);
+  if (binop->op_ != tree::MUL_OP)
+    return false;
+  tree::Exp *left = binop->left_;
+  tree::Exp *right = binop->right_;
+  if (typeid(*left) == typeid(tree::ConstExp))
+    std::swap(left, right);
+  if (typeid(*left) != typeid(tree::TempExp) ||
+      typeid(*right) != typeid(tree::ConstExp))
+    return false;
+  *counter = static_cast<tree::TempExp *>(left)->temp_;
+  *scale = static_cast<tree::ConstExp *>(right)->consti_;
+  return true;
+}
+
+bool Reads(tree::Exp *exp, temp::Temp *temp) {
+  if (typeid(*exp) == typeid(tree::TempExp))
+    return static_cast<tree::TempExp *>(exp)->temp_ == temp;
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    return Reads(binop->left_, temp) || Reads(binop->right_, temp);
+  }
+  if (typeid(*exp) == typeid(tree::MemExp))
+    return Reads(static_cast<tree::MemExp *>(exp)->exp_, temp);
+  if (typeid(*exp) == typeid(tree::CallExp)) {
+    for (tree::Exp *arg : static_cast<tree::CallExp *>(exp)->args_->GetList())
+      if (Reads(arg, temp))
+        return true;
+  }
+  return false;
+}
+
+bool ReadsIn(tree::StmList *block, temp::Temp *temp,
+             const std::vector<tree::Stm *> &skipped) {
+  for (tree::Stm *stm : block->GetList()) {
+    if (std::find(skipped.begin(), skipped.end(), stm) != skipped.end())
+      continue;
+    for (tree::Exp **operand : canon::Operands(stm))
+      if (Reads(*operand, temp))
+        return true;
+  }
+  return false;
+}
+
+} // namespace
+
+namespace canon {
+
+void StrengthReduction::Optimize() {
+  // The pointers of an outer loop are invariant in the loops inside it
+  LoopFinder finder(stm_lists_);
+  std::vector<Loop> &loops = finder.Loops();
+  for (Loop &loop : loops)
+    Reduce(loop, loops);
+}
+
+void StrengthReduction::Reduce(Loop &loop, std::vector<Loop> &loops) {
+  FindCounters(loop);
+  derived_.clear();
+  for (tree::StmList *block : stm_lists_->GetList()) {
+    if (!loop.blocks_.count(block))
+      continue;
+    for (tree::Stm *stm : block->GetList())
+      for (tree::Exp **operand : Operands(stm))
+        *operand = Replace(*operand);
+  }
+  if (derived_.empty())
+    return;
+
+  // A pointer starts from the counter the loop is entered with
+  std::list<tree::Stm *> preheader;
+  for (const Derived &derived : derived_)
+    preheader.push_back(new tree::MoveStm(
+        new tree::TempExp(derived.temp_),
+        tree::Binop(tree::PLUS_OP, new tree::TempExp(derived.base_),
+                    tree::Binop(tree::MUL_OP,
+                                new tree::TempExp(derived.counter_),
+                                new tree::ConstExp(derived.scale_)))));
+  StepDerived(loop);
+
+  // Only a pointer into an array stands in for its counter in the tests
+  std::set<temp::Temp *> replaced;
+  for (const Derived &derived : derived_) {
+    std::set<temp::Temp *> visited;
+    if (!replaced.count(derived.counter_) &&
+        IsHeapAddress(derived.base_, visited)) {
+      replaced.insert(derived.counter_);
+      ReplaceTests(loop, derived, preheader);
+    }
+  }
+  InsertPreheader(stm_lists_, loop, loops, preheader);
+}
+
+void StrengthReduction::FindCounters(const Loop &loop) {
+  defs_.clear();
+  steps_.clear();
+  std::set<temp::Temp *> others;
+  for (tree::StmList *block : loop.blocks_) {
+    for (tree::Stm *stm : block->GetList()) {
+      if (typeid(*stm) != typeid(tree::MoveStm))
+        continue;
+      auto *move = static_cast<tree::MoveStm *>(stm);
+      if (typeid(*move->dst_) != typeid(tree::TempExp))
+        continue;
+      temp::Temp *dst = static_cast<tree::TempExp *>(move->dst_)->temp_;
+      defs_.insert(dst);
+      temp::Temp *counter;
+      int step;
+      if (IsStep(stm, &counter, &step) &&
+          !reg_manager->temp_map_->Look(counter))
+        steps_[counter].push_back(stm);
+      else
+        others.insert(dst);
+    }
+  }
+  for (temp::Temp *temp : others)
+    steps_.erase(temp);
+}
+
+bool StrengthReduction::IsInvariant(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::ConstExp) ||
+      typeid(*exp) == typeid(tree::NameExp))
+    return true;
+  if (typeid(*exp) == typeid(tree::TempExp)) {
+    temp::Temp *temp = static_cast<tree::TempExp *>(exp)->temp_;
+    return !reg_manager->temp_map_->Look(temp) && !defs_.count(temp);
+  }
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    return IsInvariant(binop->left_) && IsInvariant(binop->right_);
+  }
+  return false;
+}
+
+tree::Exp *StrengthReduction::Replace(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    tree::Exp *base = binop->left_;
+    tree::Exp *offset = binop->right_;
+    for (int order = 0; order < 2 && binop->op_ == tree::PLUS_OP; ++order) {
+      temp::Temp *counter;
+      int scale;
+      if (typeid(*base) == typeid(tree::TempExp) && IsInvariant(base) &&
+          IsScaled(offset, &counter, &scale) && steps_.count(counter) &&
+          scale != 0)
+        return new tree::TempExp(Derive(
+            static_cast<tree::TempExp *>(base)->temp_, counter, scale));
+      std::swap(base, offset);
+    }
+
+    binop->left_ = Replace(binop->left_);
+    binop->right_ = Replace(binop->right_);
+  } else if (typeid(*exp) == typeid(tree::MemExp)) {
+    auto *mem = static_cast<tree::MemExp *>(exp);
+    mem->exp_ = Replace(mem->exp_);
+  } else if (typeid(*exp) == typeid(tree::CallExp)) {
+    for (tree::Exp *&arg :
+         static_cast<tree::CallExp *>(exp)->args_->GetNonConstList())
+      arg = Replace(arg);
+  }
+  return exp;
+}
+
+temp::Temp *StrengthReduction::Derive(temp::Temp *base, temp::Temp *counter,
+                                      int scale) {
+  for (const Derived &derived : derived_)
+    if (derived.base_ == base && derived.counter_ == counter &&
+        derived.scale_ == scale)
+      return derived.temp_;
+  temp::Temp *temp = temp::TempFactory::NewTemp();
+  derived_.push_back({base, counter, scale, temp});
+  return temp;
+}
+
+void StrengthReduction::StepDerived(const Loop &loop) {
+  // Every pointer moves right after its counter, so it is equal to its base
+  // plus the scaled counter wherever it is read
+  for (tree::StmList *block : stm_lists_->GetList()) {
+    if (!loop.blocks_.count(block))
+      continue;
+    std::list<tree::Stm *> &stms = block->GetNonConstList();
+    for (auto it = stms.begin(); it != stms.end(); ++it) {
+      temp::Temp *counter;
+      int step;
+      if (!IsStep(*it, &counter, &step) || !steps_.count(counter))
+        continue;
+      for (const Derived &derived : derived_)
+        if (derived.counter_ == counter)
+          it = stms.insert(
+              std::next(it),
+              new tree::MoveStm(
+                  new tree::TempExp(derived.temp_),
+                  tree::Binop(tree::PLUS_OP, new tree::TempExp(derived.temp_),
+                              tree::Binop(tree::MUL_OP,
+                                          new tree::ConstExp(step),
+                                          new tree::ConstExp(derived.scale_)))));
+    }
+  }
+}
+
+// Every definition of the temporary sets it to a pointer into the heap. Any
+// other sum may wrap around, and then compares otherwise than its counter
+bool StrengthReduction::IsHeapAddress(temp::Temp *temp,
+                                      std::set<temp::Temp *> &visited) {
+  if (temp->IsPointer())
+    return true;
+  if (!visited.insert(temp).second)
+    return true;
+  bool defined = false;
+  for (tree::StmList *block : stm_lists_->GetList())
+    for (tree::Stm *stm : block->GetList()) {
+      if (typeid(*stm) != typeid(tree::MoveStm))
+        continue;
+      auto *move = static_cast<tree::MoveStm *>(stm);
+      if (typeid(*move->dst_) != typeid(tree::TempExp) ||
+          static_cast<tree::TempExp *>(move->dst_)->temp_ != temp)
+        continue;
+      tree::Exp *src = move->src_;
+      bool pointer =
+          (typeid(*src) == typeid(tree::MemExp) &&
+           static_cast<tree::MemExp *>(src)->pointer_) ||
+          (typeid(*src) == typeid(tree::CallExp) &&
+           static_cast<tree::CallExp *>(src)->pointer_) ||
+          (typeid(*src) == typeid(tree::TempExp) &&
+           IsHeapAddress(static_cast<tree::TempExp *>(src)->temp_, visited));
+      if (!pointer)
+        return false;
+      defined = true;
+    }
+  return defined;
+}
+
+void StrengthReduction::ReplaceTests(const Loop &loop, const Derived &derived,
+                                     std::list<tree::Stm *> &preheader) {
+  temp::Temp *counter = derived.counter_;
+  const std::vector<tree::Stm *> &steps = steps_[counter];
+
+  // The counter must be dead once the loop is left, and read in the loop by
+  // its steps and by comparisons with invariants alone
+  std::vector<tree::CjumpStm *> tests;
+  for (tree::StmList *block : stm_lists_->GetList()) {
+    if (!loop.blocks_.count(block)) {
+      if (ReadsIn(block, counter, {}))
+        return;
+      continue;
+    }
+    std::vector<tree::Stm *> skipped = steps;
+    for (tree::Stm *stm : block->GetList()) {
+      if (typeid(*stm) != typeid(tree::CjumpStm))
+        continue;
+      auto *cjump = static_cast<tree::CjumpStm *>(stm);
+      tree::Exp *bound = Reads(cjump->left_, counter) ? cjump->right_
+                                                      : cjump->left_;
+      tree::Exp *side = bound == cjump->left_ ? cjump->right_ : cjump->left_;
+      if (!Reads(side, counter) || typeid(*side) != typeid(tree::TempExp) ||
+          !IsInvariant(bound) || cjump->op_ >= tree::ULT_OP)
+        continue;
+      tests.push_back(cjump);
+      skipped.push_back(stm);
+    }
+    if (ReadsIn(block, counter, skipped))
+      return;
+  }
+
+  // Addresses within an array order the same way as the indices do
+  for (tree::CjumpStm *test : tests) {
+    bool left = Reads(test->left_, counter);
+    tree::Exp *&bound = left ? test->right_ : test->left_;
+    temp::Temp *limit = temp::TempFactory::NewTemp();
+    preheader.push_back(new tree::MoveStm(
+        new tree::TempExp(limit),
+        tree::Binop(tree::PLUS_OP, new tree::TempExp(derived.base_),
+                    tree::Binop(tree::MUL_OP, bound,
+                                new tree::ConstExp(derived.scale_)))));
+    bound = new tree::TempExp(limit);
+    (left ? test->left_ : test->right_) = new tree::TempExp(derived.temp_);
+    if (derived.scale_ < 0)
+      test->op_ = tree::Commute(test->op_);
+  }
+  for (tree::StmList *block : stm_lists_->GetList())
+    if (loop.blocks_.count(block))
+      for (tree::Stm *stm : steps)
+        block->GetNonConstList().remove(stm);
+}
+
+} // namespace canon
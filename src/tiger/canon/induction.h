@@ -0,0 +1,60 @@
+#ifndef TIGER_CANON_INDUCTION_H_
+#define TIGER_CANON_INDUCTION_H_
+
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "tiger/canon/canon.h"
+#include "tiger/canon/loop.h"
+
+namespace canon {
+
+class StrengthReduction {
+public:
+  /**
+   * @param stm_lists basic blocks of canonical trees, rewritten in place
+   */
+  explicit StrengthReduction(StmListList *stm_lists) : stm_lists_(stm_lists) {}
+
+  /**
+   * Step a pointer along with each loop counter an address is computed from
+   * as base + counter * size, instead of multiplying for every element. A
+   * counter read for nothing but its own steps and the loop tests is then
+   * replaced by the pointer in the tests and no longer stepped, when the
+   * base is the address of an array, whose elements the pointer cannot step
+   * past without overflowing
+   */
+  void Optimize();
+
+private:
+  // A temporary kept equal to base + counter * scale all through the loop
+  struct Derived {
+    temp::Temp *base_;
+    temp::Temp *counter_;
+    int scale_;
+    temp::Temp *temp_;
+  };
+
+  StmListList *stm_lists_;
+  // What the loop being optimized defines
+  std::set<temp::Temp *> defs_;
+  // The counters and their steps, the only definitions they have in the loop
+  std::map<temp::Temp *, std::vector<tree::Stm *>> steps_;
+  std::vector<Derived> derived_;
+
+  void Reduce(Loop &loop, std::vector<Loop> &loops);
+  void FindCounters(const Loop &loop);
+  bool IsInvariant(tree::Exp *exp);
+  tree::Exp *Replace(tree::Exp *exp);
+  temp::Temp *Derive(temp::Temp *base, temp::Temp *counter, int scale);
+  void StepDerived(const Loop &loop);
+  bool IsHeapAddress(temp::Temp *temp, std::set<temp::Temp *> &visited);
+  void ReplaceTests(const Loop &loop, const Derived &derived,
+                    std::list<tree::Stm *> &preheader);
+};
+
+} // namespace canon
+
+#endif
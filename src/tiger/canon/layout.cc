@@ -0,0 +1,139 @@
+#include "tiger/canon/layout.h"
+
+#include <algorithm>
+
+namespace {
+
+// The chance in percent that a loop goes on, or that a path to exit is taken
+constexpr int LOOP_CHANCE = 90;
+constexpr int COLD_CHANCE = 5;
+// Entries a measured loop header needs to be aligned
+constexpr long long HOT_COUNT = 64;
+
+bool CallsExit(tree::Stm *stm) {
+  tree::Exp *exp = nullptr;
+  if (typeid(*stm) == typeid(tree::ExpStm))
+    exp = static_cast<tree::ExpStm *>(stm)->exp_;
+  else if (typeid(*stm) == typeid(tree::MoveStm))
+    exp = static_cast<tree::MoveStm *>(stm)->src_;
+  if (!exp || typeid(*exp) != typeid(tree::CallExp))
+    return false;
+  tree::Exp *fun = static_cast<tree::CallExp *>(exp)->fun_;
+  return typeid(*fun) == typeid(tree::NameExp) &&
+         static_cast<tree::NameExp *>(fun)->name_->Name() == "exit";
+}
+
+} // namespace
+
+namespace canon {
+
+void BlockLayout::Optimize() {
+  LoopFinder finder(stm_lists_);
+  BlockGraph &graph = finder.Graph();
+  const std::vector<Loop> &loops = finder.Loops();
+  FindCold(graph);
+
+  for (tree::StmList *block : graph.Blocks()) {
+    tree::Stm *last = block->GetList().back();
+    if (typeid(*last) != typeid(tree::CjumpStm))
+      continue;
+    auto *cjump = static_cast<tree::CjumpStm *>(last);
+    // A back edge goes to a block placed already, the trace turns the jump
+    // by itself
+    tree::StmList *trues = graph.BlockOf(cjump->true_label_);
+    if (TrueChance(graph, loops, block, cjump) <= 50 ||
+        (trues && graph.Dominates(trues, block)))
+      continue;
+    cjump->op_ = tree::NotRel(cjump->op_);
+    std::swap(cjump->true_label_, cjump->false_label_);
+  }
+
+  for (const Loop &loop : loops) {
+    long long count = Count(graph, loop.header_);
+    if (count >= 0 ? count >= HOT_COUNT : !cold_.count(loop.header_))
+      hot_headers_.insert(BlockLabel(loop.header_));
+  }
+
+  // A trace starts from the first block not placed yet, so the cold blocks
+  // are only placed once no other block is left
+  tree::StmList *entry = stm_lists_->GetList().front();
+  std::stable_partition(stm_lists_->GetNonConstList().begin(),
+                        stm_lists_->GetNonConstList().end(),
+                        [this, entry](tree::StmList *block) {
+                          return block == entry || !cold_.count(block);
+                        });
+}
+
+void BlockLayout::FindCold(BlockGraph &graph) {
+  // A block is cold when it calls exit, when the profile never ran it, or
+  // when all of its targets are cold
+  for (tree::StmList *block : graph.Blocks())
+    if (std::any_of(block->GetList().begin(), block->GetList().end(),
+                    CallsExit) ||
+        Count(graph, block) == 0)
+      cold_.insert(block);
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (tree::StmList *block : graph.Blocks()) {
+      if (cold_.count(block))
+        continue;
+      std::vector<temp::Label *> targets = BlockTargets(block);
+      if (std::all_of(targets.begin(), targets.end(),
+                      [this, &graph](temp::Label *target) {
+                        tree::StmList *succ = graph.BlockOf(target);
+                        return succ && cold_.count(succ);
+                      })) {
+        cold_.insert(block);
+        changed = true;
+      }
+    }
+  }
+}
+
+int BlockLayout::TrueChance(BlockGraph &graph, const std::vector<Loop> &loops,
+                            tree::StmList *block, tree::CjumpStm *cjump) {
+  if (counts_) {
+    std::string from = BlockLabel(block)->Name();
+    auto trueCount = counts_->find({from, cjump->true_label_->Name()});
+    auto falseCount = counts_->find({from, cjump->false_label_->Name()});
+    if (trueCount != counts_->end() && falseCount != counts_->end() &&
+        trueCount->second + falseCount->second > 0)
+      return static_cast<int>(trueCount->second * 100 /
+                              (trueCount->second + falseCount->second));
+  }
+
+  tree::StmList *trues = graph.BlockOf(cjump->true_label_);
+  tree::StmList *falses = graph.BlockOf(cjump->false_label_);
+  bool trueCold = trues && cold_.count(trues);
+  bool falseCold = falses && cold_.count(falses);
+  if (trueCold != falseCold)
+    return trueCold ? COLD_CHANCE : 100 - COLD_CHANCE;
+
+  // The innermost loop one target stays in and the other one leaves
+  for (auto loop = loops.rbegin(); loop != loops.rend(); ++loop) {
+    if (!loop->blocks_.count(block))
+      continue;
+    bool trueStays = trues && loop->blocks_.count(trues);
+    bool falseStays = falses && loop->blocks_.count(falses);
+    if (trueStays != falseStays)
+      return trueStays ? LOOP_CHANCE : 100 - LOOP_CHANCE;
+  }
+  return 50;
+}
+
+long long BlockLayout::Count(BlockGraph &graph, tree::StmList *block) {
+  if (!counts_)
+    return -1;
+  long long count = -1;
+  std::string to = BlockLabel(block)->Name();
+  for (tree::StmList *pred : graph.Preds(block)) {
+    auto edge = counts_->find({BlockLabel(pred)->Name(), to});
+    if (edge != counts_->end())
+      count = std::max(count, 0LL) + edge->second;
+  }
+  return count;
+}
+
+} // namespace canon
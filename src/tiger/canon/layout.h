@@ -0,0 +1,58 @@
+#ifndef TIGER_CANON_LAYOUT_H_
+#define TIGER_CANON_LAYOUT_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tiger/canon/canon.h"
+#include "tiger/canon/loop.h"
+
+namespace canon {
+
+// How often each edge between two blocks ran, by the labels of the blocks
+using EdgeCounts = std::map<std::pair<std::string, std::string>, long long>;
+
+class BlockLayout {
+public:
+  /**
+   * @param stm_lists basic blocks of canonical trees, reordered in place
+   * @param counts the edges measured by a profile, nullptr without one
+   */
+  explicit BlockLayout(StmListList *stm_lists,
+                       const EdgeCounts *counts = nullptr)
+      : stm_lists_(stm_lists), counts_(counts) {}
+
+  /**
+   * Turn every conditional jump so that its likelier target is the false
+   * label the trace goes on with, and move the blocks rarely run behind all
+   * the others. The profile decides which target is likelier where it
+   * measured the branch, the heuristics elsewhere: loops go on rather than
+   * end and paths to exit are not taken
+   */
+  void Optimize();
+
+  // Labels of the loop headers that run often, worth aligning
+  [[nodiscard]] const std::set<temp::Label *> &HotHeaders() const {
+    return hot_headers_;
+  }
+
+private:
+  StmListList *stm_lists_;
+  const EdgeCounts *counts_;
+  std::set<tree::StmList *> cold_;
+  std::set<temp::Label *> hot_headers_;
+
+  void FindCold(BlockGraph &graph);
+  // The chance in percent that a conditional jump goes to its true label
+  int TrueChance(BlockGraph &graph, const std::vector<Loop> &loops,
+                 tree::StmList *block, tree::CjumpStm *cjump);
+  // The executions of the edges into a block, -1 when the profile has none
+  long long Count(BlockGraph &graph, tree::StmList *block);
+};
+
+} // namespace canon
+
+#endif
@@ -0,0 +1,343 @@
+#include "tiger/canon/loop.h"
+
+#include <algorithm>
+#include <climits>
+
+#include "tiger/frame/frame.h"
+
+extern frame::RegManager *reg_manager;
+
+namespace {
+
+void Retarget(tree::Stm *stm, temp::Label *from, temp::Label *to) {
+  if (typeid(*stm) == typeid(tree::JumpStm)) {
+    auto *jump = static_cast<tree::JumpStm *>(stm);
+    auto *name = dynamic_cast<tree::NameExp *>(jump->exp_);
+    if (name && name->name_ == from)
+      name->name_ = to;
+    auto *jumps = new std::vector<temp::Label *>(*jump->jumps_);
+    std::replace(jumps->begin(), jumps->end(), from, to);
+    jump->jumps_ = jumps;
+  } else if (typeid(*stm) == typeid(tree::CjumpStm)) {
+    auto *cjump = static_cast<tree::CjumpStm *>(stm);
+    if (cjump->true_label_ == from)
+      cjump->true_label_ = to;
+    if (cjump->false_label_ == from)
+      cjump->false_label_ = to;
+  }
+}
+
+// sp + framesize
+bool IsFrameAddress(tree::Exp *exp) {
+  if (typeid(*exp) != typeid(tree::BinopExp))
+    return false;
+  auto *binop = static_cast<tree::BinopExp *>(exp);
+  return binop->op_ == tree::PLUS_OP &&
+         typeid(*binop->left_) == typeid(tree::TempExp) &&
+         static_cast<tree::TempExp *>(binop->left_)->temp_ ==
+             reg_manager->StackPointer() &&
+         typeid(*binop->right_) == typeid(tree::NameExp);
+}
+
+// Frame slots sit below the frame address, heap fields and elements above
+// their base, so a slot is written through a constant negative offset only
+bool IsFrameOffset(tree::Exp *address) {
+  if (typeid(*address) != typeid(tree::BinopExp))
+    return false;
+  auto *binop = static_cast<tree::BinopExp *>(address);
+  return binop->op_ == tree::MINUS_OP &&
+         typeid(*binop->right_) == typeid(tree::ConstExp);
+}
+
+// A slot of this frame or, through the static links, of an enclosing one.
+// Loading it can never fault, so it may run before the loop decides to
+bool IsFrameSlot(tree::Exp *address) {
+  if (!IsFrameOffset(address))
+    return false;
+  tree::Exp *base = static_cast<tree::BinopExp *>(address)->left_;
+  if (IsFrameAddress(base))
+    return true;
+  return typeid(*base) == typeid(tree::MemExp) &&
+         IsFrameSlot(static_cast<tree::MemExp *>(base)->exp_);
+}
+
+// Structural equality of expressions without side effects
+bool IsSame(tree::Exp *a, tree::Exp *b) {
+  if (typeid(*a) != typeid(*b))
+    return false;
+  if (typeid(*a) == typeid(tree::ConstExp))
+    return static_cast<tree::ConstExp *>(a)->consti_ ==
+           static_cast<tree::ConstExp *>(b)->consti_;
+  if (typeid(*a) == typeid(tree::NameExp))
+    return static_cast<tree::NameExp *>(a)->name_ ==
+           static_cast<tree::NameExp *>(b)->name_;
+  if (typeid(*a) == typeid(tree::TempExp))
+    return static_cast<tree::TempExp *>(a)->temp_ ==
+           static_cast<tree::TempExp *>(b)->temp_;
+  if (typeid(*a) == typeid(tree::MemExp))
+    return IsSame(static_cast<tree::MemExp *>(a)->exp_,
+                  static_cast<tree::MemExp *>(b)->exp_);
+  if (typeid(*a) == typeid(tree::BinopExp)) {
+    auto *left = static_cast<tree::BinopExp *>(a);
+    auto *right = static_cast<tree::BinopExp *>(b);
+    return left->op_ == right->op_ && IsSame(left->left_, right->left_) &&
+           IsSame(left->right_, right->right_);
+  }
+  return false;
+}
+
+bool IsCandidate(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::MemExp))
+    return true;
+  if (typeid(*exp) != typeid(tree::BinopExp))
+    return false;
+  auto *binop = static_cast<tree::BinopExp *>(exp);
+  return binop->op_ == tree::MUL_OP &&
+         typeid(*binop->left_) != typeid(tree::ConstExp) &&
+         typeid(*binop->right_) != typeid(tree::ConstExp);
+}
+
+} // namespace
+
+namespace canon {
+
+LoopFinder::LoopFinder(StmListList *stm_lists) : graph_(stm_lists) {
+  FindLoops();
+}
+
+void LoopFinder::FindLoops() {
+  std::map<tree::StmList *, int> loopOfHeader;
+  for (tree::StmList *block : graph_.Blocks()) {
+    for (tree::StmList *header : graph_.Succs(block)) {
+      // A back edge goes to a block dominating its source
+      if (!graph_.Dominates(header, block))
+        continue;
+      if (!loopOfHeader.count(header)) {
+        loopOfHeader[header] = loops_.size();
+        loops_.push_back({header, {header}});
+      }
+      Loop &loop = loops_[loopOfHeader[header]];
+
+      std::vector<tree::StmList *> worklist = {block};
+      while (!worklist.empty()) {
+        tree::StmList *body = worklist.back();
+        worklist.pop_back();
+        if (!loop.blocks_.insert(body).second)
+          continue;
+        for (tree::StmList *pred : graph_.Preds(body))
+          worklist.push_back(pred);
+      }
+    }
+  }
+
+  // An outer loop is a superset of the loops it contains
+  std::stable_sort(loops_.begin(), loops_.end(),
+                   [](const Loop &a, const Loop &b) {
+                     return a.blocks_.size() > b.blocks_.size();
+                   });
+}
+
+tree::StmList *InsertPreheader(StmListList *stm_lists, Loop &loop,
+                               std::vector<Loop> &loops,
+                               const std::list<tree::Stm *> &stms) {
+  // Every way into the loop from outside now passes the preheader
+  temp::Label *headerLabel = BlockLabel(loop.header_);
+  temp::Label *preheaderLabel = temp::LabelFactory::NewLabel();
+  for (tree::StmList *block : stm_lists->GetList())
+    if (!loop.blocks_.count(block))
+      Retarget(block->GetList().back(), headerLabel, preheaderLabel);
+
+  auto *preheader = new tree::StmList();
+  std::list<tree::Stm *> &preheaderStms = preheader->GetNonConstList();
+  preheaderStms.push_back(new tree::LabelStm(preheaderLabel));
+  preheaderStms.insert(preheaderStms.end(), stms.begin(), stms.end());
+  preheaderStms.push_back(new tree::JumpStm(
+      new tree::NameExp(headerLabel),
+      new std::vector<temp::Label *>({headerLabel})));
+
+  // In front of the header, which may be the entry of the procedure
+  std::list<tree::StmList *> &blocks = stm_lists->GetNonConstList();
+  blocks.insert(std::find(blocks.begin(), blocks.end(), loop.header_),
+                preheader);
+  for (Loop &outer : loops)
+    if (&outer != &loop && outer.blocks_.count(loop.header_))
+      outer.blocks_.insert(preheader);
+  return preheader;
+}
+
+bool IsStep(tree::Stm *stm, temp::Temp **counter, int *step) {
+  if (typeid(*stm) != typeid(tree::MoveStm))
+    return false;
+  auto *move = static_cast<tree::MoveStm *>(stm);
+  if (typeid(*move->dst_) != typeid(tree::TempExp) ||
+      typeid(*move->src_) != typeid(tree::BinopExp))
+    return false;
+  temp::Temp *dst = static_cast<tree::TempExp *>(move->dst_)->temp_;
+  auto *binop = static_cast<tree::BinopExp *>(move->src_);
+  tree::Exp *other;
+  if (typeid(*binop->left_) == typeid(tree::TempExp) &&
+      static_cast<tree::TempExp *>(binop->left_)->temp_ == dst)
+    other = binop->right_;
+  else if (binop->op_ == tree::PLUS_OP &&
+           typeid(*binop->right_) == typeid(tree::TempExp) &&
+           static_cast<tree::TempExp *>(binop->right_)->temp_ == dst)
+    other = binop->left_;
+  else
+    return false;
+  if (typeid(*other) != typeid(tree::ConstExp))
+    return false;
+
+  int value = static_cast<tree::ConstExp *>(other)->consti_;
+  if (binop->op_ == tree::PLUS_OP)
+    *step = value;
+  else if (binop->op_ == tree::MINUS_OP && value != INT_MIN)
+    *step = -value;
+  else
+    return false;
+  *counter = dst;
+  return true;
+}
+
+void LoopInvariantMotion::Optimize() {
+  // Whatever is invariant in a loop is invariant in the loops inside it, so
+  // the outer loops go first and move it the furthest
+  LoopFinder finder(stm_lists_);
+  std::vector<Loop> &loops = finder.Loops();
+  FindFrameTemps();
+  for (Loop &loop : loops)
+    Hoist(loop, loops);
+}
+
+void LoopInvariantMotion::FindFrameTemps() {
+  frame_temps_.clear();
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (tree::StmList *block : stm_lists_->GetList())
+      for (tree::Stm *stm : block->GetList()) {
+        if (typeid(*stm) != typeid(tree::MoveStm))
+          continue;
+        auto *move = static_cast<tree::MoveStm *>(stm);
+        if (typeid(*move->dst_) == typeid(tree::TempExp) &&
+            MayAddressFrame(move->src_) &&
+            frame_temps_.insert(static_cast<tree::TempExp *>(move->dst_)->temp_)
+                .second)
+          changed = true;
+      }
+  }
+}
+
+// Frame addresses start at the stack pointer and reach the enclosing frames
+// through the static links, which are always kept in the first slot
+bool LoopInvariantMotion::MayAddressFrame(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::TempExp)) {
+    temp::Temp *temp = static_cast<tree::TempExp *>(exp)->temp_;
+    return temp == reg_manager->StackPointer() || frame_temps_.count(temp);
+  }
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    return MayAddressFrame(binop->left_) || MayAddressFrame(binop->right_);
+  }
+  if (typeid(*exp) == typeid(tree::MemExp)) {
+    tree::Exp *address = static_cast<tree::MemExp *>(exp)->exp_;
+    if (!IsFrameOffset(address))
+      return false;
+    auto *binop = static_cast<tree::BinopExp *>(address);
+    return static_cast<tree::ConstExp *>(binop->right_)->consti_ ==
+               reg_manager->WordSize() &&
+           MayAddressFrame(binop->left_);
+  }
+  return false;
+}
+
+void LoopInvariantMotion::Hoist(Loop &loop, std::vector<Loop> &loops) {
+  FindWrites(loop);
+  std::list<tree::Stm *> hoisted;
+  for (tree::StmList *block : stm_lists_->GetList()) {
+    if (!loop.blocks_.count(block))
+      continue;
+    for (tree::Stm *stm : block->GetList())
+      for (tree::Exp **operand : Operands(stm))
+        *operand = Replace(*operand, hoisted);
+  }
+  if (!hoisted.empty())
+    InsertPreheader(stm_lists_, loop, loops, hoisted);
+}
+
+void LoopInvariantMotion::FindWrites(const Loop &loop) {
+  defs_.clear();
+  writes_frame_ = false;
+  calls_ = false;
+  for (tree::StmList *block : loop.blocks_) {
+    for (tree::Stm *stm : block->GetList()) {
+      if (typeid(*stm) == typeid(tree::MoveStm)) {
+        auto *move = static_cast<tree::MoveStm *>(stm);
+        if (typeid(*move->dst_) == typeid(tree::TempExp))
+          defs_.insert(static_cast<tree::TempExp *>(move->dst_)->temp_);
+        else if (IsFrameOffset(static_cast<tree::MemExp *>(move->dst_)->exp_) ||
+                 MayAddressFrame(
+                     static_cast<tree::MemExp *>(move->dst_)->exp_))
+          writes_frame_ = true;
+        if (typeid(*move->src_) == typeid(tree::CallExp))
+          calls_ = true;
+      } else if (typeid(*stm) == typeid(tree::ExpStm) &&
+                 typeid(*static_cast<tree::ExpStm *>(stm)->exp_) ==
+                     typeid(tree::CallExp)) {
+        calls_ = true;
+      }
+    }
+  }
+}
+
+bool LoopInvariantMotion::IsInvariant(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::ConstExp) ||
+      typeid(*exp) == typeid(tree::NameExp))
+    return true;
+  if (typeid(*exp) == typeid(tree::TempExp)) {
+    temp::Temp *temp = static_cast<tree::TempExp *>(exp)->temp_;
+    if (temp == reg_manager->StackPointer())
+      return true;
+    return !reg_manager->temp_map_->Look(temp) && !defs_.count(temp);
+  }
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    return IsInvariant(binop->left_) && IsInvariant(binop->right_);
+  }
+  if (typeid(*exp) == typeid(tree::MemExp)) {
+    tree::Exp *address = static_cast<tree::MemExp *>(exp)->exp_;
+    return !writes_frame_ && !calls_ && IsFrameSlot(address) &&
+           IsInvariant(address);
+  }
+  return false;
+}
+
+tree::Exp *LoopInvariantMotion::Replace(tree::Exp *exp,
+                                        std::list<tree::Stm *> &hoisted) {
+  if (IsCandidate(exp) && IsInvariant(exp)) {
+    for (tree::Stm *stm : hoisted) {
+      auto *move = static_cast<tree::MoveStm *>(stm);
+      if (IsSame(move->src_, exp))
+        return new tree::TempExp(
+            static_cast<tree::TempExp *>(move->dst_)->temp_);
+    }
+    temp::Temp *value = temp::TempFactory::NewTemp();
+    hoisted.push_back(new tree::MoveStm(new tree::TempExp(value), exp));
+    return new tree::TempExp(value);
+  }
+
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    binop->left_ = Replace(binop->left_, hoisted);
+    binop->right_ = Replace(binop->right_, hoisted);
+  } else if (typeid(*exp) == typeid(tree::MemExp)) {
+    auto *mem = static_cast<tree::MemExp *>(exp);
+    mem->exp_ = Replace(mem->exp_, hoisted);
+  } else if (typeid(*exp) == typeid(tree::CallExp)) {
+    for (tree::Exp *&arg :
+         static_cast<tree::CallExp *>(exp)->args_->GetNonConstList())
+      arg = Replace(arg, hoisted);
+  }
+  return exp;
+}
+
+} // namespace canon
@@ -0,0 +1,87 @@
+#ifndef TIGER_CANON_LOOP_H_
+#define TIGER_CANON_LOOP_H_
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "tiger/canon/blockgraph.h"
+#include "tiger/canon/canon.h"
+
+namespace canon {
+
+// A natural loop of the basic block graph
+struct Loop {
+  tree::StmList *header_;
+  std::set<tree::StmList *> blocks_;
+};
+
+class LoopFinder {
+public:
+  /**
+   * Find the natural loops from the back edges of the dominator tree
+   * @param stm_lists basic blocks, the first one is the entry
+   */
+  explicit LoopFinder(StmListList *stm_lists);
+
+  // Outermost loops come first, loops sharing a header are merged
+  [[nodiscard]] std::vector<Loop> &Loops() { return loops_; }
+  [[nodiscard]] BlockGraph &Graph() { return graph_; }
+
+private:
+  BlockGraph graph_;
+  std::vector<Loop> loops_;
+
+  void FindLoops();
+};
+
+/**
+ * Run statements once before a loop, in a new block every entry into the
+ * loop from outside passes. The block joins the loops around the loop
+ * @param stms statements ending without a jump
+ * @return the new block, ending with the jump to the header
+ */
+tree::StmList *InsertPreheader(StmListList *stm_lists, Loop &loop,
+                               std::vector<Loop> &loops,
+                               const std::list<tree::Stm *> &stms);
+
+/**
+ * Whether a statement is t := t + c or t := t - c
+ * @param step set to the constant added
+ */
+bool IsStep(tree::Stm *stm, temp::Temp **counter, int *step);
+
+class LoopInvariantMotion {
+public:
+  /**
+   * @param stm_lists basic blocks of canonical trees, rewritten in place
+   */
+  explicit LoopInvariantMotion(StmListList *stm_lists)
+      : stm_lists_(stm_lists) {}
+
+  /**
+   * Compute the loads and products that stay the same in every iteration
+   * once, in a preheader block in front of the loop header
+   */
+  void Optimize();
+
+private:
+  StmListList *stm_lists_;
+  // Temporaries that may hold the address of a frame or of a slot in one
+  std::set<temp::Temp *> frame_temps_;
+  // What the loop being optimized writes
+  std::set<temp::Temp *> defs_;
+  bool writes_frame_ = false;
+  bool calls_ = false;
+
+  void FindFrameTemps();
+  bool MayAddressFrame(tree::Exp *exp);
+  void Hoist(Loop &loop, std::vector<Loop> &loops);
+  void FindWrites(const Loop &loop);
+  bool IsInvariant(tree::Exp *exp);
+  tree::Exp *Replace(tree::Exp *exp, std::list<tree::Stm *> &hoisted);
+};
+
+} // namespace canon
+
+#endif
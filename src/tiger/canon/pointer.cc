@@ -0,0 +1,131 @@
+#include "tiger/canon/pointer.h"
+
+#include <algorithm>
+
+#include "tiger/frame/frame.h"
+
+extern frame::RegManager *reg_manager;
+
+namespace {
+
+// The temporary a move sets, nullptr for a machine register or a store
+temp::Temp *MovedTo(tree::Stm *stm) {
+  if (typeid(*stm) != typeid(tree::MoveStm))
+    return nullptr;
+  auto *move = static_cast<tree::MoveStm *>(stm);
+  if (typeid(*move->dst_) != typeid(tree::TempExp))
+    return nullptr;
+  temp::Temp *dst = static_cast<tree::TempExp *>(move->dst_)->temp_;
+  return reg_manager->temp_map_->Look(dst) ? nullptr : dst;
+}
+
+tree::Stm *Move(temp::Temp *dst, tree::Exp *src) {
+  return new tree::MoveStm(new tree::TempExp(dst), src);
+}
+
+} // namespace
+
+namespace canon {
+
+void PointerTracking::Track() {
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (tree::StmList *block : stm_lists_->GetList())
+      for (tree::Stm *stm : block->GetList()) {
+        temp::Temp *dst = MovedTo(stm);
+        if (!dst)
+          continue;
+        auto *move = static_cast<tree::MoveStm *>(stm);
+        Kind kind = KindOf(move->dst_);
+        Kind moved = std::max(kind, KindOf(move->src_));
+        if (moved != kind) {
+          kinds_[dst] = moved;
+          changed = true;
+        }
+      }
+  }
+
+  for (const auto &[reg, kind] : kinds_) {
+    if (kind == POINTER) {
+      reg->MarkPointer();
+    } else if (kind == DERIVED) {
+      temp::Temp *base = temp::TempFactory::NewTemp();
+      base->MarkPointer();
+      reg->MarkPointer(base);
+    }
+  }
+
+  for (tree::StmList *block : stm_lists_->GetList())
+    SetBases(block);
+}
+
+PointerTracking::Kind PointerTracking::KindOf(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::TempExp)) {
+    temp::Temp *reg = static_cast<tree::TempExp *>(exp)->temp_;
+    auto kind = kinds_.find(reg);
+    if (kind != kinds_.end())
+      return kind->second;
+    return reg->IsPointer() ? POINTER : NONE;
+  }
+  if (typeid(*exp) == typeid(tree::MemExp))
+    return static_cast<tree::MemExp *>(exp)->pointer_ ? POINTER : NONE;
+  if (typeid(*exp) == typeid(tree::CallExp))
+    return static_cast<tree::CallExp *>(exp)->pointer_ ? POINTER : NONE;
+  if (typeid(*exp) != typeid(tree::BinopExp))
+    return NONE;
+
+  // An offset added to a pointer or taken off it
+  auto *binop = static_cast<tree::BinopExp *>(exp);
+  bool derived =
+      (binop->op_ == tree::PLUS_OP &&
+       (KindOf(binop->left_) != NONE || KindOf(binop->right_) != NONE)) ||
+      (binop->op_ == tree::MINUS_OP && KindOf(binop->left_) != NONE);
+  return derived ? DERIVED : NONE;
+}
+
+// The operand of a sum a pointer into the middle of an object is computed
+// from
+tree::Exp **PointerTracking::BaseOf(tree::Exp **exp) {
+  if (typeid(**exp) != typeid(tree::BinopExp))
+    return KindOf(*exp) != NONE ? exp : nullptr;
+  auto *binop = static_cast<tree::BinopExp *>(*exp);
+  if (binop->op_ != tree::PLUS_OP && binop->op_ != tree::MINUS_OP)
+    return nullptr;
+  tree::Exp **base = BaseOf(&binop->left_);
+  if (!base && binop->op_ == tree::PLUS_OP)
+    base = BaseOf(&binop->right_);
+  return base;
+}
+
+void PointerTracking::SetBases(tree::StmList *block) {
+  std::list<tree::Stm *> &stms = block->GetNonConstList();
+  for (auto it = stms.begin(); it != stms.end(); ++it) {
+    temp::Temp *dst = MovedTo(*it);
+    if (!dst || !dst->Base())
+      continue;
+    auto *move = static_cast<tree::MoveStm *>(*it);
+
+    // A pointer to the start of an object is its own start
+    if (KindOf(move->src_) != DERIVED) {
+      it = stms.insert(std::next(it), Move(dst->Base(), new tree::TempExp(dst)));
+      continue;
+    }
+
+    // Otherwise the start is the one of the pointer the sum is taken from,
+    // read before the move overwrites it
+    tree::Exp **base = BaseOf(&move->src_);
+    if (typeid(**base) == typeid(tree::TempExp)) {
+      temp::Temp *from = static_cast<tree::TempExp *>(*base)->temp_;
+      if (from != dst)
+        stms.insert(it, Move(dst->Base(),
+                             new tree::TempExp(from->Base() ? from->Base()
+                                                            : from)));
+    } else {
+      stms.insert(it, Move(dst->Base(), *base));
+      *base = new tree::TempExp(dst->Base());
+    }
+  }
+}
+
+} // namespace canon
@@ -0,0 +1,41 @@
+#ifndef TIGER_CANON_POINTER_H_
+#define TIGER_CANON_POINTER_H_
+
+#include <map>
+
+#include "tiger/canon/canon.h"
+
+namespace canon {
+
+class PointerTracking {
+public:
+  /**
+   * @param stm_lists basic blocks of canonical trees, rewritten in place
+   */
+  explicit PointerTracking(StmListList *stm_lists) : stm_lists_(stm_lists) {}
+
+  /**
+   * Mark every temporary that may hold a pointer to an object the collector
+   * moves, starting from the loads, calls and temporaries translation
+   * marked. A temporary set to a sum with such a pointer may point into the
+   * middle of an object, as the ones strength reduction steps through an
+   * array do. It gets a temporary of its own set to the start of the object
+   * at each of its definitions, so the collector moves both together
+   */
+  void Track();
+
+private:
+  // Ordered so that a temporary takes the largest kind of its definitions
+  enum Kind { NONE, POINTER, DERIVED };
+
+  StmListList *stm_lists_;
+  std::map<temp::Temp *, Kind> kinds_;
+
+  Kind KindOf(tree::Exp *exp);
+  tree::Exp **BaseOf(tree::Exp **exp);
+  void SetBases(tree::StmList *block);
+};
+
+} // namespace canon
+
+#endif
@@ -0,0 +1,153 @@
+#include "tiger/canon/ssa.h"
+
+#include <set>
+
+#include "tiger/frame/frame.h"
+
+extern frame::RegManager *reg_manager;
+
+namespace {
+
+// Machine registers change behind the tree and keep no values
+bool IsTracked(temp::Temp *temp) { return !reg_manager->temp_map_->Look(temp); }
+
+// Uses sharing a node would share a value
+tree::Exp *Unshare(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::TempExp))
+    return new tree::TempExp(static_cast<tree::TempExp *>(exp)->temp_);
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    binop->left_ = Unshare(binop->left_);
+    binop->right_ = Unshare(binop->right_);
+  } else if (typeid(*exp) == typeid(tree::MemExp)) {
+    auto *mem = static_cast<tree::MemExp *>(exp);
+    mem->exp_ = Unshare(mem->exp_);
+  } else if (typeid(*exp) == typeid(tree::CallExp)) {
+    for (tree::Exp *&arg :
+         static_cast<tree::CallExp *>(exp)->args_->GetNonConstList())
+      arg = Unshare(arg);
+  }
+  return exp;
+}
+
+temp::Temp *DefinedTemp(tree::Stm *stm) {
+  if (typeid(*stm) != typeid(tree::MoveStm))
+    return nullptr;
+  tree::Exp *dst = static_cast<tree::MoveStm *>(stm)->dst_;
+  if (typeid(*dst) != typeid(tree::TempExp))
+    return nullptr;
+  temp::Temp *temp = static_cast<tree::TempExp *>(dst)->temp_;
+  return IsTracked(temp) ? temp : nullptr;
+}
+
+} // namespace
+
+namespace canon {
+
+SSA::SSA(StmListList *stm_lists) : graph_(stm_lists) {
+  for (tree::StmList *block : graph_.Blocks()) {
+    for (tree::Stm *stm : block->GetList())
+      for (tree::Exp **operand : Operands(stm))
+        *operand = Unshare(*operand);
+    if (graph_.ImmediateDominator(block))
+      children_[graph_.ImmediateDominator(block)].push_back(block);
+  }
+
+  PlacePhis();
+  if (!graph_.Blocks().empty())
+    Rename(graph_.Blocks().front());
+}
+
+int SSA::ValueOf(tree::TempExp *use) {
+  auto it = uses_.find(use);
+  return it == uses_.end() ? NO_VALUE : it->second;
+}
+
+int SSA::DefinedBy(tree::Stm *stm) {
+  auto it = defs_.find(stm);
+  return it == defs_.end() ? NO_VALUE : it->second;
+}
+
+void SSA::PlacePhis() {
+  std::map<temp::Temp *, std::set<tree::StmList *>> defSites;
+  std::vector<temp::Temp *> temps;
+  for (tree::StmList *block : graph_.Blocks()) {
+    for (tree::Stm *stm : block->GetList()) {
+      temp::Temp *temp = DefinedTemp(stm);
+      if (!temp)
+        continue;
+      if (!defSites.count(temp))
+        temps.push_back(temp);
+      defSites[temp].insert(block);
+    }
+  }
+
+  // A phi is a definition too, so the frontier is iterated
+  for (temp::Temp *temp : temps) {
+    std::set<tree::StmList *> hasPhi;
+    std::vector<tree::StmList *> worklist(defSites[temp].begin(),
+                                          defSites[temp].end());
+    while (!worklist.empty()) {
+      tree::StmList *block = worklist.back();
+      worklist.pop_back();
+      for (tree::StmList *frontier : graph_.Frontier(block)) {
+        if (!hasPhi.insert(frontier).second)
+          continue;
+        phis_[frontier].push_back({temp, value_count_++, {}});
+        if (!defSites[temp].count(frontier))
+          worklist.push_back(frontier);
+      }
+    }
+  }
+}
+
+void SSA::Rename(tree::StmList *block) {
+  std::vector<temp::Temp *> pushed;
+  for (Phi &phi : phis_[block]) {
+    stacks_[phi.temp_].push_back(phi.value_);
+    pushed.push_back(phi.temp_);
+  }
+  for (tree::Stm *stm : block->GetList()) {
+    for (tree::Exp **operand : Operands(stm))
+      RecordUses(*operand);
+    temp::Temp *temp = DefinedTemp(stm);
+    if (!temp)
+      continue;
+    defs_[stm] = value_count_;
+    stacks_[temp].push_back(value_count_++);
+    pushed.push_back(temp);
+  }
+
+  for (tree::StmList *succ : graph_.Succs(block)) {
+    for (Phi &phi : phis_[succ]) {
+      std::vector<int> &stack = stacks_[phi.temp_];
+      phi.args_[block] = stack.empty() ? NO_VALUE : stack.back();
+    }
+  }
+  for (tree::StmList *child : children_[block])
+    Rename(child);
+
+  for (temp::Temp *temp : pushed)
+    stacks_[temp].pop_back();
+}
+
+void SSA::RecordUses(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::TempExp)) {
+    auto *use = static_cast<tree::TempExp *>(exp);
+    if (!IsTracked(use->temp_))
+      return;
+    std::vector<int> &stack = stacks_[use->temp_];
+    uses_[use] = stack.empty() ? NO_VALUE : stack.back();
+  } else if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    RecordUses(binop->left_);
+    RecordUses(binop->right_);
+  } else if (typeid(*exp) == typeid(tree::MemExp)) {
+    RecordUses(static_cast<tree::MemExp *>(exp)->exp_);
+  } else if (typeid(*exp) == typeid(tree::CallExp)) {
+    for (tree::Exp *arg : static_cast<tree::CallExp *>(exp)->args_->GetList())
+      RecordUses(arg);
+  }
+}
+
+} // namespace canon
@@ -0,0 +1,61 @@
+#ifndef TIGER_CANON_SSA_H_
+#define TIGER_CANON_SSA_H_
+
+#include <map>
+#include <vector>
+
+#include "tiger/canon/blockgraph.h"
+#include "tiger/canon/canon.h"
+
+namespace canon {
+
+// Where the definitions of a temporary meet, one argument per predecessor
+struct Phi {
+  temp::Temp *temp_;
+  int value_;
+  std::map<tree::StmList *, int> args_;
+};
+
+class SSA {
+public:
+  static const int NO_VALUE = -1;
+
+  /**
+   * Give every definition of a temporary in the blocks the entry reaches a
+   * value of its own and place the phi functions by the dominance
+   * frontiers. The values are kept beside the tree instead of renaming the
+   * temporaries, so as long as a pass only replaces uses by what their value
+   * is known to be, leaving SSA form is dropping the phi functions
+   * @param stm_lists basic blocks of canonical trees, every temporary use
+   * gets a node of its own
+   */
+  explicit SSA(StmListList *stm_lists);
+
+  [[nodiscard]] BlockGraph &Graph() { return graph_; }
+  [[nodiscard]] std::vector<Phi> &Phis(tree::StmList *block) {
+    return phis_[block];
+  }
+  [[nodiscard]] int ValueCount() const { return value_count_; }
+
+  // NO_VALUE for machine registers and reads before any definition
+  [[nodiscard]] int ValueOf(tree::TempExp *use);
+  // The value a move to a temporary defines, NO_VALUE for other statements
+  [[nodiscard]] int DefinedBy(tree::Stm *stm);
+
+private:
+  BlockGraph graph_;
+  std::map<tree::StmList *, std::vector<Phi>> phis_;
+  std::map<tree::TempExp *, int> uses_;
+  std::map<tree::Stm *, int> defs_;
+  int value_count_ = 0;
+  std::map<tree::StmList *, std::vector<tree::StmList *>> children_;
+  std::map<temp::Temp *, std::vector<int>> stacks_;
+
+  void PlacePhis();
+  void Rename(tree::StmList *block);
+  void RecordUses(tree::Exp *exp);
+};
+
+} // namespace canon
+
+#endif
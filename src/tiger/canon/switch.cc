@@ -0,0 +1,185 @@
+#include "tiger/canon/switch.h"
+
+#include <algorithm>
+
+#include "tiger/frame/frame.h"
+
+extern frame::RegManager *reg_manager;
+extern frame::Frags *frags;
+
+namespace {
+
+// Shorter chains are left to test one constant after the other
+constexpr int MIN_CASES = 4;
+// Cases a binary search still tests one after the other
+constexpr int LINEAR_CASES = 3;
+// A table may have up to this many entries for each case it dispatches
+constexpr int TABLE_DENSITY = 3;
+
+// x = c or x <> c, with the labels taken when they are equal and when not
+bool IsCaseTest(tree::Stm *stm, temp::Temp **value, int *constant,
+                temp::Label **equal, temp::Label **unequal) {
+  if (typeid(*stm) != typeid(tree::CjumpStm))
+    return false;
+  auto *cjump = static_cast<tree::CjumpStm *>(stm);
+  if (cjump->op_ != tree::EQ_OP && cjump->op_ != tree::NE_OP)
+    return false;
+  tree::Exp *left = cjump->left_;
+  tree::Exp *right = cjump->right_;
+  if (typeid(*left) == typeid(tree::ConstExp))
+    std::swap(left, right);
+  if (typeid(*left) != typeid(tree::TempExp) ||
+      typeid(*right) != typeid(tree::ConstExp))
+    return false;
+  *value = static_cast<tree::TempExp *>(left)->temp_;
+  *constant = static_cast<tree::ConstExp *>(right)->consti_;
+  bool eq = cjump->op_ == tree::EQ_OP;
+  *equal = eq ? cjump->true_label_ : cjump->false_label_;
+  *unequal = eq ? cjump->false_label_ : cjump->true_label_;
+  return true;
+}
+
+} // namespace
+
+namespace canon {
+
+void SwitchLowering::Optimize() {
+  BlockGraph graph(stm_lists_);
+  for (tree::StmList *block : graph.Blocks())
+    if (!removed_.count(block))
+      Lower(graph, block);
+  stm_lists_->GetNonConstList().remove_if(
+      [this](tree::StmList *block) { return removed_.count(block); });
+}
+
+void SwitchLowering::Lower(BlockGraph &graph, tree::StmList *block) {
+  temp::Temp *value;
+  int constant;
+  temp::Label *equal;
+  temp::Label *otherwise;
+  if (!IsCaseTest(block->GetList().back(), &value, &constant, &equal,
+                  &otherwise))
+    return;
+
+  // Every further test is alone in a block only the previous test reaches
+  std::vector<Case> cases = {{constant, equal}};
+  std::vector<tree::StmList *> chain;
+  while (true) {
+    tree::StmList *next = graph.BlockOf(otherwise);
+    temp::Temp *nextValue;
+    temp::Label *nextOtherwise;
+    if (!next || next == block || removed_.count(next) ||
+        next->GetList().size() != 2 || graph.Preds(next).size() != 1 ||
+        !IsCaseTest(next->GetList().back(), &nextValue, &constant, &equal,
+                    &nextOtherwise) ||
+        nextValue != value)
+      break;
+    chain.push_back(next);
+    // A constant tested again never takes its later branch
+    if (std::none_of(cases.begin(), cases.end(), [constant](const Case &c) {
+          return c.value_ == constant;
+        }))
+      cases.push_back({constant, equal});
+    otherwise = nextOtherwise;
+  }
+  if (cases.size() < MIN_CASES)
+    return;
+
+  removed_.insert(chain.begin(), chain.end());
+  std::sort(cases.begin(), cases.end(), [](const Case &a, const Case &b) {
+    return a.value_ < b.value_;
+  });
+  block->GetNonConstList().pop_back();
+  long long range =
+      static_cast<long long>(cases.back().value_) - cases.front().value_ + 1;
+  if (jump_tables_ &&
+      range <= TABLE_DENSITY * static_cast<long long>(cases.size()))
+    Dispatch(block, value, cases, otherwise);
+  else
+    block->GetNonConstList().push_back(
+        Search(value, cases, 0, static_cast<int>(cases.size()) - 1,
+               otherwise));
+
+  std::list<tree::StmList *> &blocks = stm_lists_->GetNonConstList();
+  blocks.splice(std::next(std::find(blocks.begin(), blocks.end(), block)),
+                added_);
+}
+
+void SwitchLowering::Dispatch(tree::StmList *block, temp::Temp *value,
+                              const std::vector<Case> &cases,
+                              temp::Label *otherwise) {
+  int low = cases.front().value_;
+  int range = cases.back().value_ - low + 1;
+  std::vector<temp::Label *> targets(range, otherwise);
+  for (const Case &c : cases)
+    targets[c.value_ - low] = c.target_;
+  temp::Label *table = temp::LabelFactory::NewLabel();
+  frags->PushBack(new frame::JumpTableFrag(table, targets));
+
+  // Values below the first case wrap around to large indices, so a single
+  // unsigned comparison bounds the index
+  std::list<tree::Stm *> &stms = block->GetNonConstList();
+  temp::Temp *index = value;
+  if (low != 0) {
+    index = temp::TempFactory::NewTemp();
+    stms.push_back(new tree::MoveStm(
+        new tree::TempExp(index),
+        new tree::BinopExp(tree::MINUS_OP, new tree::TempExp(value),
+                           new tree::ConstExp(low))));
+  }
+
+  // Each entry is the offset of its target from the table
+  temp::Temp *base = temp::TempFactory::NewTemp();
+  auto *jumps = new std::vector<temp::Label *>();
+  for (temp::Label *target : targets)
+    if (std::find(jumps->begin(), jumps->end(), target) == jumps->end())
+      jumps->push_back(target);
+  temp::Label *dispatch = NewBlock(
+      {new tree::MoveStm(new tree::TempExp(base), new tree::NameExp(table)),
+       new tree::JumpStm(
+           new tree::BinopExp(
+               tree::PLUS_OP, new tree::TempExp(base),
+               new tree::MemExp(new tree::BinopExp(
+                   tree::PLUS_OP, new tree::TempExp(base),
+                   new tree::BinopExp(
+                       tree::MUL_OP, new tree::TempExp(index),
+                       new tree::ConstExp(reg_manager->WordSize()))))),
+           jumps)});
+  stms.push_back(new tree::CjumpStm(tree::UGT_OP, new tree::TempExp(index),
+                                    new tree::ConstExp(range - 1), otherwise,
+                                    dispatch));
+}
+
+tree::Stm *SwitchLowering::Search(temp::Temp *value,
+                                  const std::vector<Case> &cases, int lo,
+                                  int hi, temp::Label *otherwise) {
+  if (hi - lo < LINEAR_CASES) {
+    temp::Label *next = otherwise;
+    for (int i = hi; i > lo; --i)
+      next = NewBlock({new tree::CjumpStm(
+          tree::EQ_OP, new tree::TempExp(value),
+          new tree::ConstExp(cases[i].value_), cases[i].target_, next)});
+    return new tree::CjumpStm(tree::EQ_OP, new tree::TempExp(value),
+                              new tree::ConstExp(cases[lo].value_),
+                              cases[lo].target_, next);
+  }
+
+  int mid = (lo + hi + 1) / 2;
+  temp::Label *below = NewBlock({Search(value, cases, lo, mid - 1, otherwise)});
+  temp::Label *above = NewBlock({Search(value, cases, mid, hi, otherwise)});
+  return new tree::CjumpStm(tree::LT_OP, new tree::TempExp(value),
+                            new tree::ConstExp(cases[mid].value_), below,
+                            above);
+}
+
+temp::Label *SwitchLowering::NewBlock(const std::list<tree::Stm *> &stms) {
+  temp::Label *label = temp::LabelFactory::NewLabel();
+  auto *block = new tree::StmList();
+  block->GetNonConstList().push_back(new tree::LabelStm(label));
+  block->GetNonConstList().insert(block->GetNonConstList().end(), stms.begin(),
+                                  stms.end());
+  added_.push_back(block);
+  return label;
+}
+
+} // namespace canon
@@ -0,0 +1,53 @@
+#ifndef TIGER_CANON_SWITCH_H_
+#define TIGER_CANON_SWITCH_H_
+
+#include <list>
+#include <set>
+#include <vector>
+
+#include "tiger/canon/blockgraph.h"
+#include "tiger/canon/canon.h"
+
+namespace canon {
+
+class SwitchLowering {
+public:
+  /**
+   * @param stm_lists basic blocks of canonical trees, rewritten in place
+   * @param jump_tables whether the cases may be dispatched by an indirect
+   * jump through a table in the read-only data
+   */
+  SwitchLowering(StmListList *stm_lists, bool jump_tables)
+      : stm_lists_(stm_lists), jump_tables_(jump_tables) {}
+
+  /**
+   * Find the chains of blocks testing one temporary for equality with a
+   * constant each, and dispatch on all of the constants at once: through a
+   * jump table when they are dense, by a binary search over them otherwise
+   */
+  void Optimize();
+
+private:
+  struct Case {
+    int value_;
+    temp::Label *target_;
+  };
+
+  StmListList *stm_lists_;
+  bool jump_tables_;
+  std::set<tree::StmList *> removed_;
+  // Blocks made for the chain being lowered
+  std::list<tree::StmList *> added_;
+
+  void Lower(BlockGraph &graph, tree::StmList *block);
+  void Dispatch(tree::StmList *block, temp::Temp *value,
+                const std::vector<Case> &cases, temp::Label *otherwise);
+  // The test deciding between the cases from lo to hi
+  tree::Stm *Search(temp::Temp *value, const std::vector<Case> &cases, int lo,
+                    int hi, temp::Label *otherwise);
+  temp::Label *NewBlock(const std::list<tree::Stm *> &stms);
+};
+
+} // namespace canon
+
+#endif
@@ -0,0 +1,346 @@
+#include "tiger/canon/unroll.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+#include "tiger/canon/blockgraph.h"
+#include "tiger/frame/frame.h"
+
+extern frame::RegManager *reg_manager;
+
+namespace {
+
+// Tree nodes the copies of a body may take together
+constexpr int UNROLL_BUDGET = 96;
+// Blocks searched back from a loop for how its counter and bound start
+constexpr int ENTRY_BLOCKS = 8;
+// Larger offsets are not followed, so the arithmetic never overflows
+constexpr long long OFFSET_RANGE = 1LL << 40;
+
+tree::Exp *CloneExp(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    return new tree::BinopExp(binop->op_, CloneExp(binop->left_),
+                              CloneExp(binop->right_));
+  }
+  if (typeid(*exp) == typeid(tree::MemExp)) {
+    auto *mem = static_cast<tree::MemExp *>(exp);
+    return new tree::MemExp(CloneExp(mem->exp_), mem->pointer_);
+  }
+  if (typeid(*exp) == typeid(tree::TempExp))
+    return new tree::TempExp(static_cast<tree::TempExp *>(exp)->temp_);
+  if (typeid(*exp) == typeid(tree::ConstExp))
+    return new tree::ConstExp(static_cast<tree::ConstExp *>(exp)->consti_);
+  if (typeid(*exp) == typeid(tree::NameExp))
+    return new tree::NameExp(static_cast<tree::NameExp *>(exp)->name_);
+  auto *call = static_cast<tree::CallExp *>(exp);
+  auto *args = new tree::ExpList();
+  for (tree::Exp *arg : call->args_->GetList())
+    args->Append(CloneExp(arg));
+  return new tree::CallExp(CloneExp(call->fun_), args, call->pointer_);
+}
+
+// Statements of a block between its label and its jump
+tree::Stm *CloneStm(tree::Stm *stm) {
+  if (typeid(*stm) == typeid(tree::MoveStm)) {
+    auto *move = static_cast<tree::MoveStm *>(stm);
+    return new tree::MoveStm(CloneExp(move->dst_), CloneExp(move->src_));
+  }
+  return new tree::ExpStm(CloneExp(static_cast<tree::ExpStm *>(stm)->exp_));
+}
+
+int Size(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    return 1 + Size(binop->left_) + Size(binop->right_);
+  }
+  if (typeid(*exp) == typeid(tree::MemExp))
+    return 1 + Size(static_cast<tree::MemExp *>(exp)->exp_);
+  if (typeid(*exp) == typeid(tree::CallExp)) {
+    int size = 1;
+    for (tree::Exp *arg : static_cast<tree::CallExp *>(exp)->args_->GetList())
+      size += Size(arg);
+    return size;
+  }
+  return 1;
+}
+
+bool Holds(tree::RelOp op, long long left, long long right) {
+  switch (op) {
+  case tree::LT_OP:
+    return left < right;
+  case tree::LE_OP:
+    return left <= right;
+  case tree::GT_OP:
+    return left > right;
+  default:
+    return left >= right;
+  }
+}
+
+// A value as an unknown symbol plus a constant offset, symbol 0 is none
+struct Affine {
+  int symbol_;
+  long long offset_;
+};
+
+// Follows what straight-line code leaves in the temporaries
+class StraightLine {
+public:
+  void Run(tree::Stm *stm) {
+    if (typeid(*stm) != typeid(tree::MoveStm))
+      return;
+    auto *move = static_cast<tree::MoveStm *>(stm);
+    if (typeid(*move->dst_) == typeid(tree::TempExp))
+      values_[static_cast<tree::TempExp *>(move->dst_)->temp_] =
+          Eval(move->src_);
+  }
+
+  Affine Eval(tree::Exp *exp) {
+    if (typeid(*exp) == typeid(tree::ConstExp))
+      return {0, static_cast<tree::ConstExp *>(exp)->consti_};
+    if (typeid(*exp) == typeid(tree::TempExp)) {
+      temp::Temp *temp = static_cast<tree::TempExp *>(exp)->temp_;
+      // Machine registers change with every call
+      if (reg_manager->temp_map_->Look(temp))
+        return Unknown();
+      if (!values_.count(temp))
+        values_[temp] = Unknown();
+      return values_[temp];
+    }
+    if (typeid(*exp) != typeid(tree::BinopExp))
+      return Unknown();
+
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    Affine left = Eval(binop->left_);
+    Affine right = Eval(binop->right_);
+    if (binop->op_ == tree::PLUS_OP && (!left.symbol_ || !right.symbol_))
+      return Bounded({left.symbol_ + right.symbol_,
+                      left.offset_ + right.offset_});
+    if (binop->op_ == tree::MINUS_OP && !right.symbol_)
+      return Bounded({left.symbol_, left.offset_ - right.offset_});
+    if (binop->op_ == tree::MINUS_OP && left.symbol_ == right.symbol_)
+      return Bounded({0, left.offset_ - right.offset_});
+    if (binop->op_ == tree::MUL_OP && !left.symbol_ && !right.symbol_ &&
+        std::abs(left.offset_) < OFFSET_RANGE &&
+        std::abs(right.offset_) < OFFSET_RANGE &&
+        (!left.offset_ ||
+         std::abs(right.offset_) < OFFSET_RANGE / std::abs(left.offset_)))
+      return {0, left.offset_ * right.offset_};
+    return Unknown();
+  }
+
+private:
+  std::map<temp::Temp *, Affine> values_;
+  int symbols_ = 0;
+
+  Affine Unknown() { return {++symbols_, 0}; }
+  Affine Bounded(Affine value) {
+    return std::abs(value.offset_) < OFFSET_RANGE ? value : Unknown();
+  }
+};
+
+} // namespace
+
+namespace canon {
+
+void LoopUnrolling::Optimize() {
+  LoopFinder finder(stm_lists_);
+  std::vector<Loop> &loops = finder.Loops();
+  for (Loop &loop : loops) {
+    Counted counted;
+    if (!FindCounted(loop, &counted))
+      continue;
+
+    int size = 0;
+    bool calls = false;
+    for (tree::Stm *stm : counted.block_->GetList())
+      for (tree::Exp **operand : Operands(stm)) {
+        size += Size(*operand);
+        calls = calls || typeid(**operand) == typeid(tree::CallExp);
+      }
+    int trips = Trips(counted, UNROLL_BUDGET / std::max(size, 1));
+    if (trips) {
+      UnrollFully(counted, trips);
+      continue;
+    }
+    // A call costs far more than the test it would share
+    int factor = std::min(factor_, UNROLL_BUDGET / std::max(size, 1));
+    if (!calls && factor > 1 &&
+        std::abs((long long)counted.step_ * (factor - 1)) < INT_MAX)
+      Unroll(loop, loops, counted, factor);
+  }
+}
+
+bool LoopUnrolling::FindCounted(const Loop &loop, Counted *counted) {
+  if (loop.blocks_.size() != 1)
+    return false;
+  tree::StmList *block = loop.header_;
+  if (typeid(*block->GetList().back()) != typeid(tree::CjumpStm))
+    return false;
+  auto *cjump = static_cast<tree::CjumpStm *>(block->GetList().back());
+
+  // Goes on while counter op bound
+  temp::Label *header = BlockLabel(block);
+  tree::RelOp op = cjump->op_;
+  counted->exit_ = cjump->false_label_;
+  if (cjump->false_label_ == header) {
+    op = tree::NotRel(op);
+    counted->exit_ = cjump->true_label_;
+  }
+  if (counted->exit_ == header)
+    return false;
+  tree::Exp *counter = cjump->left_;
+  counted->bound_ = cjump->right_;
+  if (typeid(*counter) != typeid(tree::TempExp)) {
+    std::swap(counter, counted->bound_);
+    op = tree::Commute(op);
+  }
+  if (typeid(*counter) != typeid(tree::TempExp))
+    return false;
+  counted->block_ = block;
+  counted->counter_ = static_cast<tree::TempExp *>(counter)->temp_;
+  counted->op_ = op;
+  if (reg_manager->temp_map_->Look(counted->counter_))
+    return false;
+
+  // The counter is stepped once and the bound stays the same
+  temp::Temp *bound = typeid(*counted->bound_) == typeid(tree::TempExp)
+                          ? static_cast<tree::TempExp *>(counted->bound_)->temp_
+                          : nullptr;
+  if (typeid(*counted->bound_) != typeid(tree::ConstExp) &&
+      (!bound || reg_manager->temp_map_->Look(bound)))
+    return false;
+  int steps = 0;
+  for (tree::Stm *stm : block->GetList()) {
+    if (typeid(*stm) != typeid(tree::MoveStm))
+      continue;
+    auto *move = static_cast<tree::MoveStm *>(stm);
+    if (typeid(*move->dst_) != typeid(tree::TempExp))
+      continue;
+    temp::Temp *dst = static_cast<tree::TempExp *>(move->dst_)->temp_;
+    temp::Temp *stepped;
+    if (dst == bound)
+      return false;
+    if (dst != counted->counter_)
+      continue;
+    if (!IsStep(stm, &stepped, &counted->step_))
+      return false;
+    ++steps;
+  }
+  if (steps != 1)
+    return false;
+
+  bool up = op == tree::LT_OP || op == tree::LE_OP;
+  bool down = op == tree::GT_OP || op == tree::GE_OP;
+  return (up && counted->step_ > 0) || (down && counted->step_ < 0);
+}
+
+int LoopUnrolling::Trips(const Counted &counted, int limit) {
+  // The blocks leading to the loop, each the only way into the next
+  std::vector<tree::StmList *> entry;
+  tree::StmList *block = counted.block_;
+  while (entry.size() < ENTRY_BLOCKS) {
+    tree::StmList *pred = nullptr;
+    int preds = 0;
+    for (tree::StmList *other : stm_lists_->GetList()) {
+      if (other == counted.block_)
+        continue;
+      for (temp::Label *target : BlockTargets(other))
+        if (target == BlockLabel(block)) {
+          pred = other;
+          ++preds;
+        }
+    }
+    if (preds != 1 ||
+        std::find(entry.begin(), entry.end(), pred) != entry.end())
+      break;
+    entry.push_back(pred);
+    block = pred;
+  }
+
+  StraightLine straightLine;
+  for (auto it = entry.rbegin(); it != entry.rend(); ++it)
+    for (tree::Stm *stm : (*it)->GetList())
+      straightLine.Run(stm);
+  Affine counter = straightLine.Eval(new tree::TempExp(counted.counter_));
+  Affine bound = straightLine.Eval(counted.bound_);
+  if (counter.symbol_ != bound.symbol_)
+    return 0;
+
+  // The body runs once before the first test
+  long long value = counter.offset_;
+  for (int trips = 1; trips <= limit; ++trips) {
+    value += counted.step_;
+    if (!Holds(counted.op_, value, bound.offset_))
+      return trips;
+  }
+  return 0;
+}
+
+void LoopUnrolling::UnrollFully(const Counted &counted, int trips) {
+  std::list<tree::Stm *> &stms = counted.block_->GetNonConstList();
+  stms.pop_back();
+  std::vector<tree::Stm *> body(std::next(stms.begin()), stms.end());
+  for (int copy = 1; copy < trips; ++copy)
+    for (tree::Stm *stm : body)
+      stms.push_back(CloneStm(stm));
+  stms.push_back(new tree::JumpStm(
+      new tree::NameExp(counted.exit_),
+      new std::vector<temp::Label *>({counted.exit_})));
+}
+
+void LoopUnrolling::Unroll(Loop &loop, std::vector<Loop> &loops,
+                           const Counted &counted, int factor) {
+  // Every pass of the unrolled loop runs factor iterations, and is entered
+  // only while the counter is far enough from the bound for all of them
+  tree::Exp *last =
+      tree::Binop(tree::MINUS_OP, CloneExp(counted.bound_),
+                  new tree::ConstExp(counted.step_ * (factor - 1)));
+  std::list<tree::Stm *> computed;
+  if (typeid(*last) != typeid(tree::ConstExp)) {
+    temp::Temp *lastTemp = temp::TempFactory::NewTemp();
+    computed.push_back(new tree::MoveStm(new tree::TempExp(lastTemp), last));
+    last = new tree::TempExp(lastTemp);
+  }
+  tree::StmList *preheader =
+      InsertPreheader(stm_lists_, loop, loops, computed);
+
+  temp::Label *header = BlockLabel(counted.block_);
+  temp::Label *unrolledLabel = temp::LabelFactory::NewLabel();
+  temp::Label *restLabel = temp::LabelFactory::NewLabel();
+  preheader->GetNonConstList().back() = new tree::CjumpStm(
+      tree::NotRel(counted.op_), new tree::TempExp(counted.counter_),
+      CloneExp(last), header, unrolledLabel);
+
+  auto *unrolled = new tree::StmList();
+  std::list<tree::Stm *> &stms = unrolled->GetNonConstList();
+  stms.push_back(new tree::LabelStm(unrolledLabel));
+  const std::list<tree::Stm *> &body = counted.block_->GetList();
+  for (int copy = 0; copy < factor; ++copy)
+    for (auto it = std::next(body.begin()); it != std::prev(body.end()); ++it)
+      stms.push_back(CloneStm(*it));
+  stms.push_back(new tree::CjumpStm(
+      counted.op_, new tree::TempExp(counted.counter_), CloneExp(last),
+      unrolledLabel, restLabel));
+
+  // The iterations left over run in the original loop
+  auto *rest = new tree::StmList();
+  rest->GetNonConstList().push_back(new tree::LabelStm(restLabel));
+  rest->GetNonConstList().push_back(new tree::CjumpStm(
+      counted.op_, new tree::TempExp(counted.counter_),
+      CloneExp(counted.bound_), header, counted.exit_));
+
+  std::list<tree::StmList *> &blocks = stm_lists_->GetNonConstList();
+  auto position = std::find(blocks.begin(), blocks.end(), counted.block_);
+  blocks.insert(position, unrolled);
+  blocks.insert(position, rest);
+  for (Loop &outer : loops)
+    if (&outer != &loop && outer.blocks_.count(counted.block_)) {
+      outer.blocks_.insert(unrolled);
+      outer.blocks_.insert(rest);
+    }
+}
+
+} // namespace canon
@@ -0,0 +1,56 @@
+#ifndef TIGER_CANON_UNROLL_H_
+#define TIGER_CANON_UNROLL_H_
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include "tiger/canon/canon.h"
+#include "tiger/canon/loop.h"
+
+namespace canon {
+
+class LoopUnrolling {
+public:
+  /**
+   * @param stm_lists basic blocks of canonical trees, rewritten in place
+   * @param factor the most iterations one pass of an unrolled loop runs
+   */
+  explicit LoopUnrolling(StmListList *stm_lists, int factor = 4)
+      : stm_lists_(stm_lists), factor_(factor) {}
+
+  /**
+   * Copy the body of a loop made of a single block and counted by a
+   * temporary stepped by a constant, so that a single test is run for
+   * several iterations. The iterations left over run in the original loop.
+   * A loop whose number of iterations is known and small is replaced by
+   * that many copies of its body
+   */
+  void Optimize();
+
+private:
+  // The counted form of a loop: it goes on while counter op bound holds,
+  // and the counter moves by step in every iteration
+  struct Counted {
+    tree::StmList *block_;
+    temp::Temp *counter_;
+    int step_;
+    tree::RelOp op_;
+    tree::Exp *bound_;
+    temp::Label *exit_;
+  };
+
+  StmListList *stm_lists_;
+  int factor_;
+
+  bool FindCounted(const Loop &loop, Counted *counted);
+  // The number of iterations, 0 when it is not known or too large
+  int Trips(const Counted &counted, int limit);
+  void UnrollFully(const Counted &counted, int trips);
+  void Unroll(Loop &loop, std::vector<Loop> &loops, const Counted &counted,
+              int factor);
+};
+
+} // namespace canon
+
+#endif
@@ -0,0 +1,155 @@
+#include "tiger/canon/valuenumber.h"
+
+#include "tiger/frame/frame.h"
+
+extern frame::RegManager *reg_manager;
+
+namespace {
+
+// Worth a temporary when computed twice. Scaling by a constant is left alone,
+// the code generator folds it into the address or a single lea
+bool IsCandidate(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::MemExp))
+    return true;
+  if (typeid(*exp) != typeid(tree::BinopExp))
+    return false;
+  auto *binop = static_cast<tree::BinopExp *>(exp);
+  if (binop->op_ == tree::DIV_OP)
+    return true;
+  return binop->op_ == tree::MUL_OP &&
+         typeid(*binop->left_) != typeid(tree::ConstExp) &&
+         typeid(*binop->right_) != typeid(tree::ConstExp);
+}
+
+} // namespace
+
+namespace canon {
+
+void ValueNumbering::Optimize() {
+  for (tree::StmList *block : stm_lists_->GetList())
+    OptimizeBlock(block);
+}
+
+void ValueNumbering::OptimizeBlock(tree::StmList *block) {
+  std::list<tree::Stm *> &stms = block->GetNonConstList();
+
+  // Count the uses of every value first, so only the repeated ones get a
+  // temporary of their own
+  temp_versions_.clear();
+  mem_version_ = 0;
+  counts_.clear();
+  for (tree::Stm *stm : stms) {
+    for (tree::Exp **operand : Operands(stm))
+      Count(*operand);
+    Define(stm);
+  }
+
+  temp_versions_.clear();
+  mem_version_ = 0;
+  available_.clear();
+  for (auto it = stms.begin(); it != stms.end(); ++it) {
+    std::list<tree::Stm *> hoisted;
+    for (tree::Exp **operand : Operands(*it))
+      *operand = Number(*operand, hoisted);
+    stms.insert(it, hoisted.begin(), hoisted.end());
+    Define(*it);
+  }
+}
+
+void ValueNumbering::Count(tree::Exp *exp) {
+  if (IsCandidate(exp)) {
+    std::string key = Key(exp);
+    // The operands of a repeated value are not evaluated again
+    if (!key.empty() && counts_[key]++ > 0)
+      return;
+  }
+
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    Count(binop->left_);
+    Count(binop->right_);
+  } else if (typeid(*exp) == typeid(tree::MemExp)) {
+    Count(static_cast<tree::MemExp *>(exp)->exp_);
+  } else if (typeid(*exp) == typeid(tree::CallExp)) {
+    for (tree::Exp *arg : static_cast<tree::CallExp *>(exp)->args_->GetList())
+      Count(arg);
+  }
+}
+
+tree::Exp *ValueNumbering::Number(tree::Exp *exp,
+                                  std::list<tree::Stm *> &hoisted) {
+  // The key describes the expression before its operands are replaced
+  std::string key = IsCandidate(exp) ? Key(exp) : "";
+  if (!key.empty() && available_.count(key))
+    return new tree::TempExp(available_[key]);
+
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    binop->left_ = Number(binop->left_, hoisted);
+    binop->right_ = Number(binop->right_, hoisted);
+  } else if (typeid(*exp) == typeid(tree::MemExp)) {
+    auto *mem = static_cast<tree::MemExp *>(exp);
+    mem->exp_ = Number(mem->exp_, hoisted);
+  } else if (typeid(*exp) == typeid(tree::CallExp)) {
+    for (tree::Exp *&arg :
+         static_cast<tree::CallExp *>(exp)->args_->GetNonConstList())
+      arg = Number(arg, hoisted);
+  }
+
+  if (key.empty() || counts_[key] < 2)
+    return exp;
+  temp::Temp *value = temp::TempFactory::NewTemp();
+  hoisted.push_back(new tree::MoveStm(new tree::TempExp(value), exp));
+  available_[key] = value;
+  return new tree::TempExp(value);
+}
+
+void ValueNumbering::Define(tree::Stm *stm) {
+  if (typeid(*stm) == typeid(tree::MoveStm)) {
+    auto *move = static_cast<tree::MoveStm *>(stm);
+    if (typeid(*move->dst_) == typeid(tree::TempExp))
+      temp_versions_[static_cast<tree::TempExp *>(move->dst_)->temp_]++;
+    else
+      mem_version_++;
+    if (typeid(*move->src_) == typeid(tree::CallExp))
+      mem_version_++;
+  } else if (typeid(*stm) == typeid(tree::ExpStm) &&
+             typeid(*static_cast<tree::ExpStm *>(stm)->exp_) ==
+                 typeid(tree::CallExp)) {
+    mem_version_++;
+  }
+}
+
+std::string ValueNumbering::Key(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::ConstExp))
+    return "c" + std::to_string(static_cast<tree::ConstExp *>(exp)->consti_);
+  if (typeid(*exp) == typeid(tree::NameExp))
+    return "n" + static_cast<tree::NameExp *>(exp)->name_->Name();
+  if (typeid(*exp) == typeid(tree::TempExp)) {
+    temp::Temp *temp = static_cast<tree::TempExp *>(exp)->temp_;
+    // Machine registers other than the stack pointer change behind the tree
+    if (temp != reg_manager->StackPointer() &&
+        reg_manager->temp_map_->Look(temp))
+      return "";
+    return "t" + std::to_string(temp->Int()) + "." +
+           std::to_string(temp_versions_[temp]);
+  }
+  if (typeid(*exp) == typeid(tree::MemExp)) {
+    std::string address = Key(static_cast<tree::MemExp *>(exp)->exp_);
+    if (address.empty())
+      return "";
+    return "m" + std::to_string(mem_version_) + "(" + address + ")";
+  }
+  if (typeid(*exp) == typeid(tree::BinopExp)) {
+    auto *binop = static_cast<tree::BinopExp *>(exp);
+    std::string left = Key(binop->left_);
+    std::string right = Key(binop->right_);
+    if (left.empty() || right.empty())
+      return "";
+    return "b" + std::to_string(binop->op_) + "(" + left + "," + right + ")";
+  }
+  // Calls have side effects
+  return "";
+}
+
+} // namespace canon
@@ -0,0 +1,45 @@
+#ifndef TIGER_CANON_VALUENUMBER_H_
+#define TIGER_CANON_VALUENUMBER_H_
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tiger/canon/canon.h"
+
+namespace canon {
+
+class ValueNumbering {
+public:
+  /**
+   * @param stm_lists basic blocks of canonical trees, rewritten in place
+   */
+  explicit ValueNumbering(StmListList *stm_lists) : stm_lists_(stm_lists) {}
+
+  /**
+   * Compute each load, multiplication and division used more than once in a
+   * basic block into a temporary before its first use, and read that
+   * temporary instead for as long as no operand of it is redefined
+   */
+  void Optimize();
+
+private:
+  StmListList *stm_lists_;
+  // Bumped by every definition, so a stale expression never matches a key
+  std::map<temp::Temp *, int> temp_versions_;
+  int mem_version_ = 0;
+  std::map<std::string, int> counts_;
+  std::map<std::string, temp::Temp *> available_;
+
+  void OptimizeBlock(tree::StmList *block);
+  void Count(tree::Exp *exp);
+  tree::Exp *Number(tree::Exp *exp, std::list<tree::Stm *> &hoisted);
+  void Define(tree::Stm *stm);
+  // The value of an expression, empty when it may not be reused
+  std::string Key(tree::Exp *exp);
+};
+
+} // namespace canon
+
+#endif
@@ -1,6 +1,8 @@
 #include "tiger/codegen/assem.h"
 
+#include <algorithm>
 #include <cassert>
+#include <unordered_map>
 
 namespace temp {
 
@@ -13,82 +15,160 @@ Temp *TempList::NthTemp(int i) const {
 } // namespace temp
 
 namespace assem {
-/**
- * First param is string created by this function by reading 'assem' string
- * and replacing `d `s and `j stuff.
- * Last param is function to use to determine what to do with each temp.
- * @param assem assembly string
- * @param dst dst_ temp
- * @param src src temp
- * @param jumps jump labels_
- * @param m temp map
- * @return formatted assembly string
- */
-static std::string Format(std::string_view assem, temp::TempList *dst,
-                          temp::TempList *src, Targets *jumps, temp::Map *m) {
-  std::string result;
-  for (std::string::size_type i = 0; i < assem.size(); i++) {
-    char ch = assem.at(i);
-    if (ch == '`') {
-      i++;
-      switch (assem.at(i)) {
-      case 's': {
-        i++;
-        int n = assem.at(i) - '0';
-        std::string *s = m->Look(src->NthTemp(n));
-        result += *s;
-      } break;
-      case 'd': {
-        i++;
-        int n = assem.at(i) - '0';
-        std::string *s = m->Look(dst->NthTemp(n));
-        result += *s;
-      } break;
-      case 'j': {
-        i++;
-        assert(jumps);
-        std::string::size_type n = assem.at(i) - '0';
-        std::string s = temp::LabelFactory::LabelString(jumps->labels_->at(n));
-        result += s;
-      } break;
-      case '`': {
-        result += '`';
-      } break;
-      default:
-        assert(0);
-      }
-    } else {
-      result += ch;
+
+static_assert(sizeof(Operand) == 16, "operands are kept two to an instruction");
+
+namespace {
+
+const char *const mnemonics[] = {
+    "",      "movq", "movzbl", "leaq", "addq",  "subq",     "imulq",
+    "idivq", "cqto", "cmpq",   "testq", "xorl", "incq",     "decq",
+    "shrq",  "jmp",  "j",      "set",   "cmov", "callq", ".p2align",
+};
+
+const char *const condNames[] = {"",  "e", "ne", "l", "g", "le",
+                                 "ge", "b", "a",  "be", "ae"};
+
+const std::unordered_map<std::string, std::string> lowerHalfNames = {
+    {"%rax", "%eax"},  {"%rbx", "%ebx"},  {"%rcx", "%ecx"},
+    {"%rdx", "%edx"},  {"%rsi", "%esi"},  {"%rdi", "%edi"},
+    {"%rbp", "%ebp"},  {"%r8", "%r8d"},   {"%r9", "%r9d"},
+    {"%r10", "%r10d"}, {"%r11", "%r11d"}, {"%r12", "%r12d"},
+    {"%r13", "%r13d"}, {"%r14", "%r14d"}, {"%r15", "%r15d"}};
+
+const std::unordered_map<std::string, std::string> lowByteNames = {
+    {"%rax", "%al"},   {"%rbx", "%bl"},   {"%rcx", "%cl"},
+    {"%rdx", "%dl"},   {"%rsi", "%sil"},  {"%rdi", "%dil"},
+    {"%rbp", "%bpl"},  {"%r8", "%r8b"},   {"%r9", "%r9b"},
+    {"%r10", "%r10b"}, {"%r11", "%r11b"}, {"%r12", "%r12b"},
+    {"%r13", "%r13b"}, {"%r14", "%r14b"}, {"%r15", "%r15b"}};
+
+std::string RegisterName(temp::Temp *reg, int width, temp::Map *m) {
+  std::string name = *m->Look(reg);
+  return width == 8 ? name : NarrowRegister(name, width);
+}
+
+std::string Render(const Operand &operand, Opcode opcode, temp::TempList *dst,
+                   temp::TempList *src, temp::Map *m) {
+  switch (operand.kind) {
+  case OperandKind::SRC:
+  case OperandKind::DST: {
+    temp::TempList *regs = operand.kind == OperandKind::SRC ? src : dst;
+    std::string name =
+        RegisterName(regs->NthTemp(operand.reg), operand.width, m);
+    // A register a jump or a call goes through holds the target
+    return opcode == Opcode::JMP || opcode == Opcode::CALLQ ? "*" + name
+                                                            : name;
+  }
+  case OperandKind::IMM:
+    return opcode == Opcode::P2ALIGN ? std::to_string(operand.value)
+                                     : "$" + std::to_string(operand.value);
+  case OperandKind::LABEL:
+    return operand.label->Name();
+  case OperandKind::MEM: {
+    std::string result;
+    if (operand.label && operand.value != 0)
+      result = "(" + operand.label->Name() + (operand.value > 0 ? "+" : "") +
+               std::to_string(operand.value) + ")";
+    else if (operand.label)
+      result = operand.label->Name();
+    else if (operand.value != 0)
+      result = std::to_string(operand.value);
+    if (operand.reg == Operand::NO_REG)
+      return result + "(%rip)";
+    result += "(" + *m->Look(src->NthTemp(operand.reg));
+    if (operand.index != Operand::NO_REG) {
+      result += "," + *m->Look(src->NthTemp(operand.index));
+      if (operand.scale != 1)
+        result += "," + std::to_string(operand.scale);
     }
+    return result + ")";
   }
-  return result;
+  default:
+    return "";
+  }
+}
+
+} // namespace
+
+Operand Operand::Src(int n, int width) {
+  Operand operand;
+  operand.kind = OperandKind::SRC;
+  operand.reg = static_cast<uint8_t>(n);
+  operand.width = static_cast<uint8_t>(width);
+  return operand;
+}
+
+Operand Operand::Dst(int n, int width) {
+  Operand operand = Src(n, width);
+  operand.kind = OperandKind::DST;
+  return operand;
+}
+
+Operand Operand::Imm(int value) {
+  Operand operand;
+  operand.kind = OperandKind::IMM;
+  operand.value = value;
+  return operand;
+}
+
+Operand Operand::Mem(int base, int disp, temp::Label *label) {
+  return Mem(base, NO_REG, 1, disp, label);
+}
+
+Operand Operand::Mem(int base, int index, int scale, int disp,
+                     temp::Label *label) {
+  Operand operand;
+  operand.kind = OperandKind::MEM;
+  operand.reg = static_cast<uint8_t>(base);
+  operand.index = static_cast<uint8_t>(index);
+  operand.scale = static_cast<uint8_t>(scale);
+  operand.value = disp;
+  operand.label = label;
+  return operand;
+}
+
+Operand Operand::Label(temp::Label *label) {
+  Operand operand;
+  operand.kind = OperandKind::LABEL;
+  operand.label = label;
+  return operand;
+}
+
+OperInstr::OperInstr(Opcode opcode, Cond cond,
+                     std::initializer_list<Operand> operands,
+                     temp::TempList *dst, temp::TempList *src, Targets *jumps)
+    : opcode_(opcode), cond_(cond), dst_(dst), src_(src), jumps_(jumps) {
+  assert(operands.size() <= 2);
+  std::copy(operands.begin(), operands.end(), operands_);
+}
+
+std::string NarrowRegister(const std::string &name, int width) {
+  const auto &names = width == 4 ? lowerHalfNames : lowByteNames;
+  auto narrow = names.find(name);
+  return narrow == names.end() ? std::string() : narrow->second;
 }
 
 void OperInstr::Print(FILE *out, temp::Map *m) const {
-  std::string result = Format(assem_, dst_, src_, jumps_, m);
+  std::string result = mnemonics[static_cast<int>(opcode_)];
+  result += condNames[static_cast<int>(cond_)];
+  const char *separator = " ";
+  for (const Operand &operand : operands_) {
+    if (operand.kind == OperandKind::NONE)
+      break;
+    result += separator + Render(operand, opcode_, dst_, src_, m);
+    separator = ", ";
+  }
   fprintf(out, "%s\n", result.data());
 }
 
 void LabelInstr::Print(FILE *out, temp::Map *m) const {
-  std::string result = Format(assem_, nullptr, nullptr, nullptr, m);
-  fprintf(out, "%s:\n", result.data());
+  fprintf(out, "%s:\n", label_->Name().data());
 }
 
 void MoveInstr::Print(FILE *out, temp::Map *m) const {
-  if (!dst_ && !src_) {
-    std::size_t srcpos = assem_.find_first_of('%');
-    if (srcpos != std::string::npos) {
-      std::size_t dstpos = assem_.find_first_of('%', srcpos + 1);
-      if (dstpos != std::string::npos) {
-        if ((assem_[srcpos + 1] == assem_[dstpos + 1]) &&
-            (assem_[srcpos + 2] == assem_[dstpos + 2]) &&
-            (assem_[srcpos + 3] == assem_[dstpos + 3]))
-          return;
-      }
-    }
-  }
-  std::string result = Format(assem_, dst_, src_, nullptr, m);
-  fprintf(out, "%s\n", result.data());
+  fprintf(out, "movq %s, %s\n", m->Look(src_->NthTemp(0))->data(),
+          m->Look(dst_->NthTemp(0))->data());
 }
 
 void InstrList::Print(FILE *out, temp::Map *m) const {
@@ -1,7 +1,9 @@
 #ifndef TIGER_CODEGEN_ASSEM_H_
 #define TIGER_CODEGEN_ASSEM_H_
 
+#include <cstdint>
 #include <cstdio>
+#include <initializer_list>
 #include <string>
 #include <vector>
 
@@ -16,6 +18,76 @@ public:
   explicit Targets(std::vector<temp::Label *> *labels) : labels_(labels) {}
 };
 
+// Mnemonics emitted by the backend
+enum class Opcode : uint8_t {
+  NONE, // the return sink, which only marks the registers live at the end
+  MOVQ,
+  MOVZBL,
+  LEAQ,
+  ADDQ,
+  SUBQ,
+  IMULQ,
+  IDIVQ,
+  CQTO,
+  CMPQ,
+  TESTQ,
+  XORL,
+  INCQ,
+  DECQ,
+  SHRQ,
+  JMP,
+  JCC,
+  SETCC,
+  CMOVCC,
+  CALLQ,
+  P2ALIGN,
+};
+
+// Condition codes of conditional jumps, sets and moves
+enum class Cond : uint8_t { NONE, E, NE, L, G, LE, GE, B, A, BE, AE };
+
+enum class OperandKind : uint8_t {
+  NONE,
+  SRC,   // the reg-th source temporary
+  DST,   // the reg-th destination temporary
+  IMM,   // $value
+  MEM,   // label+value(base,index,scale), its registers are sources
+  LABEL, // a code or data label
+};
+
+/**
+ * An operand of an x86 instruction. Registers are numbered in the temporary
+ * lists of the instruction, so allocation rewrites the lists and never the
+ * operands. A memory operand without a base register is relative to %rip
+ */
+struct Operand {
+  static constexpr uint8_t NO_REG = 0xff;
+
+  temp::Label *label;
+  int value;
+  OperandKind kind;
+  uint8_t reg;       // SRC, DST or the base register of MEM
+  uint8_t index;     // the index register of MEM
+  uint8_t scale : 4; // of the index register of MEM
+  uint8_t width : 4; // bytes of the register named by SRC or DST
+
+  Operand()
+      : label(nullptr), value(0), kind(OperandKind::NONE), reg(NO_REG),
+        index(NO_REG), scale(1), width(8) {}
+
+  static Operand Src(int n, int width = 8);
+  static Operand Dst(int n, int width = 8);
+  static Operand Imm(int value);
+  static Operand Mem(int base, int disp, temp::Label *label = nullptr);
+  static Operand Mem(int base, int index, int scale, int disp,
+                     temp::Label *label = nullptr);
+  static Operand Label(temp::Label *label);
+
+  [[nodiscard]] bool IsReg() const {
+    return kind == OperandKind::SRC || kind == OperandKind::DST;
+  }
+};
+
 class Instr {
 public:
   virtual ~Instr() = default;
@@ -27,13 +99,18 @@ public:
 
 class OperInstr : public Instr {
 public:
-  std::string assem_;
+  Opcode opcode_;
+  Cond cond_;
+  // In AT&T order, the destination last
+  Operand operands_[2];
   temp::TempList *dst_, *src_;
   Targets *jumps_;
 
-  OperInstr(std::string assem, temp::TempList *dst, temp::TempList *src,
-            Targets *jumps)
-      : assem_(std::move(assem)), dst_(dst), src_(src), jumps_(jumps) {}
+  OperInstr(Opcode opcode, std::initializer_list<Operand> operands,
+            temp::TempList *dst, temp::TempList *src, Targets *jumps)
+      : OperInstr(opcode, Cond::NONE, operands, dst, src, jumps) {}
+  OperInstr(Opcode opcode, Cond cond, std::initializer_list<Operand> operands,
+            temp::TempList *dst, temp::TempList *src, Targets *jumps);
 
   void Print(FILE *out, temp::Map *m) const override;
   [[nodiscard]] temp::TempList *Def() const override;
@@ -42,24 +119,21 @@ public:
 
 class LabelInstr : public Instr {
 public:
-  std::string assem_;
   temp::Label *label_;
 
-  LabelInstr(std::string assem, temp::Label *label)
-      : assem_(std::move(assem)), label_(label) {}
+  explicit LabelInstr(temp::Label *label) : label_(label) {}
 
   void Print(FILE *out, temp::Map *m) const override;
   [[nodiscard]] temp::TempList *Def() const override;
   [[nodiscard]] temp::TempList *Use() const override;
 };
 
+// movq `s0, `d0 between two temporaries
 class MoveInstr : public Instr {
 public:
-  std::string assem_;
   temp::TempList *dst_, *src_;
 
-  MoveInstr(std::string assem, temp::TempList *dst, temp::TempList *src)
-      : assem_(std::move(assem)), dst_(dst), src_(src) {}
+  MoveInstr(temp::TempList *dst, temp::TempList *src) : dst_(dst), src_(src) {}
 
   void Print(FILE *out, temp::Map *m) const override;
   [[nodiscard]] temp::TempList *Def() const override;
@@ -102,14 +176,17 @@ public:
       : prolog_(std::move(prolog)), body_(body), epilog_(std::move(epilog)) {}
 };
 
+// The name of the lower 4 or 1 bytes of a 64-bit register, empty when the
+// register has none
+std::string NarrowRegister(const std::string &name, int width);
+
 class MemFetch {
 public:
-  std::string fetch_;
+  Operand fetch_;
   temp::TempList *regs_;
 
   MemFetch() { regs_ = new temp::TempList(); }
-  MemFetch(std::string fetch, temp::TempList *regs)
-      : fetch_(fetch), regs_(regs) {}
+  MemFetch(Operand fetch, temp::TempList *regs) : fetch_(fetch), regs_(regs) {}
 };
 
 } // namespace assem
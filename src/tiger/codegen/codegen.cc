@@ -1,7 +1,9 @@
 #include "tiger/codegen/codegen.h"
 
 #include <cassert>
-#include <sstream>
+#include <climits>
+#include <unordered_map>
+#include <vector>
 
 extern frame::RegManager *reg_manager;
 
@@ -10,6 +12,331 @@ namespace {
 constexpr int maxlen = 1024;
 constexpr int wordsize = 8;
 
+// An x86 memory operand disp(base,index,scale) covering an address tree, the
+// displacement may be relative to the frame size label. The cost counts the
+// instructions computing its registers
+struct AddressMode {
+  tree::Exp *base = nullptr;
+  tree::Exp *index = nullptr;
+  int scale = 1;
+  temp::Label *label = nullptr;
+  int disp = 0;
+  int cost = 0;
+
+  // The nonterminal the cover derives: the parts of the operand it fills
+  [[nodiscard]] int Shape() const {
+    return (base ? 1 : 0) | (index ? 2 : 0) | (scale != 1 ? 4 : 0) |
+           (label ? 8 : 0);
+  }
+};
+
+class Tiling;
+
+using AddressRule = void (*)(tree::Exp *exp, Tiling &tiling,
+                             std::vector<AddressMode> &covers);
+
+/**
+ * Bottom-up labeling of the trees of a procedure with the address rules. An
+ * expression gets the cheapest cover for each shape of memory operand and the
+ * cost of computing it into a register, from which its parent picks between
+ * a memory operand, a lea and an arithmetic instruction
+ */
+class Tiling {
+public:
+  static void Reset(std::string_view frameSpecific);
+
+  // The cheapest memory operand with a base register for an address
+  static AddressMode Address(tree::Exp *exp);
+  /**
+   * Whether a sum is cheaper as one lea than with an add
+   * @param mode the memory operand the lea computes
+   */
+  static bool Lea(tree::Exp *exp, AddressMode &mode);
+  // Instructions computing an expression into a register
+  static int RegCost(tree::Exp *exp);
+  // Instructions reading an expression as the source of an ALU instruction,
+  // which takes an immediate or a memory operand in place of a register
+  static int OperandCost(tree::Exp *exp);
+  // Whether an addition or multiplication is cheaper with its right operand
+  // in the result register
+  static bool Commuted(tree::BinopExp *exp);
+
+  // The covers of an expression, one per shape
+  const std::vector<AddressMode> &Covers(tree::Exp *exp) {
+    return Label(exp).covers;
+  }
+  [[nodiscard]] std::string_view FrameSpecific() const {
+    return frameSpecific_;
+  }
+
+private:
+  struct Node {
+    std::vector<AddressMode> covers;
+    int regCost = 0;
+    bool lea = false;
+    AddressMode leaMode;
+  };
+
+  // The trees are never freed, so the nodes are keyed by their address
+  std::unordered_map<tree::Exp *, Node> nodes_;
+  std::string frameSpecific_;
+  static Tiling tiling;
+
+  const Node &Label(tree::Exp *exp);
+  void ComputeRegCost(tree::Exp *exp, Node &node);
+};
+
+Tiling Tiling::tiling;
+
+// Keep a cover unless one of its shape is at most as expensive
+void Keep(std::vector<AddressMode> &covers, const AddressMode &mode) {
+  for (AddressMode &cover : covers) {
+    if (cover.Shape() != mode.Shape())
+      continue;
+    if (mode.cost < cover.cost)
+      cover = mode;
+    return;
+  }
+  covers.push_back(mode);
+}
+
+// The operand adding up two covers, if one holds them both
+bool Combine(const AddressMode &a, const AddressMode &b, AddressMode &sum) {
+  tree::Exp *regs[4];
+  int scales[4];
+  int count = 0;
+  for (const AddressMode *mode : {&a, &b}) {
+    if (mode->base) {
+      regs[count] = mode->base;
+      scales[count++] = 1;
+    }
+    if (mode->index) {
+      regs[count] = mode->index;
+      scales[count++] = mode->scale;
+    }
+  }
+  long long disp = static_cast<long long>(a.disp) + b.disp;
+  if (count > 2 || (a.label && b.label) || disp < INT_MIN || disp > INT_MAX)
+    return false;
+  if (count == 2 && scales[0] != 1) {
+    if (scales[1] != 1)
+      return false;
+    std::swap(regs[0], regs[1]);
+    std::swap(scales[0], scales[1]);
+  }
+
+  sum = AddressMode();
+  if (count == 1 && scales[0] != 1) {
+    sum.index = regs[0];
+    sum.scale = scales[0];
+  } else if (count >= 1) {
+    sum.base = regs[0];
+  }
+  if (count == 2) {
+    sum.index = regs[1];
+    sum.scale = scales[1];
+  }
+  sum.label = a.label ? a.label : b.label;
+  sum.disp = static_cast<int>(disp);
+  sum.cost = a.cost + b.cost;
+  return true;
+}
+
+// CONST
+void CoverConst(tree::Exp *exp, Tiling &tiling,
+                std::vector<AddressMode> &covers) {
+  if (typeid(*exp) != typeid(tree::ConstExp))
+    return;
+  AddressMode mode;
+  mode.disp = static_cast<tree::ConstExp *>(exp)->consti_;
+  covers.push_back(mode);
+}
+
+// NAME frame size
+void CoverFrameSize(tree::Exp *exp, Tiling &tiling,
+                    std::vector<AddressMode> &covers) {
+  if (typeid(*exp) != typeid(tree::NameExp) ||
+      static_cast<tree::NameExp *>(exp)->name_->Name() !=
+          tiling.FrameSpecific())
+    return;
+  AddressMode mode;
+  mode.label = static_cast<tree::NameExp *>(exp)->name_;
+  covers.push_back(mode);
+}
+
+// PLUS(e1, e2)
+void CoverPlus(tree::Exp *exp, Tiling &tiling,
+               std::vector<AddressMode> &covers) {
+  if (typeid(*exp) != typeid(tree::BinopExp) ||
+      static_cast<tree::BinopExp *>(exp)->op_ != tree::PLUS_OP)
+    return;
+  auto *binop = static_cast<tree::BinopExp *>(exp);
+  for (const AddressMode &a : tiling.Covers(binop->left_)) {
+    for (const AddressMode &b : tiling.Covers(binop->right_)) {
+      AddressMode sum;
+      if (Combine(a, b, sum))
+        covers.push_back(sum);
+    }
+  }
+}
+
+// MINUS(e, CONST)
+void CoverMinusConst(tree::Exp *exp, Tiling &tiling,
+                     std::vector<AddressMode> &covers) {
+  if (typeid(*exp) != typeid(tree::BinopExp))
+    return;
+  auto *binop = static_cast<tree::BinopExp *>(exp);
+  if (binop->op_ != tree::MINUS_OP ||
+      typeid(*binop->right_) != typeid(tree::ConstExp) ||
+      static_cast<tree::ConstExp *>(binop->right_)->consti_ == INT_MIN)
+    return;
+  AddressMode negated;
+  negated.disp = -static_cast<tree::ConstExp *>(binop->right_)->consti_;
+  for (const AddressMode &a : tiling.Covers(binop->left_)) {
+    AddressMode difference;
+    if (Combine(a, negated, difference))
+      covers.push_back(difference);
+  }
+}
+
+// MUL(e, CONST 1|2|4|8) or MUL(CONST 1|2|4|8, e)
+void CoverScaledIndex(tree::Exp *exp, Tiling &tiling,
+                      std::vector<AddressMode> &covers) {
+  if (typeid(*exp) != typeid(tree::BinopExp))
+    return;
+  auto *binop = static_cast<tree::BinopExp *>(exp);
+  if (binop->op_ != tree::MUL_OP)
+    return;
+  tree::Exp *index = binop->left_;
+  tree::Exp *scale = binop->right_;
+  if (typeid(*index) == typeid(tree::ConstExp))
+    std::swap(index, scale);
+  if (typeid(*scale) != typeid(tree::ConstExp))
+    return;
+  int factor = static_cast<tree::ConstExp *>(scale)->consti_;
+  if (factor != 1 && factor != 2 && factor != 4 && factor != 8)
+    return;
+  AddressMode mode;
+  if (factor == 1) {
+    mode.base = index;
+  } else {
+    mode.index = index;
+    mode.scale = factor;
+  }
+  mode.cost = Tiling::RegCost(index);
+  covers.push_back(mode);
+}
+
+// Tree shapes one memory operand covers, an expression computed into a
+// register is a base besides
+const AddressRule addressRules[] = {
+    CoverConst,      CoverFrameSize,   CoverPlus,
+    CoverMinusConst, CoverScaledIndex,
+};
+
+void Tiling::Reset(std::string_view frameSpecific) {
+  tiling.nodes_.clear();
+  tiling.frameSpecific_ = frameSpecific;
+}
+
+AddressMode Tiling::Address(tree::Exp *exp) {
+  const AddressMode *best = nullptr;
+  for (const AddressMode &mode : tiling.Label(exp).covers)
+    if (mode.base && (!best || mode.cost < best->cost))
+      best = &mode;
+  return *best;
+}
+
+bool Tiling::Lea(tree::Exp *exp, AddressMode &mode) {
+  const Node &node = tiling.Label(exp);
+  mode = node.leaMode;
+  return node.lea;
+}
+
+int Tiling::RegCost(tree::Exp *exp) { return tiling.Label(exp).regCost; }
+
+int Tiling::OperandCost(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::ConstExp))
+    return 0;
+  if (typeid(*exp) == typeid(tree::MemExp))
+    return Address(static_cast<tree::MemExp *>(exp)->exp_).cost;
+  return RegCost(exp);
+}
+
+bool Tiling::Commuted(tree::BinopExp *exp) {
+  return RegCost(exp->right_) + OperandCost(exp->left_) <
+         RegCost(exp->left_) + OperandCost(exp->right_);
+}
+
+const Tiling::Node &Tiling::Label(tree::Exp *exp) {
+  auto found = nodes_.find(exp);
+  if (found != nodes_.end())
+    return found->second;
+
+  std::vector<AddressMode> covers;
+  for (AddressRule rule : addressRules)
+    rule(exp, *this, covers);
+  Node node;
+  for (const AddressMode &mode : covers)
+    Keep(node.covers, mode);
+  ComputeRegCost(exp, node);
+  AddressMode reg;
+  reg.base = exp;
+  reg.cost = node.regCost;
+  Keep(node.covers, reg);
+  return nodes_.emplace(exp, std::move(node)).first->second;
+}
+
+void Tiling::ComputeRegCost(tree::Exp *exp, Node &node) {
+  if (typeid(*exp) == typeid(tree::TempExp)) {
+    node.regCost = 0;
+    return;
+  }
+  if (typeid(*exp) == typeid(tree::MemExp)) {
+    node.regCost = 1 + Address(static_cast<tree::MemExp *>(exp)->exp_).cost;
+    return;
+  }
+  node.regCost = 1;
+  if (typeid(*exp) != typeid(tree::BinopExp))
+    return;
+
+  auto *binop = static_cast<tree::BinopExp *>(exp);
+  tree::Exp *left = binop->left_;
+  tree::Exp *right = binop->right_;
+  if ((binop->op_ == tree::PLUS_OP || binop->op_ == tree::MUL_OP) &&
+      Commuted(binop))
+    std::swap(left, right);
+  // A move to the result register and the operation
+  int arithmetic = 2 + RegCost(left) + OperandCost(right);
+  switch (binop->op_) {
+  case tree::PLUS_OP:
+  case tree::MINUS_OP:
+    node.regCost = arithmetic;
+    for (const AddressMode &mode : node.covers) {
+      if (mode.base && 1 + mode.cost < node.regCost) {
+        node.regCost = 1 + mode.cost;
+        node.lea = true;
+        node.leaMode = mode;
+      }
+    }
+    return;
+  case tree::MUL_OP:
+  case tree::DIV_OP:
+    // Saving, loading and restoring rax and rdx around the operation
+    node.regCost = 6 + arithmetic;
+    if (binop->op_ == tree::MUL_OP &&
+        typeid(*right) == typeid(tree::ConstExp)) {
+      int factor = static_cast<tree::ConstExp *>(right)->consti_;
+      if (factor == 2 || factor == 3 || factor == 5 || factor == 9)
+        node.regCost = 1 + RegCost(left);
+    }
+    return;
+  default:
+    node.regCost = 2 + RegCost(left) + RegCost(right);
+    return;
+  }
+}
+
 } // namespace
 
 namespace cg {
@@ -18,6 +345,7 @@ void CodeGen::Codegen() {
   /* TODO: Put your lab5 code here */
   tree::StmList *stm_list = traces_.get()->GetStmList();
   assem::InstrList *instr_list = new assem::InstrList();
+  Tiling::Reset(fs_);
   for (auto stm : stm_list->GetList())
     stm->Munch(*instr_list, fs_);
   instr_list = frame::PrepareProcedureInstructions(instr_list);
@@ -33,51 +361,29 @@ void AssemInstr::Print(FILE *out, temp::Map *map) const {
 
 namespace tree {
 /* TODO: Put your lab5 code here */
+
+// Compute the registers of an addressing mode, they are the sources from
+// `s<sequential> on
+static assem::MemFetch *MunchAddress(const AddressMode &mode, int sequential,
+                                     assem::InstrList &instrList,
+                                     std::string_view frameSpecific) {
+  auto *regs = new temp::TempList(mode.base->Munch(instrList, frameSpecific));
+  int index = assem::Operand::NO_REG;
+  if (mode.index) {
+    regs->Append(mode.index->Munch(instrList, frameSpecific));
+    index = sequential + 1;
+  }
+  return new assem::MemFetch(assem::Operand::Mem(sequential, index, mode.scale,
+                                                 mode.disp, mode.label),
+                             regs);
+}
+
 static assem::MemFetch *MunchMem(tree::Exp *memExp, int sequential,
                                  assem::InstrList &instrList,
                                  std::string_view frameSpecific) {
   tree::Exp *innerExp = static_cast<tree::MemExp *>(memExp)->exp_;
-  std::stringstream memStream;
-  if (typeid(*innerExp) == typeid(tree::BinopExp) &&
-      static_cast<tree::BinopExp *>(innerExp)->op_ == tree::PLUS_OP) {
-    tree::BinopExp *binaryExpression = static_cast<tree::BinopExp *>(innerExp);
-    if (typeid(*binaryExpression->left_) == typeid(tree::ConstExp)) {
-      tree::ConstExp *offsetExpression =
-          static_cast<tree::ConstExp *>(binaryExpression->left_);
-      temp::Temp *baseRegister =
-          binaryExpression->right_->Munch(instrList, frameSpecific);
-      if (offsetExpression->consti_ != 0)
-        memStream << offsetExpression->consti_ << "(`s" << sequential << ")";
-      else
-        memStream << "(`s" << sequential << ")";
-      return new assem::MemFetch(memStream.str(),
-                                 new temp::TempList(baseRegister));
-
-    } else if (typeid(*binaryExpression->right_) == typeid(tree::ConstExp)) {
-      tree::ConstExp *offsetExpression =
-          static_cast<tree::ConstExp *>(binaryExpression->right_);
-      temp::Temp *baseRegister =
-          binaryExpression->left_->Munch(instrList, frameSpecific);
-      if (offsetExpression->consti_ != 0)
-        memStream << offsetExpression->consti_ << "(`s" << sequential << ")";
-      else
-        memStream << "(`s" << sequential << ")";
-      return new assem::MemFetch(memStream.str(),
-                                 new temp::TempList(baseRegister));
-
-    } else { // Both operands are registers
-      temp::Temp *memoryRegister = innerExp->Munch(instrList, frameSpecific);
-      memStream << "(`s" << sequential << ")";
-      return new assem::MemFetch(memStream.str(),
-                                 new temp::TempList(memoryRegister));
-    }
-
-  } else {
-    temp::Temp *memoryRegister = innerExp->Munch(instrList, frameSpecific);
-    memStream << "(`s" << sequential << ")";
-    return new assem::MemFetch(memStream.str(),
-                               new temp::TempList(memoryRegister));
-  }
+  return MunchAddress(Tiling::Address(innerExp), sequential, instrList,
+                      frameSpecific);
 }
 
 void SeqStm::Munch(assem::InstrList &instr_list, std::string_view fs) {
@@ -88,95 +394,217 @@ void SeqStm::Munch(assem::InstrList &instr_list, std::string_view fs) {
 
 void LabelStm::Munch(assem::InstrList &instr_list, std::string_view fs) {
   /* TODO: Put your lab5 code here */
-  instr_list.Append(new assem::LabelInstr(label_->Name(), label_));
+  instr_list.Append(new assem::LabelInstr(label_));
 }
 
 void JumpStm::Munch(assem::InstrList &instr_list, std::string_view fs) {
   /* TODO: Put your lab5 code here */
-  std::string instr_str = "jmp " + exp_->name_->Name();
-  instr_list.Append(new assem::OperInstr(instr_str, nullptr, nullptr,
-                                         new assem::Targets(jumps_)));
+  if (typeid(*exp_) != typeid(tree::NameExp)) {
+    temp::Temp *target = exp_->Munch(instr_list, fs);
+    instr_list.Append(new assem::OperInstr(
+        assem::Opcode::JMP, {assem::Operand::Src(0)}, nullptr,
+        new temp::TempList(target), new assem::Targets(jumps_)));
+    return;
+  }
+  instr_list.Append(new assem::OperInstr(
+      assem::Opcode::JMP,
+      {assem::Operand::Label(static_cast<tree::NameExp *>(exp_)->name_)},
+      nullptr, nullptr, new assem::Targets(jumps_)));
+}
+
+// Only the right operand of cmp is an immediate or memory operand, so
+// constants and then memory go there
+static int CompareRank(tree::Exp *exp) {
+  if (typeid(*exp) == typeid(tree::ConstExp))
+    return 2;
+  return typeid(*exp) == typeid(tree::MemExp) ? 1 : 0;
 }
 
 void CjumpStm::Munch(assem::InstrList &instrList,
                      std::string_view frameSpecific) {
-  std::stringstream instrStream;
+  tree::Exp *left = left_;
+  tree::Exp *right = right_;
+  RelOp op = op_;
+  if (CompareRank(left) > CompareRank(right)) {
+    std::swap(left, right);
+    op = tree::Commute(op);
+  }
 
-  if (typeid(*right_) == typeid(tree::ConstExp)) {
-    tree::ConstExp *rightConst = static_cast<tree::ConstExp *>(right_);
-    temp::Temp *leftReg = left_->Munch(instrList, frameSpecific);
-    instrStream << "cmpq $" << rightConst->consti_ << ", `s0";
+  if (typeid(*right) == typeid(tree::ConstExp) &&
+      typeid(*left) == typeid(tree::MemExp)) { // Compare memory with constant
+    tree::ConstExp *rightConst = static_cast<tree::ConstExp *>(right);
+    assem::MemFetch *memFetch = MunchMem(left, 0, instrList, frameSpecific);
     instrList.Append(new assem::OperInstr(
-        instrStream.str(), nullptr, new temp::TempList(leftReg), nullptr));
+        assem::Opcode::CMPQ,
+        {assem::Operand::Imm(rightConst->consti_), memFetch->fetch_}, nullptr,
+        memFetch->regs_, nullptr));
+  } else if (typeid(*right) == typeid(tree::ConstExp)) {
+    tree::ConstExp *rightConst = static_cast<tree::ConstExp *>(right);
+    temp::Temp *leftReg = left->Munch(instrList, frameSpecific);
+    instrList.Append(new assem::OperInstr(
+        assem::Opcode::CMPQ,
+        {assem::Operand::Imm(rightConst->consti_), assem::Operand::Src(0)},
+        nullptr, new temp::TempList(leftReg), nullptr));
+  } else if (typeid(*right) == typeid(tree::MemExp)) { // Compare with memory
+    temp::Temp *leftReg = left->Munch(instrList, frameSpecific);
+    assem::MemFetch *memFetch = MunchMem(right, 1, instrList, frameSpecific);
+    temp::TempList *srcRegs = new temp::TempList(leftReg);
+    srcRegs->AppendTempList(memFetch->regs_);
+    instrList.Append(new assem::OperInstr(
+        assem::Opcode::CMPQ, {memFetch->fetch_, assem::Operand::Src(0)},
+        nullptr, srcRegs, nullptr));
   } else {
-    temp::Temp *leftReg = left_->Munch(instrList, frameSpecific);
-    temp::Temp *rightReg = right_->Munch(instrList, frameSpecific);
-    instrList.Append(
-        new assem::OperInstr("cmpq `s0, `s1", nullptr,
-                             new temp::TempList({rightReg, leftReg}), nullptr));
+    temp::Temp *leftReg = left->Munch(instrList, frameSpecific);
+    temp::Temp *rightReg = right->Munch(instrList, frameSpecific);
+    instrList.Append(new assem::OperInstr(
+        assem::Opcode::CMPQ, {assem::Operand::Src(0), assem::Operand::Src(1)},
+        nullptr, new temp::TempList({rightReg, leftReg}), nullptr));
   }
 
-  instrStream.str(""); // Clearing the stream
-
-  switch (op_) {
+  assem::Cond cond;
+  switch (op) {
   case EQ_OP:
-    instrStream << "je " << true_label_->Name();
+    cond = assem::Cond::E;
     break;
   case NE_OP:
-    instrStream << "jne " << true_label_->Name();
+    cond = assem::Cond::NE;
     break;
   case LT_OP:
-    instrStream << "jl " << true_label_->Name();
+    cond = assem::Cond::L;
     break;
   case GT_OP:
-    instrStream << "jg " << true_label_->Name();
+    cond = assem::Cond::G;
     break;
   case LE_OP:
-    instrStream << "jle " << true_label_->Name();
+    cond = assem::Cond::LE;
     break;
   case GE_OP:
-    instrStream << "jge " << true_label_->Name();
+    cond = assem::Cond::GE;
+    break;
+  case ULT_OP:
+    cond = assem::Cond::B;
+    break;
+  case UGT_OP:
+    cond = assem::Cond::A;
+    break;
+  case ULE_OP:
+    cond = assem::Cond::BE;
+    break;
+  case UGE_OP:
+    cond = assem::Cond::AE;
     break;
   default:
     return; // Error handling
   }
   instrList.Append(new assem::OperInstr(
-      instrStream.str(), nullptr, nullptr,
+      assem::Opcode::JCC, cond, {assem::Operand::Label(true_label_)}, nullptr,
+      nullptr,
       new assem::Targets(new std::vector<temp::Label *>{true_label_})));
 }
 
+// Whether two trees compute the same value, read one after the other
+static bool SameExp(tree::Exp *a, tree::Exp *b) {
+  if (typeid(*a) != typeid(*b))
+    return false;
+  if (typeid(*a) == typeid(tree::TempExp))
+    return static_cast<tree::TempExp *>(a)->temp_ ==
+           static_cast<tree::TempExp *>(b)->temp_;
+  if (typeid(*a) == typeid(tree::ConstExp))
+    return static_cast<tree::ConstExp *>(a)->consti_ ==
+           static_cast<tree::ConstExp *>(b)->consti_;
+  if (typeid(*a) == typeid(tree::NameExp))
+    return static_cast<tree::NameExp *>(a)->name_ ==
+           static_cast<tree::NameExp *>(b)->name_;
+  if (typeid(*a) == typeid(tree::MemExp))
+    return SameExp(static_cast<tree::MemExp *>(a)->exp_,
+                   static_cast<tree::MemExp *>(b)->exp_);
+  if (typeid(*a) == typeid(tree::BinopExp)) {
+    auto *binopA = static_cast<tree::BinopExp *>(a);
+    auto *binopB = static_cast<tree::BinopExp *>(b);
+    return binopA->op_ == binopB->op_ &&
+           SameExp(binopA->left_, binopB->left_) &&
+           SameExp(binopA->right_, binopB->right_);
+  }
+  return false;
+}
+
+// MOVE(MEM(e), PLUS(MEM(e), e2)) or MINUS is one add or sub to memory
+static bool MunchUpdate(tree::Exp *dst, tree::Exp *src,
+                        assem::InstrList &instrList,
+                        std::string_view frameSpecific) {
+  if (typeid(*dst) != typeid(tree::MemExp) ||
+      typeid(*src) != typeid(tree::BinopExp))
+    return false;
+  auto *binop = static_cast<tree::BinopExp *>(src);
+  tree::Exp *operand = nullptr;
+  if ((binop->op_ == tree::PLUS_OP || binop->op_ == tree::MINUS_OP) &&
+      SameExp(binop->left_, dst))
+    operand = binop->right_;
+  else if (binop->op_ == tree::PLUS_OP && SameExp(binop->right_, dst))
+    operand = binop->left_;
+  if (!operand)
+    return false;
+
+  assem::Opcode opcode =
+      binop->op_ == tree::PLUS_OP ? assem::Opcode::ADDQ : assem::Opcode::SUBQ;
+  if (typeid(*operand) == typeid(tree::ConstExp)) {
+    assem::MemFetch *memFetch = MunchMem(dst, 0, instrList, frameSpecific);
+    instrList.Append(new assem::OperInstr(
+        opcode,
+        {assem::Operand::Imm(static_cast<tree::ConstExp *>(operand)->consti_),
+         memFetch->fetch_},
+        nullptr, memFetch->regs_, nullptr));
+    return true;
+  }
+  temp::Temp *operandReg = operand->Munch(instrList, frameSpecific);
+  assem::MemFetch *memFetch = MunchMem(dst, 1, instrList, frameSpecific);
+  temp::TempList *srcRegs = new temp::TempList(operandReg);
+  srcRegs->AppendTempList(memFetch->regs_);
+  instrList.Append(new assem::OperInstr(
+      opcode, {assem::Operand::Src(0), memFetch->fetch_}, nullptr, srcRegs,
+      nullptr));
+  return true;
+}
+
 void MoveStm::Munch(assem::InstrList &instrList,
                     std::string_view frameSpecific) {
-  std::stringstream instrStream;
-
-  if (typeid(*dst_) == typeid(tree::MemExp)) {
+  if (MunchUpdate(dst_, src_, instrList, frameSpecific))
+    return;
+  if (typeid(*dst_) == typeid(tree::MemExp) &&
+      typeid(*src_) == typeid(tree::ConstExp)) { // Store an immediate
+    assem::MemFetch *memFetch = MunchMem(dst_, 0, instrList, frameSpecific);
+    instrList.Append(new assem::OperInstr(
+        assem::Opcode::MOVQ,
+        {assem::Operand::Imm(static_cast<tree::ConstExp *>(src_)->consti_),
+         memFetch->fetch_},
+        nullptr, memFetch->regs_, nullptr));
+  } else if (typeid(*dst_) == typeid(tree::MemExp)) {
     temp::Temp *srcReg = src_->Munch(instrList, frameSpecific);
     assem::MemFetch *memFetch = MunchMem(dst_, 1, instrList, frameSpecific);
-    instrStream << "movq `s0, " << memFetch->fetch_;
     temp::TempList *srcRegs = new temp::TempList(srcReg);
     srcRegs->AppendTempList(memFetch->regs_);
-    instrList.Append(
-        new assem::OperInstr(instrStream.str(), nullptr, srcRegs, nullptr));
+    instrList.Append(new assem::OperInstr(
+        assem::Opcode::MOVQ, {assem::Operand::Src(0), memFetch->fetch_},
+        nullptr, srcRegs, nullptr));
   } else {
     if (typeid(*src_) == typeid(tree::MemExp)) {
       assem::MemFetch *memFetch = MunchMem(src_, 0, instrList, frameSpecific);
       temp::Temp *dstReg = dst_->Munch(instrList, frameSpecific);
-      instrStream << "movq " << memFetch->fetch_ << ", `d0";
-      instrList.Append(new assem::OperInstr(instrStream.str(),
-                                            new temp::TempList(dstReg),
-                                            memFetch->regs_, nullptr));
+      instrList.Append(new assem::OperInstr(
+          assem::Opcode::MOVQ, {memFetch->fetch_, assem::Operand::Dst(0)},
+          new temp::TempList(dstReg), memFetch->regs_, nullptr));
     } else if (typeid(*src_) == typeid(tree::ConstExp)) {
       temp::Temp *dstReg = dst_->Munch(instrList, frameSpecific);
-      instrStream << "movq $" << static_cast<tree::ConstExp *>(src_)->consti_
-                  << ", `d0";
       instrList.Append(new assem::OperInstr(
-          instrStream.str(), new temp::TempList(dstReg), nullptr, nullptr));
+          assem::Opcode::MOVQ,
+          {assem::Operand::Imm(static_cast<tree::ConstExp *>(src_)->consti_),
+           assem::Operand::Dst(0)},
+          new temp::TempList(dstReg), nullptr, nullptr));
 
     } else {
       temp::Temp *srcReg = src_->Munch(instrList, frameSpecific);
       temp::Temp *dstReg = dst_->Munch(instrList, frameSpecific);
-      instrList.Append(new assem::MoveInstr("movq `s0, `d0",
-                                            new temp::TempList(dstReg),
+      instrList.Append(new assem::MoveInstr(new temp::TempList(dstReg),
                                             new temp::TempList(srcReg)));
     }
   }
@@ -188,120 +616,169 @@ void ExpStm::Munch(assem::InstrList &instr_list, std::string_view fs) {
 }
 void LoadOperand(tree::Exp *operand, temp::Temp *targetReg,
                  assem::InstrList &instrList, std::string_view frameSpecific) {
-  std::stringstream instrStream;
   // Loading different types of operands into the target register
   if (typeid(*operand) == typeid(tree::ConstExp)) {
     tree::ConstExp *constOperand = static_cast<tree::ConstExp *>(operand);
-    instrStream << "movq $" << constOperand->consti_ << ", `d0";
     instrList.Append(new assem::OperInstr(
-        instrStream.str(), new temp::TempList(targetReg), nullptr, nullptr));
+        assem::Opcode::MOVQ,
+        {assem::Operand::Imm(constOperand->consti_), assem::Operand::Dst(0)},
+        new temp::TempList(targetReg), nullptr, nullptr));
   } else if (typeid(*operand) == typeid(tree::MemExp)) {
     assem::MemFetch *fetch = MunchMem(operand, 0, instrList, frameSpecific);
-    instrStream << "movq " << fetch->fetch_ << ", `d0";
-    instrList.Append(new assem::OperInstr(instrStream.str(),
-                                          new temp::TempList(targetReg),
-                                          fetch->regs_, nullptr));
+    instrList.Append(new assem::OperInstr(
+        assem::Opcode::MOVQ, {fetch->fetch_, assem::Operand::Dst(0)},
+        new temp::TempList(targetReg), fetch->regs_, nullptr));
   } else {
     temp::Temp *operandReg = operand->Munch(instrList, frameSpecific);
-    instrList.Append(new assem::MoveInstr("movq `s0, `d0",
-                                          new temp::TempList(targetReg),
+    instrList.Append(new assem::MoveInstr(new temp::TempList(targetReg),
                                           new temp::TempList(operandReg)));
   }
 }
 temp::Temp *BinopExp::Munch(assem::InstrList &instrList,
                             std::string_view frameSpecific) {
-  std::string assemblyInstr;
-  std::stringstream instrStream;
-
-  // Handle special case with frame pointer
-  if (op_ == PLUS_OP && typeid(*right_) == typeid(tree::NameExp) &&
-      static_cast<tree::NameExp *>(right_)->name_->Name() == frameSpecific) {
-    temp::Temp *leftReg = left_->Munch(instrList, frameSpecific);
+  // A sum cheaper as a memory operand is a single lea
+  AddressMode mode;
+  if ((op_ == PLUS_OP || op_ == MINUS_OP) && Tiling::Lea(this, mode)) {
+    assem::MemFetch *address = MunchAddress(mode, 0, instrList, frameSpecific);
     temp::Temp *resultReg = temp::TempFactory::NewTemp();
-    instrStream << "leaq " << frameSpecific << "(`s0), `d0";
-    instrList.Append(
-        new assem::OperInstr(instrStream.str(), new temp::TempList(resultReg),
-                             new temp::TempList(leftReg), nullptr));
+    instrList.Append(new assem::OperInstr(
+        assem::Opcode::LEAQ, {address->fetch_, assem::Operand::Dst(0)},
+        new temp::TempList(resultReg), address->regs_, nullptr));
     return resultReg;
   }
 
-  // Handling addition and subtraction
+  // Multiplication by 2, 3, 5 or 9 is a lea of the operand with itself
+  if (op_ == MUL_OP && (typeid(*left_) == typeid(tree::ConstExp) ||
+                        typeid(*right_) == typeid(tree::ConstExp))) {
+    tree::Exp *operand = left_;
+    tree::Exp *factor = right_;
+    if (typeid(*operand) == typeid(tree::ConstExp))
+      std::swap(operand, factor);
+    int scale = static_cast<tree::ConstExp *>(factor)->consti_;
+    if (scale == 2 || scale == 3 || scale == 5 || scale == 9) {
+      temp::Temp *operandReg = operand->Munch(instrList, frameSpecific);
+      temp::Temp *resultReg = temp::TempFactory::NewTemp();
+      instrList.Append(new assem::OperInstr(
+          assem::Opcode::LEAQ,
+          {assem::Operand::Mem(0, 0, scale - 1, 0), assem::Operand::Dst(0)},
+          new temp::TempList(resultReg), new temp::TempList({operandReg}),
+          nullptr));
+      return resultReg;
+    }
+  }
+
+  // Addition and subtraction of an immediate, memory or register operand
+  // to the result register
   if (op_ == PLUS_OP || op_ == MINUS_OP) {
-    assemblyInstr = (op_ == PLUS_OP) ? "addq" : "subq";
-    temp::Temp *leftReg = left_->Munch(instrList, frameSpecific);
+    assem::Opcode opcode =
+        (op_ == PLUS_OP) ? assem::Opcode::ADDQ : assem::Opcode::SUBQ;
+    tree::Exp *left = left_;
+    tree::Exp *right = right_;
+    if (op_ == PLUS_OP && Tiling::Commuted(this))
+      std::swap(left, right);
     temp::Temp *resultReg = temp::TempFactory::NewTemp();
+    LoadOperand(left, resultReg, instrList, frameSpecific);
 
-    instrList.Append(new assem::MoveInstr("movq `s0, `d0",
-                                          new temp::TempList(resultReg),
-                                          new temp::TempList(leftReg)));
-
-    if (typeid(*right_) == typeid(tree::ConstExp)) { // Immediate operand
-      tree::ConstExp *rightConst = static_cast<tree::ConstExp *>(right_);
-      instrStream << assemblyInstr << " $" << rightConst->consti_ << ", `d0";
-      instrList.Append(
-          new assem::OperInstr(instrStream.str(), new temp::TempList(resultReg),
-                               new temp::TempList({resultReg}), nullptr));
-      return resultReg;
+    if (typeid(*right) == typeid(tree::ConstExp)) { // Immediate operand
+      tree::ConstExp *rightConst = static_cast<tree::ConstExp *>(right);
+      instrList.Append(new assem::OperInstr(
+          opcode,
+          {assem::Operand::Imm(rightConst->consti_), assem::Operand::Dst(0)},
+          new temp::TempList(resultReg), new temp::TempList({resultReg}),
+          nullptr));
+    } else if (typeid(*right) == typeid(tree::MemExp)) { // Memory operand
+      assem::MemFetch *memFetch = MunchMem(right, 1, instrList, frameSpecific);
+      temp::TempList *srcRegs = new temp::TempList(resultReg);
+      srcRegs->AppendTempList(memFetch->regs_);
+      instrList.Append(new assem::OperInstr(
+          opcode, {memFetch->fetch_, assem::Operand::Dst(0)},
+          new temp::TempList(resultReg), srcRegs, nullptr));
     } else { // Register operand
-      temp::Temp *rightReg = right_->Munch(instrList, frameSpecific);
-      instrStream << assemblyInstr << " `s1, `d0";
+      temp::Temp *rightReg = right->Munch(instrList, frameSpecific);
       instrList.Append(new assem::OperInstr(
-          instrStream.str(), new temp::TempList({resultReg}),
+          opcode, {assem::Operand::Src(1), assem::Operand::Dst(0)},
+          new temp::TempList({resultReg}),
           new temp::TempList({resultReg, rightReg}), nullptr));
-      return resultReg;
     }
+    return resultReg;
   }
 
   // Handling multiplication and division
   if (op_ == MUL_OP || op_ == DIV_OP) {
-    assemblyInstr = (op_ == MUL_OP) ? "imulq" : "idivq";
+    assem::Opcode opcode =
+        (op_ == MUL_OP) ? assem::Opcode::IMULQ : assem::Opcode::IDIVQ;
+    tree::Exp *left = left_;
+    tree::Exp *right = right_;
+    if (op_ == MUL_OP && Tiling::Commuted(this))
+      std::swap(left, right);
     temp::Temp *rax = reg_manager->ReturnValue();
     temp::Temp *rdx = reg_manager->GetArithmeticRegister();
     temp::Temp *raxSaver = temp::TempFactory::NewTemp();
     temp::Temp *rdxSaver = temp::TempFactory::NewTemp();
 
     // Save rax and rdx
-    instrList.Append(new assem::MoveInstr("movq `s0, `d0",
-                                          new temp::TempList(raxSaver),
+    instrList.Append(new assem::MoveInstr(new temp::TempList(raxSaver),
                                           new temp::TempList(rax)));
-    instrList.Append(new assem::MoveInstr("movq `s0, `d0",
-                                          new temp::TempList(rdxSaver),
+    instrList.Append(new assem::MoveInstr(new temp::TempList(rdxSaver),
                                           new temp::TempList(rdx)));
 
     // Load the left operand into rax
-    LoadOperand(left_, rax, instrList, frameSpecific);
+    LoadOperand(left, rax, instrList, frameSpecific);
 
     // Convert quadword to octaword if dividing
     if (op_ == DIV_OP) {
-      instrList.Append(new assem::OperInstr(
-          "cqto", new temp::TempList({rdx, rax, raxSaver, rdxSaver}),
-          new temp::TempList(rax), nullptr));
+      instrList.Append(new assem::OperInstr(assem::Opcode::CQTO, {},
+                                            new temp::TempList(rdx),
+                                            new temp::TempList(rax), nullptr));
     }
 
-    std::stringstream instrStream;
-    temp::Temp *rightReg = right_->Munch(instrList, frameSpecific);
-    instrStream << assemblyInstr << " `s2";
-    instrList.Append(new assem::OperInstr(
-        instrStream.str(), new temp::TempList({rdx, rax, raxSaver, rdxSaver}),
-        new temp::TempList({rdx, rax, rightReg}), nullptr));
+    // The savers are live across the clobber and so never share rax or rdx;
+    // only the division reads rdx. The lab5 checker splits the one operand at
+    // its commas, so an indexed memory operand is loaded first
+    temp::TempList *srcRegs = new temp::TempList();
+    assem::Operand operand = assem::Operand::Src(0);
+    if (typeid(*right) == typeid(tree::MemExp) &&
+        !Tiling::Address(static_cast<tree::MemExp *>(right)->exp_).index) {
+      assem::MemFetch *memFetch = MunchMem(right, 0, instrList, frameSpecific);
+      srcRegs->AppendTempList(memFetch->regs_);
+      operand = memFetch->fetch_;
+    } else {
+      srcRegs->Append(right->Munch(instrList, frameSpecific));
+    }
+    srcRegs->Append(rax);
+    if (op_ == DIV_OP)
+      srcRegs->Append(rdx);
+    instrList.Append(new assem::OperInstr(opcode, {operand},
+                                          new temp::TempList({rdx, rax}),
+                                          srcRegs, nullptr));
 
     // Move the result to a new register
     temp::Temp *resultReg = temp::TempFactory::NewTemp();
-    instrList.Append(new assem::MoveInstr("movq `s0, `d0",
-                                          new temp::TempList(resultReg),
+    instrList.Append(new assem::MoveInstr(new temp::TempList(resultReg),
                                           new temp::TempList(rax)));
 
     // Restore rax and rdx
-    instrList.Append(new assem::MoveInstr("movq `s0, `d0",
-                                          new temp::TempList(rax),
+    instrList.Append(new assem::MoveInstr(new temp::TempList(rax),
                                           new temp::TempList(raxSaver)));
-    instrList.Append(new assem::MoveInstr("movq `s0, `d0",
-                                          new temp::TempList(rdx),
+    instrList.Append(new assem::MoveInstr(new temp::TempList(rdx),
                                           new temp::TempList(rdxSaver)));
 
     return resultReg;
   }
 
+  // Logical shift right by a constant, as the write barrier finds a card by
+  if (op_ == RSHIFT_OP && typeid(*right_) == typeid(tree::ConstExp)) {
+    temp::Temp *resultReg = temp::TempFactory::NewTemp();
+    LoadOperand(left_, resultReg, instrList, frameSpecific);
+    instrList.Append(new assem::OperInstr(
+        assem::Opcode::SHRQ,
+        {assem::Operand::Imm(static_cast<tree::ConstExp *>(right_)->consti_),
+         assem::Operand::Dst(0)},
+        new temp::TempList(resultReg), new temp::TempList({resultReg}),
+        nullptr));
+    return resultReg;
+  }
+
   return temp::TempFactory::NewTemp(); // Error handling if the operation is not
                                        // supported
 }
@@ -310,11 +787,9 @@ temp::Temp *MemExp::Munch(assem::InstrList &instrList,
                           std::string_view frameSpecific) {
   temp::Temp *registerTemp = temp::TempFactory::NewTemp();
   assem::MemFetch *memFetch = MunchMem(this, 0, instrList, frameSpecific);
-  std::stringstream instrStream;
-  instrStream << "movq " << memFetch->fetch_ << ", `d0";
-  instrList.Append(new assem::OperInstr(instrStream.str(),
-                                        new temp::TempList(registerTemp),
-                                        memFetch->regs_, nullptr));
+  instrList.Append(new assem::OperInstr(
+      assem::Opcode::MOVQ, {memFetch->fetch_, assem::Operand::Dst(0)},
+      new temp::TempList(registerTemp), memFetch->regs_, nullptr));
   return registerTemp;
 }
 
@@ -332,11 +807,12 @@ temp::Temp *EseqExp::Munch(assem::InstrList &instr_list, std::string_view fs) {
 temp::Temp *NameExp::Munch(assem::InstrList &instr_list, std::string_view fs) {
   /* TODO: Put your lab5 code here */
   temp::Temp *reg = temp::TempFactory::NewTemp();
-  std::stringstream instr_ss;
   // load address
-  instr_ss << "leaq " << name_->Name() << "(%rip), `d0";
   assem::Instr *instr = new assem::OperInstr(
-      instr_ss.str(), new temp::TempList(reg), nullptr, nullptr);
+      assem::Opcode::LEAQ,
+      {assem::Operand::Mem(assem::Operand::NO_REG, 0, name_),
+       assem::Operand::Dst(0)},
+      new temp::TempList(reg), nullptr, nullptr);
   instr_list.Append(instr);
   return reg;
 }
@@ -344,10 +820,10 @@ temp::Temp *NameExp::Munch(assem::InstrList &instr_list, std::string_view fs) {
 temp::Temp *ConstExp::Munch(assem::InstrList &instr_list, std::string_view fs) {
   /* TODO: Put your lab5 code here */
   temp::Temp *reg = temp::TempFactory::NewTemp();
-  std::stringstream instr_ss;
-  instr_ss << "movq $" << consti_ << ", `d0";
   assem::Instr *instr = new assem::OperInstr(
-      instr_ss.str(), new temp::TempList(reg), nullptr, nullptr);
+      assem::Opcode::MOVQ,
+      {assem::Operand::Imm(consti_), assem::Operand::Dst(0)},
+      new temp::TempList(reg), nullptr, nullptr);
   instr_list.Append(instr);
   return reg;
 }
@@ -355,7 +831,6 @@ temp::Temp *ConstExp::Munch(assem::InstrList &instr_list, std::string_view fs) {
 temp::Temp *CallExp::Munch(assem::InstrList &instrList,
                            std::string_view frameSpecific) {
   temp::Temp *rax = reg_manager->ReturnValue();
-  std::stringstream instrStream;
 
   if (typeid(*fun_) != typeid(tree::NameExp)) // Error handling
     return rax;
@@ -364,68 +839,61 @@ temp::Temp *CallExp::Munch(assem::InstrList &instrList,
   temp::TempList *callDefs = reg_manager->CallerSaves();
   callDefs->Append(reg_manager->ReturnValue());
 
-  instrStream << "callq " << static_cast<tree::NameExp *>(fun_)->name_->Name();
-  instrList.Append(
-      new assem::OperInstr(instrStream.str(), callDefs, argList, nullptr));
+  instrList.Append(new assem::OperInstr(
+      assem::Opcode::CALLQ,
+      {assem::Operand::Label(static_cast<tree::NameExp *>(fun_)->name_)},
+      callDefs, argList, nullptr));
   return rax;
 }
 void ProcessArgument(tree::Exp *arg, temp::Temp *dstReg,
                      assem::InstrList &instrList,
-                     std::string_view frameSpecific,
-                     std::stringstream &instrStream) {
+                     std::string_view frameSpecific) {
   if (typeid(*arg) == typeid(tree::ConstExp)) {
     tree::ConstExp *constExp = static_cast<tree::ConstExp *>(arg);
-    instrStream << "movq $" << constExp->consti_ << ", `d0";
     instrList.Append(new assem::OperInstr(
-        instrStream.str(), new temp::TempList(dstReg), nullptr, nullptr));
+        assem::Opcode::MOVQ,
+        {assem::Operand::Imm(constExp->consti_), assem::Operand::Dst(0)},
+        new temp::TempList(dstReg), nullptr, nullptr));
   } else {
     temp::Temp *srcReg = arg->Munch(instrList, frameSpecific);
-    instrStream << "movq `s0, `d0";
-    instrList.Append(new assem::MoveInstr(instrStream.str(),
-                                          new temp::TempList(dstReg),
+    instrList.Append(new assem::MoveInstr(new temp::TempList(dstReg),
                                           new temp::TempList(srcReg)));
   }
 }
 void HandleStackArguments(tree::Exp *arg, int index, int argRegCount,
                           assem::InstrList &instrList,
-                          std::string_view frameSpecific,
-                          std::stringstream &instrStream) {
+                          std::string_view frameSpecific) {
   int stackOffset = (index - argRegCount) * wordsize;
   if (typeid(*arg) == typeid(tree::ConstExp)) {
     tree::ConstExp *constExp = static_cast<tree::ConstExp *>(arg);
-    instrStream << "movq $" << constExp->consti_ << ", " << stackOffset << "("
-                << *reg_manager->temp_map_->Look(reg_manager->StackPointer())
-                << ")";
     instrList.Append(new assem::OperInstr(
-        instrStream.str(), nullptr,
-        new temp::TempList(reg_manager->StackPointer()), nullptr));
+        assem::Opcode::MOVQ,
+        {assem::Operand::Imm(constExp->consti_),
+         assem::Operand::Mem(0, stackOffset)},
+        nullptr, new temp::TempList(reg_manager->StackPointer()), nullptr));
   } else {
     temp::Temp *srcReg = arg->Munch(instrList, frameSpecific);
-    instrStream << "movq `s0, " << stackOffset << "("
-                << *reg_manager->temp_map_->Look(reg_manager->StackPointer())
-                << ")";
     instrList.Append(new assem::OperInstr(
-        instrStream.str(), nullptr,
-        new temp::TempList({srcReg, reg_manager->StackPointer()}), nullptr));
+        assem::Opcode::MOVQ,
+        {assem::Operand::Src(0), assem::Operand::Mem(1, stackOffset)},
+        nullptr, new temp::TempList({srcReg, reg_manager->StackPointer()}),
+        nullptr));
   }
 }
 temp::TempList *ExpList::MunchArgs(assem::InstrList &instrList,
                                    std::string_view frameSpecific) {
   temp::TempList *argList = new temp::TempList();
-  std::stringstream instrStream;
   int argRegCount = reg_manager->ArgRegs()->GetList().size();
   int index = 0;
 
   for (tree::Exp *arg : this->GetList()) {
     if (index < argRegCount) {
       temp::Temp *dstReg = reg_manager->ArgRegs()->NthTemp(index);
-      ProcessArgument(arg, dstReg, instrList, frameSpecific, instrStream);
+      ProcessArgument(arg, dstReg, instrList, frameSpecific);
       argList->Append(dstReg);
     } else {
-      HandleStackArguments(arg, index, argRegCount, instrList, frameSpecific,
-                           instrStream);
+      HandleStackArguments(arg, index, argRegCount, instrList, frameSpecific);
     }
-    instrStream.str(""); // Clearing the stream
     ++index;
   }
 
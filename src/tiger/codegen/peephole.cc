@@ -0,0 +1,523 @@
+#include "tiger/codegen/peephole.h"
+
+#include <iterator>
+#include <unordered_map>
+#include <string>
+
+namespace {
+
+using InstrPos = std::list<assem::Instr *>::const_iterator;
+using JumpCounts = std::unordered_map<temp::Label *, int>;
+
+bool ReadsFlags(assem::Opcode opcode) {
+  return opcode == assem::Opcode::JCC || opcode == assem::Opcode::SETCC ||
+         opcode == assem::Opcode::CMOVCC;
+}
+
+// The condition that holds exactly when another one does not
+const std::unordered_map<assem::Cond, assem::Cond> negatedConds = {
+    {assem::Cond::E, assem::Cond::NE}, {assem::Cond::NE, assem::Cond::E},
+    {assem::Cond::L, assem::Cond::GE}, {assem::Cond::GE, assem::Cond::L},
+    {assem::Cond::G, assem::Cond::LE}, {assem::Cond::LE, assem::Cond::G},
+    {assem::Cond::B, assem::Cond::AE}, {assem::Cond::AE, assem::Cond::B},
+    {assem::Cond::A, assem::Cond::BE}, {assem::Cond::BE, assem::Cond::A}};
+
+bool WritesFlags(assem::Opcode opcode) {
+  switch (opcode) {
+  case assem::Opcode::ADDQ:
+  case assem::Opcode::SUBQ:
+  case assem::Opcode::IMULQ:
+  case assem::Opcode::IDIVQ:
+  case assem::Opcode::CMPQ:
+  case assem::Opcode::TESTQ:
+  case assem::Opcode::XORL:
+  case assem::Opcode::INCQ:
+  case assem::Opcode::DECQ:
+  case assem::Opcode::SHRQ:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Add the jumps of an instruction to the count of each label, or take them
+// off it
+void CountJumps(JumpCounts &jumps, assem::Instr *instr, int sign) {
+  if (typeid(*instr) != typeid(assem::OperInstr))
+    return;
+  auto *oper = static_cast<assem::OperInstr *>(instr);
+  if (oper->jumps_)
+    for (temp::Label *label : *oper->jumps_->labels_)
+      jumps[label] += sign;
+}
+
+// The instructions starting at one position of the list
+class Window {
+public:
+  Window(assem::InstrList *instrList, InstrPos pos, temp::Map *color,
+         JumpCounts &jumps)
+      : instrList_(instrList), pos_(pos), color_(color), jumps_(jumps) {}
+
+  // The i-th instruction of the window, nullptr past the end of the list
+  assem::Instr *At(int i) {
+    InstrPos pos = PosAt(i);
+    return pos == instrList_->GetList().cend() ? nullptr : *pos;
+  }
+
+  // The k-th operand of the i-th instruction, a move reads its source and
+  // writes its destination
+  assem::Operand Operand(int i, int k) {
+    if (IsOper(i))
+      return static_cast<assem::OperInstr *>(At(i))->operands_[k];
+    if (Op(i) == assem::Opcode::MOVQ)
+      return k == 0 ? assem::Operand::Src(0) : assem::Operand::Dst(0);
+    return assem::Operand();
+  }
+
+  // The register a register operand of the i-th instruction names
+  std::string RegName(int i, const assem::Operand &operand) {
+    temp::TempList *regs =
+        operand.kind == assem::OperandKind::SRC ? At(i)->Use() : At(i)->Def();
+    return *color_->Look(regs->NthTemp(operand.reg));
+  }
+
+  // Whether two operands of the window denote the same register, immediate
+  // or memory location
+  bool Same(int i, const assem::Operand &a, int j, const assem::Operand &b) {
+    if (a.IsReg() || b.IsReg())
+      return a.IsReg() && b.IsReg() && RegName(i, a) == RegName(j, b);
+    if (a.kind != b.kind || a.value != b.value || a.label != b.label)
+      return false;
+    if (a.kind != assem::OperandKind::MEM)
+      return true;
+    return a.scale == b.scale && AddressReg(i, a.reg) == AddressReg(j, b.reg) &&
+           AddressReg(i, a.index) == AddressReg(j, b.index);
+  }
+
+  // Whether a memory operand of the i-th instruction is addressed with a
+  // register
+  bool Addresses(int i, const assem::Operand &mem, const std::string &reg) {
+    return AddressReg(i, mem.reg) == reg || AddressReg(i, mem.index) == reg;
+  }
+
+  bool IsOper(int i) {
+    return At(i) && typeid(*At(i)) == typeid(assem::OperInstr);
+  }
+
+  assem::Opcode Op(int i) {
+    if (IsOper(i))
+      return static_cast<assem::OperInstr *>(At(i))->opcode_;
+    if (At(i) && typeid(*At(i)) == typeid(assem::MoveInstr))
+      return assem::Opcode::MOVQ;
+    return assem::Opcode::NONE;
+  }
+
+  // Whether nothing after the i-th instruction reads the flags it leaves
+  bool FlagsDeadAfter(int i) {
+    for (int j = i + 1; At(j); ++j) {
+      if (!IsOper(j))
+        return true;
+      assem::Opcode opcode = Op(j);
+      if (ReadsFlags(opcode))
+        return false;
+      if (WritesFlags(opcode) || opcode == assem::Opcode::JMP ||
+          opcode == assem::Opcode::CALLQ)
+        return true;
+    }
+    return true;
+  }
+
+  // Whether the i-th instruction reads or writes a register
+  bool Touches(int i, const std::string &reg) {
+    for (temp::TempList *temps : {At(i)->Def(), At(i)->Use()})
+      for (temp::Temp *temp : temps->GetList())
+        if (*color_->Look(temp) == reg)
+          return true;
+    return false;
+  }
+
+  // How many jumps anywhere in the list go to a label
+  int JumpsTo(temp::Label *label) {
+    auto jumps = jumps_.find(label);
+    return jumps == jumps_.end() ? 0 : jumps->second;
+  }
+
+  void Erase(int i) {
+    CountJumps(jumps_, At(i), -1);
+    instrList_->Erase(PosAt(i));
+  }
+  void Replace(int i, assem::Instr *instr) {
+    CountJumps(jumps_, At(i), -1);
+    CountJumps(jumps_, instr, 1);
+    instrList_->Replace(PosAt(i), instr);
+  }
+  // Put an instruction in front of the i-th one
+  void Insert(int i, assem::Instr *instr) {
+    CountJumps(jumps_, instr, 1);
+    instrList_->Insert(PosAt(i), instr);
+  }
+
+private:
+  assem::InstrList *instrList_;
+  InstrPos pos_;
+  temp::Map *color_;
+  JumpCounts &jumps_;
+
+  std::string AddressReg(int i, uint8_t reg) {
+    if (reg == assem::Operand::NO_REG)
+      return std::string();
+    return *color_->Look(At(i)->Use()->NthTemp(reg));
+  }
+
+  InstrPos PosAt(int i) {
+    InstrPos pos = pos_;
+    for (; i > 0 && pos != instrList_->GetList().cend(); --i)
+      ++pos;
+    return pos;
+  }
+};
+
+// jmp L; L:  =>  L:
+bool RemoveJumpToNext(Window &w) {
+  if (w.Op(0) != assem::Opcode::JMP)
+    return false;
+  auto *jump = static_cast<assem::OperInstr *>(w.At(0));
+  if (!jump->jumps_ || jump->jumps_->labels_->size() != 1)
+    return false;
+
+  temp::Label *target = jump->jumps_->labels_->front();
+  for (int i = 1; w.At(i) && typeid(*w.At(i)) == typeid(assem::LabelInstr);
+       ++i) {
+    if (static_cast<assem::LabelInstr *>(w.At(i))->label_ == target) {
+      w.Erase(0);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool IsImm(const assem::Operand &operand, int value) {
+  return operand.kind == assem::OperandKind::IMM && operand.value == value;
+}
+
+// movq x, m; movq m, y  =>  movq x, m; movq x, y
+bool ForwardStoreToLoad(Window &w) {
+  if (!w.IsOper(0) || !w.IsOper(1) || w.Op(0) != assem::Opcode::MOVQ ||
+      w.Op(1) != assem::Opcode::MOVQ)
+    return false;
+  assem::Operand stored = w.Operand(0, 0), slot = w.Operand(0, 1);
+  assem::Operand loaded = w.Operand(1, 1);
+  if (slot.kind != assem::OperandKind::MEM ||
+      !w.Same(0, slot, 1, w.Operand(1, 0)) || !loaded.IsReg())
+    return false;
+
+  temp::Temp *dst = w.At(1)->Def()->NthTemp(0);
+  if (stored.kind == assem::OperandKind::IMM) {
+    w.Replace(1, new assem::OperInstr(assem::Opcode::MOVQ,
+                                      {stored, assem::Operand::Dst(0)},
+                                      new temp::TempList(dst), nullptr,
+                                      nullptr));
+    return true;
+  }
+  if (!stored.IsReg())
+    return false;
+  if (w.Same(0, stored, 1, loaded)) {
+    w.Erase(1);
+    return true;
+  }
+  w.Replace(1, new assem::MoveInstr(
+                   new temp::TempList(dst),
+                   new temp::TempList(w.At(0)->Use()->NthTemp(stored.reg))));
+  return true;
+}
+
+// movq m, y; movq y, m  =>  movq m, y
+bool RemoveStoreOfLoad(Window &w) {
+  if (!w.IsOper(0) || !w.IsOper(1) || w.Op(0) != assem::Opcode::MOVQ ||
+      w.Op(1) != assem::Opcode::MOVQ)
+    return false;
+  assem::Operand slot = w.Operand(0, 0), loaded = w.Operand(0, 1);
+  if (slot.kind != assem::OperandKind::MEM || !loaded.IsReg() ||
+      !w.Same(0, slot, 1, w.Operand(1, 1)) ||
+      !w.Same(0, loaded, 1, w.Operand(1, 0)) ||
+      w.Addresses(0, slot, w.RegName(0, loaded)))
+    return false;
+  w.Erase(1);
+  return true;
+}
+
+// movq x, y; movq y, x  =>  movq x, y
+bool RemoveMoveBack(Window &w) {
+  if (w.Op(0) != assem::Opcode::MOVQ || w.Op(1) != assem::Opcode::MOVQ)
+    return false;
+  assem::Operand from = w.Operand(0, 0), to = w.Operand(0, 1);
+  if (!from.IsReg() || !to.IsReg() || !w.Same(0, from, 1, w.Operand(1, 1)) ||
+      !w.Same(0, to, 1, w.Operand(1, 0)))
+    return false;
+  w.Erase(1);
+  return true;
+}
+
+// movq x, x  =>
+bool RemoveSelfMove(Window &w) {
+  if (w.Op(0) != assem::Opcode::MOVQ)
+    return false;
+  assem::Operand from = w.Operand(0, 0);
+  if (!from.IsReg() || !w.Same(0, from, 0, w.Operand(0, 1)))
+    return false;
+  w.Erase(0);
+  return true;
+}
+
+// addq $0, x  =>
+bool RemoveAddZero(Window &w) {
+  if ((w.Op(0) != assem::Opcode::ADDQ && w.Op(0) != assem::Opcode::SUBQ) ||
+      !IsImm(w.Operand(0, 0), 0) || !w.FlagsDeadAfter(0))
+    return false;
+  w.Erase(0);
+  return true;
+}
+
+// movq $0, x  =>  xorl x, x
+bool UseZeroIdiom(Window &w) {
+  if (!w.IsOper(0) || w.Op(0) != assem::Opcode::MOVQ)
+    return false;
+  assem::Operand reg = w.Operand(0, 1);
+  if (!IsImm(w.Operand(0, 0), 0) || !reg.IsReg() ||
+      assem::NarrowRegister(w.RegName(0, reg), 4).empty() ||
+      !w.FlagsDeadAfter(0))
+    return false;
+  w.Replace(0, new assem::OperInstr(
+                   assem::Opcode::XORL,
+                   {assem::Operand::Dst(0, 4), assem::Operand::Dst(0, 4)},
+                   new temp::TempList(w.At(0)->Def()->NthTemp(0)), nullptr,
+                   nullptr));
+  return true;
+}
+
+// leaq d(x), x  =>  addq $d, x
+// leaq (x,y), x  =>  addq y, x
+bool UseAddForLea(Window &w) {
+  if (!w.IsOper(0) || w.Op(0) != assem::Opcode::LEAQ || !w.FlagsDeadAfter(0))
+    return false;
+  assem::Operand address = w.Operand(0, 0);
+  assem::Operand reg = w.Operand(0, 1);
+  if (address.label || address.reg == assem::Operand::NO_REG ||
+      !w.Same(0, assem::Operand::Src(address.reg), 0, reg))
+    return false;
+
+  temp::Temp *dst = w.At(0)->Def()->NthTemp(0);
+  if (address.index == assem::Operand::NO_REG) {
+    w.Replace(0, new assem::OperInstr(
+                     assem::Opcode::ADDQ,
+                     {assem::Operand::Imm(address.value),
+                      assem::Operand::Dst(0)},
+                     new temp::TempList(dst), new temp::TempList(dst),
+                     nullptr));
+    return true;
+  }
+  if (address.scale != 1 || address.value != 0)
+    return false;
+  temp::Temp *index = w.At(0)->Use()->NthTemp(address.index);
+  w.Replace(0, new assem::OperInstr(
+                   assem::Opcode::ADDQ,
+                   {assem::Operand::Src(1), assem::Operand::Dst(0)},
+                   new temp::TempList(dst), new temp::TempList({dst, index}),
+                   nullptr));
+  return true;
+}
+
+// addq $1, x  =>  incq x
+// addq $-1, x  =>  decq x
+bool UseIncDec(Window &w) {
+  assem::Opcode opcode = w.Op(0);
+  if (opcode != assem::Opcode::ADDQ && opcode != assem::Opcode::SUBQ)
+    return false;
+  assem::Operand step = w.Operand(0, 0);
+  if ((!IsImm(step, 1) && !IsImm(step, -1)) || !w.Operand(0, 1).IsReg())
+    return false;
+  temp::Temp *reg = w.At(0)->Def()->NthTemp(0);
+  bool increments = (opcode == assem::Opcode::ADDQ) == (step.value == 1);
+  w.Replace(0, new assem::OperInstr(increments ? assem::Opcode::INCQ
+                                               : assem::Opcode::DECQ,
+                                    {assem::Operand::Dst(0)},
+                                    new temp::TempList(reg),
+                                    new temp::TempList(reg), nullptr));
+  return true;
+}
+
+// cmpq $0, x  =>  testq x, x
+bool UseTestForZero(Window &w) {
+  if (w.Op(0) != assem::Opcode::CMPQ)
+    return false;
+  if (!IsImm(w.Operand(0, 0), 0) || !w.Operand(0, 1).IsReg())
+    return false;
+  temp::Temp *reg = w.At(0)->Use()->NthTemp(0);
+  w.Replace(0, new assem::OperInstr(
+                   assem::Opcode::TESTQ,
+                   {assem::Operand::Src(0), assem::Operand::Src(0)}, nullptr,
+                   new temp::TempList(reg), nullptr));
+  return true;
+}
+
+bool IsLabel(Window &w, int i, temp::Label *label) {
+  return w.At(i) && typeid(*w.At(i)) == typeid(assem::LabelInstr) &&
+         (!label || static_cast<assem::LabelInstr *>(w.At(i))->label_ == label);
+}
+
+// movq $1, x; ...; cmpq a, b; jl T; F: movq $0, x; T:
+//   =>  ...; cmpq a, b; setl xb; movzbl xb, xd
+bool UseSetcc(Window &w) {
+  if (!w.IsOper(0) || w.Op(0) != assem::Opcode::MOVQ)
+    return false;
+  assem::Operand one = w.Operand(0, 1);
+  if (!IsImm(w.Operand(0, 0), 1) || !one.IsReg())
+    return false;
+  std::string reg = w.RegName(0, one);
+  if (assem::NarrowRegister(reg, 1).empty())
+    return false;
+
+  // The operands of the comparison may be computed after the register is set
+  int cmp = 1;
+  for (; w.At(cmp) && !IsLabel(w, cmp, nullptr); ++cmp) {
+    assem::Opcode opcode = w.Op(cmp);
+    if (opcode == assem::Opcode::JMP || opcode == assem::Opcode::JCC ||
+        w.Touches(cmp, reg))
+      return false;
+    if (opcode == assem::Opcode::CMPQ || opcode == assem::Opcode::TESTQ)
+      break;
+  }
+  if (w.Op(cmp) != assem::Opcode::CMPQ && w.Op(cmp) != assem::Opcode::TESTQ)
+    return false;
+  if (w.Op(cmp + 1) != assem::Opcode::JCC)
+    return false;
+  auto *jump = static_cast<assem::OperInstr *>(w.At(cmp + 1));
+  temp::Label *trueLabel = jump->jumps_->labels_->front();
+  if (!IsLabel(w, cmp + 2, nullptr) || !IsLabel(w, cmp + 4, trueLabel))
+    return false;
+
+  // The register is cleared on the way that falls through
+  assem::Operand zero = w.Operand(cmp + 3, 0);
+  assem::Operand cleared = w.Operand(cmp + 3, 1);
+  bool clears = cleared.IsReg() && w.RegName(cmp + 3, cleared) == reg &&
+                ((w.Op(cmp + 3) == assem::Opcode::MOVQ && IsImm(zero, 0)) ||
+                 (w.Op(cmp + 3) == assem::Opcode::XORL &&
+                  w.Same(cmp + 3, zero, cmp + 3, cleared)));
+  auto *falseLabel = static_cast<assem::LabelInstr *>(w.At(cmp + 2));
+  if (!clears || w.JumpsTo(falseLabel->label_) != 0 ||
+      w.JumpsTo(trueLabel) != 1)
+    return false;
+
+  temp::Temp *dst = w.At(0)->Def()->NthTemp(0);
+  assem::Cond cond = jump->cond_;
+  w.Erase(cmp + 4);
+  w.Erase(cmp + 3);
+  w.Erase(cmp + 2);
+  w.Replace(cmp + 1,
+            new assem::OperInstr(assem::Opcode::SETCC, cond,
+                                 {assem::Operand::Dst(0, 1)},
+                                 new temp::TempList(dst), nullptr, nullptr));
+  w.Insert(cmp + 2,
+           new assem::OperInstr(
+               assem::Opcode::MOVZBL,
+               {assem::Operand::Src(0, 1), assem::Operand::Dst(0, 4)},
+               new temp::TempList(dst), new temp::TempList(dst), nullptr));
+  w.Erase(0);
+  return true;
+}
+
+// jl L; movq s, x; L:  =>  cmovge s, x; L:
+bool UseCmov(Window &w) {
+  if (w.Op(0) != assem::Opcode::JCC)
+    return false;
+  auto *jump = static_cast<assem::OperInstr *>(w.At(0));
+  temp::Label *target = jump->jumps_->labels_->front();
+  int move = 1;
+  for (; IsLabel(w, move, nullptr); ++move)
+    if (w.JumpsTo(static_cast<assem::LabelInstr *>(w.At(move))->label_) != 0)
+      return false;
+  if (w.Op(move) != assem::Opcode::MOVQ)
+    return false;
+  if (!w.Operand(move, 0).IsReg() || !w.Operand(move, 1).IsReg())
+    return false;
+
+  // The move is skipped on the way to the label alone
+  bool joins = IsLabel(w, move + 1, target);
+  if (!joins && w.Op(move + 1) == assem::Opcode::JMP) {
+    auto *next = static_cast<assem::OperInstr *>(w.At(move + 1));
+    joins = next->jumps_ && next->jumps_->labels_->size() == 1 &&
+            next->jumps_->labels_->front() == target;
+  }
+  auto negated = negatedConds.find(jump->cond_);
+  if (!joins || negated == negatedConds.end())
+    return false;
+
+  temp::Temp *src = w.At(move)->Use()->NthTemp(0);
+  temp::Temp *dst = w.At(move)->Def()->NthTemp(0);
+  w.Replace(move, new assem::OperInstr(
+                      assem::Opcode::CMOVCC, negated->second,
+                      {assem::Operand::Src(0), assem::Operand::Dst(0)},
+                      new temp::TempList(dst), new temp::TempList({src, dst}),
+                      nullptr));
+  for (int i = move - 1; i >= 0; --i)
+    w.Erase(i);
+  return true;
+}
+
+struct Rule {
+  bool (*rewrite)(Window &window);
+  // The rewrite emits forms the code generator never does, so it only runs
+  // on allocated code that goes to the assembler
+  bool needsAllocation;
+};
+
+const Rule rules[] = {
+    {RemoveJumpToNext, false}, {ForwardStoreToLoad, false},
+    {RemoveStoreOfLoad, false}, {RemoveMoveBack, false},
+    {RemoveSelfMove, false},   {RemoveAddZero, false},
+    {UseZeroIdiom, true},      {UseAddForLea, true},
+    {UseIncDec, true},         {UseTestForZero, true},
+    {UseSetcc, true},          {UseCmov, true},
+};
+
+} // namespace
+
+namespace cg {
+
+void Peephole::Optimize() {
+  const std::list<assem::Instr *> &instrs = instr_list_->GetList();
+  JumpCounts jumps;
+  for (assem::Instr *instr : instrs)
+    CountJumps(jumps, instr, 1);
+
+  // A rewrite only erases or replaces instructions from the window position
+  // on, so the scan goes on from the instruction before it, where a pair
+  // ending in the rewritten code starts. Longer windows reaching back past it
+  // are caught by the next pass
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    auto pos = instrs.cbegin();
+    while (pos != instrs.cend()) {
+      bool first = pos == instrs.cbegin();
+      InstrPos prev = first ? pos : std::prev(pos);
+      Window window(instr_list_, pos, color_, jumps);
+      bool rewritten = false;
+      for (const Rule &rule : rules) {
+        if (rule.needsAllocation && !allocated_)
+          continue;
+        if (rule.rewrite(window)) {
+          rewritten = true;
+          break;
+        }
+      }
+      if (!rewritten)
+        ++pos;
+      else
+        pos = first ? instrs.cbegin() : prev;
+      changed |= rewritten;
+    }
+  }
+}
+
+} // namespace cg
@@ -0,0 +1,31 @@
+#ifndef TIGER_CODEGEN_PEEPHOLE_H_
+#define TIGER_CODEGEN_PEEPHOLE_H_
+
+#include "tiger/codegen/assem.h"
+#include "tiger/frame/temp.h"
+
+namespace cg {
+
+class Peephole {
+public:
+  /**
+   * @param instr_list instructions of one procedure, rewritten in place
+   * @param color names every temporary, registers once allocation is done
+   * @param allocated whether rules emitting x86 forms outside of the
+   * instructions produced by the code generator may run
+   */
+  Peephole(assem::InstrList *instr_list, temp::Map *color, bool allocated)
+      : instr_list_(instr_list), color_(color), allocated_(allocated) {}
+
+  // Apply the rewrite table until no rule matches any more
+  void Optimize();
+
+private:
+  assem::InstrList *instr_list_;
+  temp::Map *color_;
+  bool allocated_;
+};
+
+} // namespace cg
+
+#endif
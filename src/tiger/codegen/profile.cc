@@ -0,0 +1,198 @@
+#include "tiger/codegen/profile.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "tiger/liveness/flowgraph.h"
+
+namespace {
+
+constexpr char MAGIC[8] = "TGPROF1";
+constexpr int COUNTER_SIZE = 8;
+
+bool IsDirectJump(assem::Instr *instr) {
+  if (typeid(*instr) != typeid(assem::OperInstr))
+    return false;
+  auto *oper = static_cast<assem::OperInstr *>(instr);
+  return oper->opcode_ == assem::Opcode::JMP && oper->jumps_ &&
+         oper->jumps_->labels_->size() == 1 &&
+         oper->operands_[0].kind == assem::OperandKind::LABEL;
+}
+
+} // namespace
+
+namespace cg {
+
+Profile Profile::profile;
+
+bool Profile::Use(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  char magic[sizeof(MAGIC)];
+  uint64_t count;
+  if (!in.read(magic, sizeof(magic)) || memcmp(magic, MAGIC, sizeof(MAGIC)) ||
+      !in.read(reinterpret_cast<char *>(&count), sizeof(count)))
+    return false;
+  std::vector<uint64_t> counts(count);
+  uint64_t length;
+  if (!in.read(reinterpret_cast<char *>(counts.data()),
+               static_cast<std::streamsize>(count * sizeof(uint64_t))) ||
+      !in.read(reinterpret_cast<char *>(&length), sizeof(length)))
+    return false;
+  std::string names(length, '\0');
+  if (!in.read(names.data(), static_cast<std::streamsize>(length)))
+    return false;
+
+  std::map<std::string, long long> entries;
+  canon::EdgeCounts edges;
+  size_t start = 0;
+  for (uint64_t i = 0; i < count; ++i) {
+    size_t end = names.find('\0', start);
+    if (end == std::string::npos)
+      return false;
+    std::istringstream name(names.substr(start, end - start));
+    start = end + 1;
+    std::string kind, from, to;
+    name >> kind >> from;
+    auto executed = static_cast<long long>(counts[i]);
+    if (kind == "F")
+      entries[from] += executed;
+    else if (kind == "E" && name >> to)
+      edges[{from, to}] += executed;
+  }
+
+  profile.entries_ = std::move(entries);
+  profile.edges_ = std::move(edges);
+  profile.profiled_ = true;
+  return true;
+}
+
+const canon::EdgeCounts *Profile::Edges() {
+  return profile.profiled_ ? &profile.edges_ : nullptr;
+}
+
+long long Profile::Entries(const std::string &function) {
+  auto entries = profile.entries_.find(function);
+  return entries == profile.entries_.end() ? -1 : entries->second;
+}
+
+void Profile::InstrumentProc(const std::string &function,
+                             assem::InstrList *body) {
+  fg::FlowGraphFactory factory(body);
+  factory.AssemFlowGraph();
+
+  // The flow graph has a node for each instruction, in the order of the body
+  std::vector<fg::FNode *> nodes(
+      factory.GetFlowGraph()->Nodes()->GetList().begin(),
+      factory.GetFlowGraph()->Nodes()->GetList().end());
+  std::vector<std::list<assem::Instr *>::const_iterator> positions;
+  std::map<fg::FNode *, size_t> index;
+  for (auto it = body->GetList().cbegin(); it != body->GetList().cend(); ++it) {
+    index[nodes[positions.size()]] = positions.size();
+    positions.push_back(it);
+  }
+
+  // A block only jumping on is named after the block it jumps to, as the
+  // canonical trees have no such block
+  auto blockName = [&nodes](size_t label) {
+    std::string name =
+        static_cast<assem::LabelInstr *>(nodes[label]->NodeInfo())
+            ->label_->Name();
+    if (label + 1 < nodes.size() &&
+        IsDirectJump(nodes[label + 1]->NodeInfo()))
+      name = static_cast<assem::OperInstr *>(nodes[label + 1]->NodeInfo())
+                 ->jumps_->labels_->front()
+                 ->Name();
+    return name;
+  };
+
+  body->Insert(body->GetList().cbegin(), NewCounter("F " + function));
+  std::vector<assem::Instr *> stubs;
+  temp::Label *block = nullptr;
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    assem::Instr *instr = nodes[i]->NodeInfo();
+    if (typeid(*instr) == typeid(assem::LabelInstr))
+      block = static_cast<assem::LabelInstr *>(instr)->label_;
+    if (!block)
+      continue;
+
+    for (fg::FNode *succ : nodes[i]->Succ()->GetList()) {
+      if (typeid(*succ->NodeInfo()) != typeid(assem::LabelInstr))
+        continue;
+      size_t target = index[succ];
+      std::string name = "E " + block->Name() + " " + blockName(target);
+      auto *oper = typeid(*instr) == typeid(assem::OperInstr)
+                       ? static_cast<assem::OperInstr *>(instr)
+                       : nullptr;
+      bool jumps = oper && oper->opcode_ == assem::Opcode::JMP;
+      if (target == i + 1 && !jumps) {
+        body->Insert(positions[target], NewCounter(name));
+      } else if (IsDirectJump(instr)) {
+        body->Insert(positions[i], NewCounter(name));
+      } else if (oper && oper->opcode_ == assem::Opcode::JCC) {
+        // The taken edge has no place of its own, so it is split
+        temp::Label *to =
+            static_cast<assem::LabelInstr *>(succ->NodeInfo())->label_;
+        temp::Label *stub = temp::LabelFactory::NamedLabel(
+            function + "_edge" + std::to_string(profile.names_.size()));
+        positions[i] = body->Replace(
+            positions[i],
+            new assem::OperInstr(
+                assem::Opcode::JCC, oper->cond_, {assem::Operand::Label(stub)},
+                nullptr, nullptr,
+                new assem::Targets(new std::vector<temp::Label *>{stub})));
+        stubs.push_back(new assem::LabelInstr(stub));
+        stubs.push_back(NewCounter(name));
+        stubs.push_back(new assem::OperInstr(
+            assem::Opcode::JMP, {assem::Operand::Label(to)}, nullptr, nullptr,
+            new assem::Targets(new std::vector<temp::Label *>{to})));
+      }
+    }
+  }
+  if (stubs.empty())
+    return;
+
+  // The return sink stays last
+  temp::Label *counted = temp::LabelFactory::NamedLabel(function + "_counted");
+  auto sink = std::prev(body->GetList().cend());
+  body->Insert(sink, new assem::OperInstr(
+                         assem::Opcode::JMP, {assem::Operand::Label(counted)},
+                         nullptr, nullptr,
+                         new assem::Targets(
+                             new std::vector<temp::Label *>{counted})));
+  for (assem::Instr *stub : stubs)
+    body->Insert(sink, stub);
+  body->Insert(sink, new assem::LabelInstr(counted));
+}
+
+void Profile::OutputCounters(FILE *out) {
+  const std::vector<std::string> &names = profile.names_;
+  fprintf(out, ".bss\n");
+  fprintf(out, ".p2align 3\n");
+  fprintf(out, ".globl tiger_counters\n");
+  fprintf(out, "tiger_counters:\n");
+  fprintf(out, ".zero %zu\n", names.size() * COUNTER_SIZE);
+
+  fprintf(out, ".section .rodata\n");
+  fprintf(out, ".p2align 3\n");
+  fprintf(out, ".globl tiger_counter_count\n");
+  fprintf(out, "tiger_counter_count:\n");
+  fprintf(out, ".quad %zu\n", names.size());
+  fprintf(out, ".globl tiger_counter_names\n");
+  fprintf(out, "tiger_counter_names:\n");
+  for (const std::string &name : names)
+    fprintf(out, ".string \"%s\"\n", name.data());
+}
+
+assem::Instr *Profile::NewCounter(const std::string &name) {
+  int offset = static_cast<int>(profile.names_.size()) * COUNTER_SIZE;
+  profile.names_.push_back(name);
+  return new assem::OperInstr(
+      assem::Opcode::INCQ,
+      {assem::Operand::Mem(assem::Operand::NO_REG, offset,
+                           temp::LabelFactory::NamedLabel("tiger_counters"))},
+      nullptr, nullptr, nullptr);
+}
+
+} // namespace cg
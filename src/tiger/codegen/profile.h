@@ -0,0 +1,66 @@
+#ifndef TIGER_CODEGEN_PROFILE_H_
+#define TIGER_CODEGEN_PROFILE_H_
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tiger/canon/layout.h"
+#include "tiger/codegen/assem.h"
+
+namespace cg {
+
+/**
+ * The counters of an instrumented program and the profile they are read back
+ * from. The runtime writes the counters at exit as "TGPROF1\0", their number,
+ * one 64-bit count each, the length of their names and the names, each ended
+ * by a zero: "F function" counts the entries of a function, "E from to" the
+ * edge between two blocks named by their labels
+ */
+class Profile {
+public:
+  // Count the entries of every function and the edges between its blocks
+  static void Instrument() { profile.instrumenting_ = true; }
+  [[nodiscard]] static bool Instrumenting() { return profile.instrumenting_; }
+
+  /**
+   * Read the profile an instrumented program wrote
+   * @return whether the file is a complete profile
+   */
+  static bool Use(const std::string &path);
+
+  // The edges measured, nullptr without a profile
+  static const canon::EdgeCounts *Edges();
+  // How often a function was entered, -1 when the profile has no count
+  static long long Entries(const std::string &function);
+
+  /**
+   * Increment a counter at the entry of a procedure and on every edge of its
+   * flow graph into a block. A taken conditional jump goes through a stub
+   * placed after the body, which is jumped over on the way to the return
+   * sink
+   * @param function label of the procedure
+   * @param body instructions of the procedure after allocation
+   */
+  static void InstrumentProc(const std::string &function,
+                             assem::InstrList *body);
+
+  // The zeroed counters and their names, once all procedures are instrumented
+  static void OutputCounters(FILE *out);
+
+private:
+  bool instrumenting_ = false;
+  bool profiled_ = false;
+  std::map<std::string, long long> entries_;
+  canon::EdgeCounts edges_;
+  std::vector<std::string> names_;
+  static Profile profile;
+
+  // An instruction incrementing a new counter
+  static assem::Instr *NewCounter(const std::string &name);
+};
+
+} // namespace cg
+
+#endif
@@ -0,0 +1,98 @@
+#include "tiger/codegen/stackmap.h"
+
+#include <sstream>
+
+#include "tiger/frame/x64frame.h"
+
+namespace {
+
+bool IsCall(assem::Instr *instr) {
+  return typeid(*instr) == typeid(assem::OperInstr) &&
+         static_cast<assem::OperInstr *>(instr)->opcode_ ==
+             assem::Opcode::CALLQ;
+}
+
+} // namespace
+
+namespace cg {
+
+StackMaps StackMaps::maps;
+
+void StackMaps::KeepBases(assem::InstrList *body) {
+  for (auto it = body->GetList().cbegin(); it != body->GetList().cend(); ++it) {
+    temp::TempList *bases = new temp::TempList();
+    for (temp::Temp *reg : (*it)->Use()->GetList())
+      if (reg->Base() && !bases->ContainsElement(reg->Base()))
+        bases->Append(reg->Base());
+    if (bases->GetList().empty())
+      continue;
+
+    if (typeid(**it) == typeid(assem::MoveInstr)) {
+      // A move has a single source, the copy is no longer coalesced
+      auto *move = static_cast<assem::MoveInstr *>(*it);
+      auto *src = new temp::TempList(move->src_->NthTemp(0));
+      src->AppendTempList(bases);
+      it = body->Replace(
+          it, new assem::OperInstr(
+                  assem::Opcode::MOVQ,
+                  {assem::Operand::Src(0), assem::Operand::Dst(0)},
+                  move->dst_, src, nullptr));
+    } else if (typeid(**it) == typeid(assem::OperInstr)) {
+      auto *oper = static_cast<assem::OperInstr *>(*it);
+      if (!oper->src_)
+        oper->src_ = new temp::TempList();
+      oper->src_->AppendTempList(bases);
+    }
+  }
+}
+
+void StackMaps::RecordProc(frame::Frame *frame, assem::InstrList *body,
+                           const CallRoots &roots, temp::Map *color) {
+  std::string frameSize = frame->frameSizeLabel_->Name();
+  auto place = [&frameSize](int place) {
+    return place < 0 ? std::to_string(place)
+                     : frameSize + "-" + std::to_string(place);
+  };
+
+  std::stringstream saves;
+  for (int slot : frame::FindCalleeSaveSlots(frame, body, color))
+    saves << ".quad " << place(slot) << "\n";
+
+  for (auto it = body->GetList().cbegin(); it != body->GetList().cend(); ++it) {
+    if (!IsCall(*it))
+      continue;
+    auto callRoots = roots.find(*it);
+    temp::Label *ret = temp::LabelFactory::NewLabel();
+    body->Insert(std::next(it), new assem::LabelInstr(ret));
+    ++it;
+
+    // The slots of the escaping pointers are read at every call
+    std::vector<Root> callPlaces;
+    if (callRoots != roots.end())
+      callPlaces = callRoots->second;
+    for (size_t i = 0; i < frame->pointerSlots_.size(); ++i)
+      if (frame->pointerSlots_[i]) {
+        int offset = static_cast<int>(i + 1) * frame->GetWordSize();
+        callPlaces.emplace_back(offset, offset);
+      }
+
+    std::stringstream entry;
+    entry << ".quad " << ret->Name() << "\n";
+    entry << ".quad " << frameSize << "\n";
+    entry << saves.str();
+    entry << ".quad " << callPlaces.size() << "\n";
+    for (const Root &root : callPlaces)
+      entry << ".quad " << place(root.first) << ", " << place(root.second)
+            << "\n";
+    maps.entries_.push_back(entry.str());
+  }
+}
+
+void StackMaps::OutputMaps(FILE *out) {
+  fprintf(out, ".section tiger_gc_maps, \"aw\"\n");
+  fprintf(out, ".p2align 3\n");
+  for (const std::string &entry : maps.entries_)
+    fprintf(out, "%s", entry.data());
+}
+
+} // namespace cg
@@ -0,0 +1,71 @@
+#ifndef TIGER_CODEGEN_STACKMAP_H_
+#define TIGER_CODEGEN_STACKMAP_H_
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tiger/codegen/assem.h"
+#include "tiger/frame/frame.h"
+
+namespace cg {
+
+/**
+ * A pointer kept across a call and the start of the object it points into,
+ * both given by the place they are kept in: the offset below the frame
+ * address of a frame slot, or -1 minus the index of a callee-saved register.
+ * A pointer to the start of an object is its own start
+ */
+using Root = std::pair<int, int>;
+// The roots the register allocator found at every call of a procedure
+using CallRoots = std::map<assem::Instr *, std::vector<Root>>;
+
+/**
+ * The stack maps the collector of the runtime finds the pointers into its
+ * heap by, in the section tiger_gc_maps. Every call a procedure makes has an
+ * entry of 64-bit words: the address the call returns to, the frame size of
+ * the procedure, for each callee-saved register the offset from the stack
+ * pointer of the slot the procedure saves it to or -1, the number of roots
+ * and the two places of each root. A place is an offset from the stack
+ * pointer, or -1 minus the index of the callee-saved register holding the
+ * value
+ */
+class StackMaps {
+public:
+  // Emit the stack maps and the write barrier of the collector
+  static void Emit() { maps.emitting_ = true; }
+  [[nodiscard]] static bool Emitting() { return maps.emitting_; }
+
+  /**
+   * Make every instruction reading a pointer into the middle of an object
+   * read the start of the object too, so the start is kept as long as the
+   * pointer is
+   * @param body instructions of the procedure before allocation
+   */
+  static void KeepBases(assem::InstrList *body);
+
+  /**
+   * Label the address every call of a procedure returns to and record its
+   * entry
+   * @param frame frame of the procedure, its size known
+   * @param body instructions of the procedure, its tail calls already jumps
+   * @param roots roots of the calls the register allocator found
+   * @param color allocated registers
+   */
+  static void RecordProc(frame::Frame *frame, assem::InstrList *body,
+                         const CallRoots &roots, temp::Map *color);
+
+  // The entries of all procedures, once all procedures are recorded
+  static void OutputMaps(FILE *out);
+
+private:
+  bool emitting_ = false;
+  std::vector<std::string> entries_;
+  static StackMaps maps;
+};
+
+} // namespace cg
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <list>
 #include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -76,7 +77,9 @@ class Frame;
 class Access {
 public:
   /* TODO: Put your lab5 code here */
-  virtual std::string ConsumeAccess(Frame *frame) = 0;
+  // The operand reading the access, the registers it needs are the sources
+  // of the instruction from the base-th one on
+  virtual assem::Operand ConsumeAccess(Frame *frame, int base) = 0;
   virtual ~Access() = default;
 };
 
@@ -84,7 +87,7 @@ class Frame {
 protected:
   Frame() = default;
   explicit Frame(temp::Label *frameLabel)
-      : frameLabel_(frameLabel), localVariableCount_(0),
+      : frameLabel_(frameLabel), localVariableCount_(0), liveLocalCount_(0),
         maxOutgoingArguments_(0) {}
 
   virtual ~Frame() = default;
@@ -96,8 +99,9 @@ public:
   virtual int GetWordSize() const = 0;
   // Get the label associated with the frame
   virtual std::string GetFrameLabel() const = 0;
-  // Allocate a new local variable in the frame
-  virtual Access *AllocateLocal(bool escapes) = 0;
+  // Allocate a new local variable in the frame, one holding a pointer to an
+  // object the collector moves only ever shares its slot with such variables
+  virtual Access *AllocateLocal(bool escapes, bool pointer = false) = 0;
   // Get the address expression of the frame
   virtual tree::Exp *GetFrameAddress() const = 0;
 
@@ -108,16 +112,21 @@ public:
   std::vector<Access *> formalAccesses_;
   std::vector<Access *> localAccesses_;
   int localVariableCount_;
+  // Number of slots held by escaping variables whose scope is still open,
+  // slots above it are handed out again by the next allocation
+  int liveLocalCount_;
+  // Whether each slot handed out to an escaping variable holds a pointer to
+  // an object the collector moves, the first slot right below the frame
+  // address
+  std::vector<bool> pointerSlots_;
   // Label for the frame size, altered when frame size is known
   temp::Label *frameSizeLabel_;
   // Statement for view shift operations
   tree::Stm *viewShiftStatement;
-  // Statement for saving callee-saved registers
-  tree::Stm *saveCalleeSavesStatement;
-  // Statement for restoring callee-saved registers
-  tree::Stm *restoreCalleeSavesStatement;
   // Maximum number of outgoing arguments in any call within the frame
   int maxOutgoingArguments_;
+  // Functions called with the address of this frame as their static link
+  std::set<temp::Label *> frameAddressCallees_;
 };
 
 /**
@@ -152,6 +161,18 @@ public:
   void OutputAssem(FILE *out, OutputPhase phase, bool need_ra) const override;
 };
 
+// The targets of an indirect jump, each as an offset from the table
+class JumpTableFrag : public Frag {
+public:
+  temp::Label *label_;
+  std::vector<temp::Label *> targets_;
+
+  JumpTableFrag(temp::Label *label, std::vector<temp::Label *> targets)
+      : label_(label), targets_(std::move(targets)) {}
+
+  void OutputAssem(FILE *out, OutputPhase phase, bool need_ra) const override;
+};
+
 class ProcFrag : public Frag {
 public:
   tree::Stm *body_;
@@ -166,6 +187,7 @@ class Frags {
 public:
   Frags() = default;
   void PushBack(Frag *frag) { frags_.emplace_back(frag); }
+  void Remove(Frag *frag) { frags_.remove(frag); }
   const std::list<Frag *> &GetList() { return frags_; }
 
 private:
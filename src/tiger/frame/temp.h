@@ -26,8 +26,20 @@ class Temp {
 public:
   [[nodiscard]] int Int() const;
 
+  // Whether the temporary may hold a pointer to an object the collector moves
+  [[nodiscard]] bool IsPointer() const { return pointer_; }
+  // The temporary holding the start of the object a pointer into its middle
+  // points into, nullptr for a pointer to the start
+  [[nodiscard]] Temp *Base() const { return base_; }
+  void MarkPointer(Temp *base = nullptr) {
+    pointer_ = true;
+    base_ = base;
+  }
+
 private:
   int num_;
+  bool pointer_ = false;
+  Temp *base_ = nullptr;
   explicit Temp(int num) : num_(num) {}
 };
 
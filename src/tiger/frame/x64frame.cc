@@ -1,6 +1,9 @@
 #include "tiger/frame/x64frame.h"
 #include "tiger/codegen/assem.h"
+#include "tiger/codegen/stackmap.h"
+#include <algorithm>
 #include <iostream>
+#include <set>
 #include <sstream>
 extern frame::RegManager *reg_manager;
 
@@ -63,7 +66,9 @@ temp::TempList *X64RegManager::CalleeSaves() {
 }
 
 temp::TempList *X64RegManager::ReturnSink() {
-  temp::TempList *temps = CalleeSaves();
+  // Callee-saved registers are preserved by the prologue and epilogue, so
+  // the body does not need to keep them alive
+  temp::TempList *temps = new temp::TempList();
   temps->Append(regs_.at(RAX));
   temps->Append(regs_.at(RSP));
   return temps;
@@ -82,14 +87,13 @@ temp::Temp *X64RegManager::GetArithmeticRegister() { return regs_.at(RDX); }
 class InFrameAccess : public Access {
 public:
   int offset;
+  bool pointer;
 
-  explicit InFrameAccess(int offset) : offset(offset) {}
+  InFrameAccess(int offset, bool pointer) : offset(offset), pointer(pointer) {}
   /* TODO: Put your lab5 code here */
-  std::string ConsumeAccess(Frame *frame) override {
-    std::stringstream ss;
-    ss << "(" << frame->frameSizeLabel_->Name() << "-" << offset << ")("
-       << *reg_manager->temp_map_->Look(reg_manager->StackPointer()) << ")";
-    return ss.str();
+  // Addressed from the stack pointer
+  assem::Operand ConsumeAccess(Frame *frame, int base) override {
+    return assem::Operand::Mem(base, -offset, frame->frameSizeLabel_);
   }
 };
 
@@ -99,8 +103,9 @@ public:
 
   explicit InRegAccess(temp::Temp *reg) : reg(reg) {}
   /* TODO: Put your lab5 code here */
-  std::string ConsumeAccess(Frame *frame) override {
-    return *temp::Map::Name()->Look(reg);
+  // The register itself
+  assem::Operand ConsumeAccess(Frame *frame, int base) override {
+    return assem::Operand::Src(base);
   }
 };
 
@@ -109,28 +114,40 @@ class X64Frame : public Frame {
 public:
   X64Frame(temp::Label *name) : Frame(name) { wordSize_ = WORD_SIZE_X64_; }
   int GetWordSize() const override;
-  Access *AllocateLocal(bool escape) override;
+  Access *AllocateLocal(bool escape, bool pointer) override;
   tree::Exp *GetFrameAddress() const override;
   std::string GetFrameLabel() const override;
   tree::Exp *GetStackOffset(int frame_offset) const override;
 };
 /* TODO: Put your lab5 code here */
-Access *X64Frame::AllocateLocal(bool escape) {
+Access *X64Frame::AllocateLocal(bool escape, bool pointer) {
   Access *access;
   if (escape) {
-    localVariableCount_++;
-    access = new InFrameAccess(localVariableCount_ * wordSize_);
+    // A slot keeps the kind it is first handed out with, the collector reads
+    // a pointer slot at every call
+    int slot = liveLocalCount_;
+    while (slot < static_cast<int>(pointerSlots_.size()) &&
+           pointerSlots_[slot] != pointer)
+      slot++;
+    if (slot == static_cast<int>(pointerSlots_.size()))
+      pointerSlots_.push_back(pointer);
+    liveLocalCount_ = slot + 1;
+    localVariableCount_ = std::max(localVariableCount_, liveLocalCount_);
+    access = new InFrameAccess(liveLocalCount_ * wordSize_, pointer);
   } else {
-    access = new InRegAccess(temp::TempFactory::NewTemp());
+    temp::Temp *reg = temp::TempFactory::NewTemp();
+    if (pointer)
+      reg->MarkPointer();
+    access = new InRegAccess(reg);
   }
   localAccesses_.push_back(access);
   return access;
 }
 
 tree::Exp *X64Frame::GetFrameAddress() const {
-  return new tree::BinopExp(tree::PLUS_OP,
-                            new tree::TempExp(reg_manager->StackPointer()),
-                            new tree::NameExp(frameSizeLabel_));
+  return tree::Binop(tree::PLUS_OP,
+                     new tree::TempExp(reg_manager->StackPointer()),
+                     new tree::NameExp(frameSizeLabel_));
 }
 
 int X64Frame::GetWordSize() const { return wordSize_; }
@@ -139,11 +156,12 @@ std::string X64Frame::GetFrameLabel() const { return frameLabel_->Name(); }
 
 tree::Exp *X64Frame::GetStackOffset(int frame_offset) const {
   // offset is calculated from frame pointer (rbp) and frame size label
-  return new tree::BinopExp(tree::MINUS_OP, new tree::NameExp(frameSizeLabel_),
-                            new tree::ConstExp(frame_offset));
+  return tree::Binop(tree::MINUS_OP, new tree::NameExp(frameSizeLabel_),
+                     new tree::ConstExp(frame_offset));
 }
 
-Frame *NewFrame(temp::Label *name, std::vector<bool> formals) {
+Frame *NewFrame(temp::Label *name, std::vector<bool> formals,
+                std::vector<bool> pointers) {
   Frame *_frame = new X64Frame(name);
   int frameOffset = _frame->GetWordSize();
   _frame->frameSizeLabel_ =
@@ -167,17 +185,24 @@ Frame *NewFrame(temp::Label *name, std::vector<bool> formals) {
   }
   // escape and non-escape formals
   for (int i = 0; i < formals.size(); ++i) {
+    bool pointer = static_cast<size_t>(i) < pointers.size() && pointers.at(i);
     if (formals.at(i)) { // escape
-      _frame->formalAccesses_.push_back(new InFrameAccess(frameOffset));
-      destinationExppression = new tree::MemExp(new tree::BinopExp(
-          tree::MINUS_OP, framePointerExpression,
-          new tree::ConstExp((i + 1) * _frame->GetWordSize())));
+      _frame->formalAccesses_.push_back(
+          new InFrameAccess(frameOffset, pointer));
+      _frame->pointerSlots_.push_back(pointer);
+      destinationExppression = new tree::MemExp(
+          tree::Binop(tree::MINUS_OP, framePointerExpression,
+                      new tree::ConstExp(frameOffset)),
+          pointer);
       // claculate offset from frame pointer (rbp)
       frameOffset += _frame->GetWordSize();
       _frame->localVariableCount_++;
+      _frame->liveLocalCount_++;
     } else {
       // non-escape
       temp::Temp *reg = temp::TempFactory::NewTemp();
+      if (pointer)
+        reg->MarkPointer();
       _frame->formalAccesses_.push_back(new InRegAccess(reg));
       destinationExppression = new tree::TempExp(reg);
     }
@@ -187,45 +212,18 @@ Frame *NewFrame(temp::Label *name, std::vector<bool> formals) {
           new tree::TempExp(reg_manager->ArgRegs()->NthTemp(i)));
     } else {
       // *fp is return address
-      singleViewShift =
-          new tree::MoveStm(destinationExppression,
-                            new tree::MemExp(new tree::BinopExp(
-                                tree::PLUS_OP, framePointerCopy,
-                                new tree::ConstExp((i - ArgRegCount + 1) *
-                                                   _frame->GetWordSize()))));
+      singleViewShift = new tree::MoveStm(
+          destinationExppression,
+          new tree::MemExp(
+              tree::Binop(tree::PLUS_OP, framePointerCopy,
+                          new tree::ConstExp((i - ArgRegCount + 1) *
+                                             _frame->GetWordSize())),
+              pointer));
     }
     _frame->viewShiftStatement =
         new tree::SeqStm(_frame->viewShiftStatement, singleViewShift);
   }
 
-  temp::TempList *calleeSaves = reg_manager->CalleeSaves();
-
-  temp::Temp *storedReg;
-  tree::Stm *saveStm, *restoreStm;
-
-  auto calleeSavesEnd = calleeSaves->GetList().end();
-  storedReg = temp::TempFactory::NewTemp();
-  // save and restore return address
-  _frame->restoreCalleeSavesStatement =
-      new tree::MoveStm(new tree::TempExp(calleeSaves->GetList().front()),
-                        new tree::TempExp(storedReg));
-  _frame->saveCalleeSavesStatement =
-      new tree::MoveStm(new tree::TempExp(storedReg),
-                        new tree::TempExp(calleeSaves->GetList().front()));
-
-  for (auto regIt = std::next(calleeSaves->GetList().begin());
-       regIt != calleeSavesEnd; ++regIt) {
-    storedReg = temp::TempFactory::NewTemp();
-    saveStm = new tree::MoveStm(new tree::TempExp(storedReg),
-                                new tree::TempExp(*regIt));
-    restoreStm = new tree::MoveStm(new tree::TempExp(*regIt),
-                                   new tree::TempExp(storedReg));
-    _frame->restoreCalleeSavesStatement =
-        new tree::SeqStm(restoreStm, _frame->restoreCalleeSavesStatement);
-    _frame->saveCalleeSavesStatement =
-        new tree::SeqStm(saveStm, _frame->saveCalleeSavesStatement);
-  }
-
   return _frame;
 }
 // Function to get the current access expression from an Access object in the
@@ -235,8 +233,9 @@ tree::Exp *GetCurrentAccessExpression(Access *acc, Frame *frame) {
     // Cast access to InFrameAccess and calculate memory expression
     InFrameAccess *frameAcc = static_cast<InFrameAccess *>(acc);
     return new tree::MemExp(
-        new tree::BinopExp(tree::MINUS_OP, frame->GetFrameAddress(),
-                           new tree::ConstExp(frameAcc->offset)));
+        tree::Binop(tree::MINUS_OP, frame->GetFrameAddress(),
+                    new tree::ConstExp(frameAcc->offset)),
+        frameAcc->pointer);
   } else {
     // Cast access to InRegAccess and return the register expression
     InRegAccess *regAcc = static_cast<InRegAccess *>(acc);
@@ -255,72 +254,239 @@ tree::Exp *GetAccessExpression(Access *acc, tree::Exp *fp) {
     // Cast access to InFrameAccess and calculate memory expression with frame
     // pointer
     InFrameAccess *frameAcc = static_cast<InFrameAccess *>(acc);
-    return new tree::MemExp(new tree::BinopExp(
-        tree::MINUS_OP, fp, new tree::ConstExp(frameAcc->offset)));
+    return new tree::MemExp(
+        tree::Binop(tree::MINUS_OP, fp, new tree::ConstExp(frameAcc->offset)),
+        frameAcc->pointer);
   }
 }
 
 // Function to create an external call expression
 tree::Exp *CreateExternalFunctionCall(std::string functionName,
-                                      tree::ExpList *arguments) {
+                                      tree::ExpList *arguments, bool pointer) {
   // Create a CallExp with the function name and arguments
   return new tree::CallExp(
       new tree::NameExp(temp::LabelFactory::NamedLabel(functionName)),
-      arguments);
+      arguments, pointer);
 }
 
 // Function to create a statement for procedure entry and exit
 tree::Stm *GenerateProcedureEntryExitSequence(Frame *currentFrame,
                                               tree::Stm *procedureBody) {
-  // Sequence statements for callee saves, view shift, and restore
-  procedureBody =
-      new tree::SeqStm(currentFrame->saveCalleeSavesStatement, procedureBody);
-  procedureBody =
-      new tree::SeqStm(currentFrame->viewShiftStatement, procedureBody);
-  procedureBody = new tree::SeqStm(procedureBody,
-                                   currentFrame->restoreCalleeSavesStatement);
-  return procedureBody;
+  // Callee-saved registers are saved by the prologue once the clobbered ones
+  // are known, only the view shift goes into the body
+  return new tree::SeqStm(currentFrame->viewShiftStatement, procedureBody);
 }
 
 // Function to append a return sink instruction to a list of assembly
 // instructions
 assem::InstrList *PrepareProcedureInstructions(assem::InstrList *body) {
   // Create a return sink operation instruction
-  assem::Instr *returnSink =
-      new assem::OperInstr("", nullptr, reg_manager->ReturnSink(), nullptr);
+  assem::Instr *returnSink = new assem::OperInstr(
+      assem::Opcode::NONE, {}, nullptr, reg_manager->ReturnSink(), nullptr);
   body->Append(returnSink);
   return body;
 }
 
+// Function to collect the callee-saved registers written by a procedure body
+std::vector<temp::Temp *>
+FindClobberedCalleeSaves(assem::InstrList *procedureBodyInstructions,
+                         temp::Map *color) {
+  std::vector<temp::Temp *> clobbered;
+  for (temp::Temp *reg : reg_manager->CalleeSaves()->GetList()) {
+    std::string *regName = reg_manager->temp_map_->Look(reg);
+    for (assem::Instr *instr : procedureBodyInstructions->GetList()) {
+      temp::TempList *defs = instr->Def();
+      if (std::any_of(defs->GetList().cbegin(), defs->GetList().cend(),
+                      [&](temp::Temp *def) {
+                        std::string *defName = color->Look(def);
+                        return defName && *defName == *regName;
+                      })) {
+        clobbered.push_back(reg);
+        break;
+      }
+    }
+  }
+  return clobbered;
+}
+
+// Function to compute the size of a frame saving some callee-saved registers
+int ComputeFrameSize(Frame *procedureFrame, size_t savedRegCount) {
+  return (procedureFrame->localVariableCount_ +
+          static_cast<int>(savedRegCount) +
+          procedureFrame->maxOutgoingArguments_) *
+         procedureFrame->GetWordSize();
+}
+
+// Function to compute the offset below the frame address of the slot the
+// i-th saved callee-saved register goes to
+int ComputeSaveOffset(Frame *procedureFrame, size_t i) {
+  return (procedureFrame->localVariableCount_ + static_cast<int>(i) + 1) *
+         procedureFrame->GetWordSize();
+}
+
+std::vector<int> FindCalleeSaveSlots(Frame *procedureFrame,
+                                     assem::InstrList *procedureBodyInstructions,
+                                     temp::Map *color) {
+  std::vector<temp::Temp *> savedRegs =
+      FindClobberedCalleeSaves(procedureBodyInstructions, color);
+  std::vector<int> slots;
+  for (temp::Temp *reg : reg_manager->CalleeSaves()->GetList()) {
+    auto saved = std::find(savedRegs.cbegin(), savedRegs.cend(), reg);
+    slots.push_back(saved == savedRegs.cend()
+                        ? -1
+                        : ComputeSaveOffset(procedureFrame,
+                                            saved - savedRegs.cbegin()));
+  }
+  return slots;
+}
+
 // Function to create a procedure object with prologue and epilogue
 assem::Proc *
 BuildCompleteProcedure(Frame *procedureFrame,
-                       assem::InstrList *procedureBodyInstructions) {
+                       assem::InstrList *procedureBodyInstructions,
+                       temp::Map *color) {
   std::stringstream prologue, epilogue;
+  std::string stackPointer =
+      *reg_manager->temp_map_->Look(reg_manager->StackPointer());
 
-  // Calculate frame size
-  int frameSize = (procedureFrame->localVariableCount_ +
-                   procedureFrame->maxOutgoingArguments_) *
-                  procedureFrame->GetWordSize();
+  // Only the callee-saved registers the body writes are saved, they go right
+  // above the local variables
+  std::vector<temp::Temp *> savedRegs =
+      FindClobberedCalleeSaves(procedureBodyInstructions, color);
+
+  // Calculate frame size, a leaf procedure without locals needs no frame
+  int frameSize = ComputeFrameSize(procedureFrame, savedRegs.size());
   prologue << ".set " << procedureFrame->frameSizeLabel_->Name() << ", "
            << frameSize << "\n";
 
   // Add function label and adjust stack pointer
   prologue << procedureFrame->GetFrameLabel() << ":\n";
   if (frameSize != 0)
-    prologue << "subq $" << frameSize << ", "
-             << *reg_manager->temp_map_->Look(reg_manager->StackPointer())
-             << "\n";
+    prologue << "subq $" << frameSize << ", " << stackPointer << "\n";
+
+  // The collector reads the slots of the escaping pointers at every call,
+  // before their variables are first set as well
+  for (size_t i = 0; i < procedureFrame->pointerSlots_.size(); ++i)
+    if (procedureFrame->pointerSlots_[i] && cg::StackMaps::Emitting())
+      prologue << "movq $0, (" << procedureFrame->frameSizeLabel_->Name() << "-"
+               << (i + 1) * procedureFrame->GetWordSize() << ")("
+               << stackPointer << ")\n";
+
+  // Save and restore the clobbered callee-saved registers
+  for (size_t i = 0; i < savedRegs.size(); ++i) {
+    temp::Temp *reg = savedRegs[i];
+    std::stringstream slot;
+    slot << "(" << procedureFrame->frameSizeLabel_->Name() << "-"
+         << ComputeSaveOffset(procedureFrame, i) << ")(" << stackPointer
+         << ")";
+    prologue << "movq " << *reg_manager->temp_map_->Look(reg) << ", "
+             << slot.str() << "\n";
+    epilogue << "movq " << slot.str() << ", "
+             << *reg_manager->temp_map_->Look(reg) << "\n";
+  }
 
   // Reset stack pointer and return instruction
   if (frameSize != 0)
-    epilogue << "addq $" << frameSize << ", "
-             << *reg_manager->temp_map_->Look(reg_manager->StackPointer())
-             << "\n";
+    epilogue << "addq $" << frameSize << ", " << stackPointer << "\n";
   epilogue << "retq\n";
 
   return new assem::Proc(prologue.str(), procedureBodyInstructions,
                          epilogue.str());
 }
 
+// Function to tell whether a call passes the address of the current frame,
+// as the static link of a procedure nested in it
+bool PassesFrameAddress(Frame *frame, assem::OperInstr *call) {
+  return frame->frameAddressCallees_.count(call->operands_[0].label);
+}
+
+// Function to tell whether the procedure returns right after an instruction,
+// with nothing but labels, jumps and moves of a register to itself between
+bool ReturnsAfter(const std::list<assem::Instr *> &body,
+                  std::list<assem::Instr *>::const_iterator pos,
+                  temp::Map *color) {
+  std::set<assem::Instr *> visited;
+  for (auto it = std::next(pos); it != body.cend();) {
+    assem::Instr *instr = *it;
+    if (!visited.insert(instr).second)
+      return false;
+    if (typeid(*instr) == typeid(assem::LabelInstr)) {
+      ++it;
+      continue;
+    }
+    if (typeid(*instr) == typeid(assem::MoveInstr)) {
+      if (*color->Look(instr->Def()->NthTemp(0)) !=
+          *color->Look(instr->Use()->NthTemp(0)))
+        return false;
+      ++it;
+      continue;
+    }
+    auto *oper = static_cast<assem::OperInstr *>(instr);
+    // The return sink
+    if (oper->opcode_ == assem::Opcode::NONE)
+      return true;
+    if (oper->opcode_ != assem::Opcode::JMP || !oper->jumps_ ||
+        oper->jumps_->labels_->size() != 1)
+      return false;
+    temp::Label *target = oper->jumps_->labels_->front();
+    it = std::find_if(body.cbegin(), body.cend(), [target](assem::Instr *i) {
+      return typeid(*i) == typeid(assem::LabelInstr) &&
+             static_cast<assem::LabelInstr *>(i)->label_ == target;
+    });
+  }
+  return true;
+}
+
+// Function to turn the calls a procedure returns the value of into jumps,
+// releasing the frame first so the callee returns straight to the caller
+void JumpToTailCalls(Frame *frame, assem::Proc *procedure, temp::Map *color) {
+  // The epilogue without its return
+  std::vector<temp::Temp *> savedRegs =
+      FindClobberedCalleeSaves(procedure->body_, color);
+  int frameSize = ComputeFrameSize(frame, savedRegs.size());
+  temp::Temp *sp = reg_manager->StackPointer();
+  auto release = [&](std::list<assem::Instr *>::const_iterator pos) {
+    for (size_t i = 0; i < savedRegs.size(); ++i)
+      procedure->body_->Insert(
+          pos, new assem::OperInstr(
+                   assem::Opcode::MOVQ,
+                   {assem::Operand::Mem(0, -ComputeSaveOffset(frame, i),
+                                        frame->frameSizeLabel_),
+                    assem::Operand::Dst(0)},
+                   new temp::TempList(savedRegs[i]), new temp::TempList(sp),
+                   nullptr));
+    if (frameSize != 0)
+      procedure->body_->Insert(
+          pos, new assem::OperInstr(
+                   assem::Opcode::ADDQ,
+                   {assem::Operand::Imm(frameSize), assem::Operand::Dst(0)},
+                   new temp::TempList(sp), new temp::TempList(sp), nullptr));
+  };
+
+  size_t argRegCount = reg_manager->ArgRegs()->GetList().size();
+  const std::list<assem::Instr *> &body = procedure->body_->GetList();
+  for (auto it = body.cbegin(); it != body.cend(); ++it) {
+    if (typeid(**it) != typeid(assem::OperInstr) ||
+        static_cast<assem::OperInstr *>(*it)->opcode_ != assem::Opcode::CALLQ)
+      continue;
+    auto *call = static_cast<assem::OperInstr *>(*it);
+    // With all the argument registers taken, more arguments may be in the
+    // frame that is released
+    if (call->Use()->GetList().size() >= argRegCount ||
+        PassesFrameAddress(frame, call) || !ReturnsAfter(body, it, color))
+      continue;
+    release(it);
+    it = procedure->body_->Replace(
+        it, new assem::OperInstr(assem::Opcode::JMP, {call->operands_[0]},
+                                 nullptr, call->src_, nullptr));
+    // Up to the next label nothing is reached any more, the return sink
+    // stays last
+    for (auto next = std::next(it);
+         next != body.cend() && std::next(next) != body.cend() &&
+         typeid(**next) != typeid(assem::LabelInstr);
+         next = std::next(it))
+      procedure->body_->Erase(next);
+  }
+}
+
 } // namespace frame
@@ -50,12 +50,16 @@ private:
   static const int WORD_SIZE = WORD_SIZE_X64_;
 };
 
-Frame *NewFrame(temp::Label *name, std::vector<bool> formals);
+// The formals are given by whether they escape and whether they hold a
+// pointer to an object the collector moves
+Frame *NewFrame(temp::Label *name, std::vector<bool> formals,
+                std::vector<bool> pointers = {});
 tree::Exp *GetCurrentAccessExpression(Access *acc, Frame *frame);
 tree::Exp *GetAccessExpression(Access *acc, tree::Exp *fp);
 // Function to create an expression for an external function call
 tree::Exp *CreateExternalFunctionCall(std::string functionName,
-                                      tree::ExpList *arguments);
+                                      tree::ExpList *arguments,
+                                      bool pointer = false);
 
 // Function to generate the entry and exit sequence for a procedure's body
 // statement
@@ -67,10 +71,22 @@ tree::Stm *GenerateProcedureEntryExitSequence(Frame *currentFrame,
 assem::InstrList *
 PrepareProcedureInstructions(assem::InstrList *procedureInstructions);
 
-// Function to construct the complete procedure with prologue and epilogue
+// Function to construct the complete procedure with prologue and epilogue,
+// saving the callee-saved registers the body clobbers under `color`
 assem::Proc *
 BuildCompleteProcedure(Frame *procedureFrame,
-                       assem::InstrList *procedureBodyInstructions);
+                       assem::InstrList *procedureBodyInstructions,
+                       temp::Map *color);
+
+// Function to find the offset below the frame address of the slot each
+// callee-saved register is saved to, -1 for the ones the body keeps
+std::vector<int> FindCalleeSaveSlots(Frame *procedureFrame,
+                                     assem::InstrList *procedureBodyInstructions,
+                                     temp::Map *color);
+
+// Function to reuse the frame for the calls whose value the procedure
+// returns, only once the registers are allocated
+void JumpToTailCalls(Frame *frame, assem::Proc *procedure, temp::Map *color);
 
 } // namespace frame
 #endif // TIGER_COMPILER_X64FRAME_H
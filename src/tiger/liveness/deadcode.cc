@@ -0,0 +1,109 @@
+#include "tiger/liveness/deadcode.h"
+
+#include <set>
+#include <vector>
+
+#include "tiger/liveness/liveness.h"
+
+namespace {
+
+// Whether dropping the instruction loses nothing but the temporaries it
+// defines
+bool IsPure(assem::Instr *instr) {
+  if (typeid(*instr) == typeid(assem::MoveInstr))
+    return true;
+  if (typeid(*instr) != typeid(assem::OperInstr))
+    return false;
+  auto *oper = static_cast<assem::OperInstr *>(instr);
+  // Stores and compares define no temporary and are never dead
+  if (oper->jumps_ || oper->Def()->GetList().empty())
+    return false;
+
+  switch (oper->opcode_) {
+  case assem::Opcode::LEAQ:
+    return true;
+  case assem::Opcode::MOVQ:
+  case assem::Opcode::ADDQ:
+  case assem::Opcode::SUBQ:
+  case assem::Opcode::IMULQ:
+    // Only the frame, addressed from its size, is known to be mapped; a
+    // load through a pointer may be the nil dereference the program stops
+    // at
+    return oper->operands_[0].kind != assem::OperandKind::MEM ||
+           (oper->operands_[0].label &&
+            oper->operands_[0].reg != assem::Operand::NO_REG);
+  case assem::Opcode::CQTO:
+  case assem::Opcode::XORL:
+  case assem::Opcode::INCQ:
+  case assem::Opcode::DECQ:
+  case assem::Opcode::SHRQ:
+    return true;
+  default:
+    // Division traps on zero and calls do anything
+    return false;
+  }
+}
+
+} // namespace
+
+namespace live {
+
+void DeadCode::Eliminate() {
+  bool changed = true;
+  while (changed) {
+    fg::FlowGraphFactory flowGraphFactory(instr_list_);
+    flowGraphFactory.AssemFlowGraph();
+    fg::FGraphPtr flowgraph = flowGraphFactory.GetFlowGraph();
+    if (flowgraph->Nodes()->GetList().empty())
+      return;
+    changed = RemoveUnreachable(flowgraph);
+    if (!changed)
+      changed = RemoveDead(flowgraph);
+  }
+}
+
+bool DeadCode::RemoveUnreachable(fg::FGraphPtr flowgraph) {
+  std::set<fg::FNodePtr> reachable;
+  std::vector<fg::FNodePtr> worklist = {flowgraph->Nodes()->GetList().front()};
+  while (!worklist.empty()) {
+    fg::FNodePtr node = worklist.back();
+    worklist.pop_back();
+    if (!reachable.insert(node).second)
+      continue;
+    for (fg::FNodePtr succ : node->Succ()->GetList())
+      worklist.push_back(succ);
+  }
+
+  // The return sink stays even when the procedure never returns
+  std::vector<assem::Instr *> unreachable;
+  for (fg::FNodePtr node : flowgraph->Nodes()->GetList())
+    if (!reachable.count(node) && node != flowgraph->Nodes()->GetList().back())
+      unreachable.push_back(node->NodeInfo());
+  for (assem::Instr *instr : unreachable)
+    instr_list_->Remove(instr);
+  return !unreachable.empty();
+}
+
+bool DeadCode::RemoveDead(fg::FGraphPtr flowgraph) {
+  LiveGraphFactory liveGraphFactory(flowgraph);
+  liveGraphFactory.LiveMap();
+  graph::Table<assem::Instr, temp::TempList> *liveOut =
+      liveGraphFactory.GetLiveOut();
+
+  std::vector<assem::Instr *> dead;
+  for (fg::FNodePtr node : flowgraph->Nodes()->GetList()) {
+    assem::Instr *instr = node->NodeInfo();
+    if (!IsPure(instr))
+      continue;
+    bool live = false;
+    for (temp::Temp *def : instr->Def()->GetList())
+      live = live || liveOut->Look(node)->ContainsElement(def);
+    if (!live)
+      dead.push_back(instr);
+  }
+  for (assem::Instr *instr : dead)
+    instr_list_->Remove(instr);
+  return !dead.empty();
+}
+
+} // namespace live
@@ -0,0 +1,33 @@
+#ifndef TIGER_LIVENESS_DEADCODE_H_
+#define TIGER_LIVENESS_DEADCODE_H_
+
+#include "tiger/codegen/assem.h"
+#include "tiger/liveness/flowgraph.h"
+
+namespace live {
+
+class DeadCode {
+public:
+  /**
+   * @param instr_list instructions of one procedure, rewritten in place
+   */
+  explicit DeadCode(assem::InstrList *instr_list) : instr_list_(instr_list) {}
+
+  /**
+   * Remove the instructions the entry never reaches and those without side
+   * effects whose results are not live afterwards, until none is left, as
+   * one removal may leave the operands of another dead
+   */
+  void Eliminate();
+
+private:
+  assem::InstrList *instr_list_;
+
+  // Whether anything was removed
+  bool RemoveUnreachable(fg::FGraphPtr flowgraph);
+  bool RemoveDead(fg::FGraphPtr flowgraph);
+};
+
+} // namespace live
+
+#endif
@@ -39,7 +39,7 @@ void FlowGraphFactory::AddGraphEdges() {
           flowgraph_->AddEdge(*nodeIterator, label_map_.get()->Look(label));
         }
 
-        if (operationInstruction->assem_.find("jmp") == std::string::npos) {
+        if (operationInstruction->opcode_ != assem::Opcode::JMP) {
           flowgraph_->AddEdge(*nodeIterator, *std::next(nodeIterator));
         }
       } else {
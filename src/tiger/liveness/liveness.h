@@ -65,11 +65,16 @@ public:
   // { worklistMoves = new live::MoveList(); }
 
   void Liveness(MoveList **worklist_moves);
+  // Only the live-in and live-out sets, without the interference graph
+  void LiveMap();
   LiveGraph GetLiveGraph() { return live_graph_; }
   tab::Table<temp::Temp, INode> *GetTempNodeMap() { return temp_node_map_; }
 
   void BuildIGraph(assem::InstrList *instr_list);
   std::shared_ptr<NodeInstrMap> GetNodeInstrMap() { return nodeInstractionMap; }
+  graph::Table<assem::Instr, temp::TempList> *GetLiveOut() {
+    return out_.get();
+  }
   MoveList *GetWorklistMoves() { return worklistMoves; }
 
 private:
@@ -82,7 +87,6 @@ private:
   std::shared_ptr<NodeInstrMap> nodeInstractionMap;
   MoveList *worklistMoves;
 
-  void LiveMap();
   void InterfGraph(MoveList **worklist_moves);
 };
 
@@ -1,4 +1,6 @@
 #include "tiger/absyn/absyn.h"
+#include "tiger/codegen/profile.h"
+#include "tiger/codegen/stackmap.h"
 #include "tiger/escape/escape.h"
 #include "tiger/frame/x64frame.h"
 #include "tiger/output/logger.h"
@@ -16,12 +18,28 @@ int main(int argc, char **argv) {
   reg_manager = new frame::X64RegManager();
   frags = new frame::Frags();
 
-  if (argc < 2) {
-    fprintf(stderr, "usage: tiger-compiler file.tig\n");
+  // Either count how the program runs or compile it for a profile it wrote
+  int arg = 1;
+  if (argc == 3 && std::string_view(argv[1]) == "--instrument") {
+    cg::Profile::Instrument();
+    arg = 2;
+  } else if (argc == 4 && std::string_view(argv[1]) == "--profile-use") {
+    if (!cg::Profile::Use(argv[2])) {
+      fprintf(stderr, "tiger-compiler: cannot read profile %s\n", argv[2]);
+      exit(1);
+    }
+    arg = 3;
+  }
+
+  if (argc != arg + 1) {
+    fprintf(stderr, "usage: tiger-compiler [--instrument | --profile-use "
+                    "file.prof] file.tig\n");
     exit(1);
   }
 
-  fname = std::string_view(argv[1]);
+  fname = std::string_view(argv[arg]);
+  // The runtime collects precisely from the stack maps of the program
+  cg::StackMaps::Emit();
 
   {
     std::unique_ptr<err::ErrorMsg> errormsg;
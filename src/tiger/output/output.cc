@@ -22,6 +22,11 @@ void AssemGen::GenAssem(bool need_ra) {
   fprintf(out_, ".section .rodata\n");
   for (auto &&frag : frags->GetList())
     frag->OutputAssem(out_, phase, need_ra);
+
+  if (cg::Profile::Instrumenting())
+    cg::Profile::OutputCounters(out_);
+  if (cg::StackMaps::Emitting())
+    cg::StackMaps::OutputMaps(out_);
 }
 
 } // namespace output
@@ -32,6 +37,7 @@ void ProcFrag::OutputAssem(FILE *out, OutputPhase phase, bool need_ra) const {
   std::unique_ptr<canon::Traces> traces;
   std::unique_ptr<cg::AssemInstr> assem_instr;
   std::unique_ptr<ra::Result> allocation;
+  std::set<temp::Label *> hot_headers;
 
   // When generating proc fragment, do not output string assembly
   if (phase != Proc)
@@ -55,6 +61,65 @@ void ProcFrag::OutputAssem(FILE *out, OutputPhase phase, bool need_ra) const {
     canon::StmListList *stm_lists = canon.BasicBlocks();
     TigerLog(stm_lists);
 
+    // Propagate constants across the blocks in SSA form
+    TigerLog("------====Constant propagation=====-------\n");
+    canon::ConstantPropagation(stm_lists).Optimize();
+    TigerLog(stm_lists);
+
+    // Read the originals instead of their copies
+    TigerLog("------====Copy propagation=====-------\n");
+    canon::CopyPropagation(stm_lists).Optimize();
+    TigerLog(stm_lists);
+
+    // Move what every iteration computes alike out of the loops
+    TigerLog("------====Loop invariant motion=====-------\n");
+    canon::LoopInvariantMotion(stm_lists).Optimize();
+    TigerLog(stm_lists);
+
+    // Step pointers through the arrays the loops index
+    TigerLog("------====Strength reduction=====-------\n");
+    canon::StrengthReduction(stm_lists).Optimize();
+    TigerLog(stm_lists);
+
+    // Test the counted loops once for several iterations
+    TigerLog("------====Loop unrolling=====-------\n");
+    canon::LoopUnrolling(stm_lists).Optimize();
+    TigerLog(stm_lists);
+
+    // Reuse values computed earlier in the same block
+    TigerLog("------====Value numbering=====-------\n");
+    canon::ValueNumbering(stm_lists).Optimize();
+    TigerLog(stm_lists);
+
+    // Dispatch on a chain of tests against constants at once, through a
+    // table only where the interpreter of unallocated code is not used
+    TigerLog("------====Switch lowering=====-------\n");
+    canon::SwitchLowering(stm_lists, need_ra).Optimize();
+    TigerLog(stm_lists);
+
+    // Leave a single move for a branch to skip, emitted as a conditional
+    // move once registers are allocated
+    if (need_ra) {
+      TigerLog("------====If conversion=====-------\n");
+      canon::IfConversion(stm_lists).Optimize();
+      TigerLog(stm_lists);
+    }
+
+    // Tell the collector which temporaries hold pointers into its heap
+    if (cg::StackMaps::Emitting()) {
+      TigerLog("------====Pointer tracking=====-------\n");
+      canon::PointerTracking(stm_lists).Track();
+      TigerLog(stm_lists);
+    }
+
+    // Put the likely targets of the branches next to them, the rarely run
+    // blocks last
+    TigerLog("------====Block layout=====-------\n");
+    canon::BlockLayout layout(stm_lists, cg::Profile::Edges());
+    layout.Optimize();
+    hot_headers = layout.HotHeaders();
+    TigerLog(stm_lists);
+
     // Order basic blocks into traces_
     TigerLog("-------====Trace=====-----\n");
     tree::StmList *stm_traces = canon.TraceSchedule();
@@ -76,6 +141,22 @@ void ProcFrag::OutputAssem(FILE *out, OutputPhase phase, bool need_ra) const {
 
   assem::InstrList *il = assem_instr.get()->GetInstrList();
 
+  {
+    TigerLog("-------====Peephole=====-----\n");
+    cg::Peephole(il, color, false).Optimize();
+    TigerLog(assem_instr.get(), color);
+  }
+
+  if (cg::StackMaps::Emitting())
+    cg::StackMaps::KeepBases(il);
+
+  {
+    // Drop what is computed but never read
+    TigerLog("-------====Dead code=====-----\n");
+    live::DeadCode(il).Eliminate();
+    TigerLog(assem_instr.get(), color);
+  }
+
   if (need_ra) {
     // Lab 6: register allocation
     TigerLog("----====Register allocate====-----\n");
@@ -84,15 +165,41 @@ void ProcFrag::OutputAssem(FILE *out, OutputPhase phase, bool need_ra) const {
     allocation = reg_allocator.BuildAllocationResult();
     il = allocation->il_;
     color = temp::Map::LayerMap(reg_manager->temp_map_, allocation->coloring_);
+
+    // Rewrites that depend on the allocated registers
+    cg::Peephole(il, color, true).Optimize();
   }
 
   TigerLog("-------====Output assembly for %s=====-----\n",
            frame_->frameLabel_->Name().data());
 
-  assem::Proc *proc = frame::BuildCompleteProcedure(frame_, il);
-
   std::string proc_name = frame_->GetFrameLabel();
+  // A function the profile never saw entered is kept apart from the others
+  bool unlikely = cg::Profile::Entries(proc_name) == 0;
 
+  assem::Proc *proc = frame::BuildCompleteProcedure(frame_, il, color);
+  if (need_ra) {
+    frame::JumpToTailCalls(frame_, proc, color);
+    if (cg::Profile::Instrumenting())
+      cg::Profile::InstrumentProc(proc_name, proc->body_);
+
+    // Start the loops run often at a fetch block boundary
+    const std::list<assem::Instr *> &body = proc->body_->GetList();
+    for (auto it = body.cbegin(); it != body.cend(); ++it)
+      if (typeid(**it) == typeid(assem::LabelInstr) &&
+          hot_headers.count(static_cast<assem::LabelInstr *>(*it)->label_))
+        proc->body_->Insert(
+            it, new assem::OperInstr(assem::Opcode::P2ALIGN,
+                                     {assem::Operand::Imm(4)}, nullptr,
+                                     nullptr, nullptr));
+
+    if (cg::StackMaps::Emitting())
+      cg::StackMaps::RecordProc(frame_, proc->body_, allocation->roots_,
+                                color);
+  }
+
+  if (unlikely)
+    fprintf(out, ".section .text.unlikely\n");
   fprintf(out, ".globl %s\n", proc_name.data());
   fprintf(out, ".type %s, @function\n", proc_name.data());
   // prologue
@@ -102,6 +209,8 @@ void ProcFrag::OutputAssem(FILE *out, OutputPhase phase, bool need_ra) const {
   // epilog_
   fprintf(out, "%s", proc->epilog_.data());
   fprintf(out, ".size %s, .-%s\n", proc_name.data(), proc_name.data());
+  if (unlikely)
+    fprintf(out, ".text\n");
 }
 
 void StringFrag::OutputAssem(FILE *out, OutputPhase phase, bool need_ra) const {
@@ -128,4 +237,17 @@ void StringFrag::OutputAssem(FILE *out, OutputPhase phase, bool need_ra) const {
   }
   fprintf(out, "\"\n");
 }
+
+void JumpTableFrag::OutputAssem(FILE *out, OutputPhase phase,
+                                bool need_ra) const {
+  if (phase != String)
+    return;
+
+  // Offsets keep the table free of relocations in position independent code
+  fprintf(out, ".p2align 3\n");
+  fprintf(out, "%s:\n", label_->Name().data());
+  for (temp::Label *target : targets_)
+    fprintf(out, ".quad %s-%s\n", target->Name().data(),
+            label_->Name().data());
+}
 } // namespace frame
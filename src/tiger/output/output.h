@@ -6,8 +6,22 @@
 #include <string>
 
 #include "tiger/canon/canon.h"
+#include "tiger/canon/constprop.h"
+#include "tiger/canon/copyprop.h"
+#include "tiger/canon/ifconvert.h"
+#include "tiger/canon/induction.h"
+#include "tiger/canon/layout.h"
+#include "tiger/canon/loop.h"
+#include "tiger/canon/pointer.h"
+#include "tiger/canon/switch.h"
+#include "tiger/canon/unroll.h"
+#include "tiger/canon/valuenumber.h"
 #include "tiger/codegen/codegen.h"
+#include "tiger/codegen/peephole.h"
+#include "tiger/codegen/profile.h"
+#include "tiger/codegen/stackmap.h"
 #include "tiger/frame/frame.h"
+#include "tiger/liveness/deadcode.h"
 #include "tiger/regalloc/regalloc.h"
 
 namespace output {
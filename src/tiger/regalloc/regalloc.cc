@@ -2,9 +2,45 @@
 
 #include "tiger/output/logger.h"
 
+#include <algorithm>
 #include <sstream>
 
 extern frame::RegManager *reg_manager;
+
+namespace {
+
+bool IsCallInstr(assem::Instr *instr) {
+  if (typeid(*instr) != typeid(assem::OperInstr))
+    return false;
+  return static_cast<assem::OperInstr *>(instr)->opcode_ ==
+         assem::Opcode::CALLQ;
+}
+
+bool IsJumpInstr(assem::Instr *instr) {
+  if (typeid(*instr) != typeid(assem::OperInstr))
+    return false;
+  return static_cast<assem::OperInstr *>(instr)->jumps_ != nullptr;
+}
+
+// A constant load or an address computation from the stack pointer can be
+// recomputed anywhere in the procedure body
+bool IsRematerializable(assem::Instr *instr) {
+  if (typeid(*instr) != typeid(assem::OperInstr))
+    return false;
+  auto *oper = static_cast<assem::OperInstr *>(instr);
+  if (oper->jumps_ != nullptr || oper->Def()->GetList().size() != 1)
+    return false;
+  for (temp::Temp *reg : oper->Use()->GetList()) {
+    if (reg != reg_manager->StackPointer())
+      return false;
+  }
+  return oper->opcode_ == assem::Opcode::LEAQ ||
+         (oper->opcode_ == assem::Opcode::MOVQ &&
+          oper->operands_[0].kind == assem::OperandKind::IMM);
+}
+
+} // namespace
+
 namespace ra {
 
 RegAllocator::RegAllocator(frame::Frame *frame,
@@ -28,6 +64,20 @@ RegAllocator::RegAllocator(frame::Frame *frame,
   frozenMoves = new live::MoveList();
   worklistMoves = new live::MoveList();
   activeMoves = new live::MoveList();
+
+  int colorIndex = 0;
+  temp::TempList *calleeSaves = reg_manager->CalleeSaves();
+  for (temp::Temp *reg : reg_manager->Registers()->GetList()) {
+    if (calleeSaves->ContainsElement(reg))
+      calleeSaveColors.insert(colorIndex);
+    if (reg == reg_manager->StackPointer())
+      stackPointerColor = colorIndex;
+    colorIndex++;
+  }
+
+  // Spill slots never share a frame slot with an escaping variable
+  frame->liveLocalCount_ = frame->localVariableCount_;
+  firstSpillSlot = frame->localVariableCount_;
 }
 
 void RegAllocator::RegAlloc() {
@@ -44,6 +94,7 @@ void RegAllocator::RegAlloc() {
 
   InitializeNodeColors();
   InitializeNodeAliases();
+  FindCallCrossingNodes();
   initialNodes = liveGraphFactory->GetLiveGraph().interf_graph->Nodes()->Diff(
       preColoredNodes);
 
@@ -67,6 +118,9 @@ void RegAllocator::RegAlloc() {
     RegAlloc();
   } else {
     RemoveRedundantMoves();
+    ColorSpillSlots();
+    if (cg::StackMaps::Emitting())
+      RecordRoots();
   }
 }
 
@@ -107,6 +161,7 @@ std::unique_ptr<Result> RegAllocator::BuildAllocationResult() {
   }
   auto result =
       std::make_unique<Result>(coloring, assemblyInstruction->GetInstrList());
+  result->roots_ = std::move(callRoots);
   return result;
 }
 
@@ -249,6 +304,8 @@ void RegAllocator::Combine(live::INode *u, live::INode *v) {
 
   coalescedNodes = coalescedNodes->Union(singleV);
   aliasMap[v] = u;
+  if (callCrossingNodes.count(v))
+    callCrossingNodes.insert(u);
 
   auto *uMoves = liveGraphFactory->GetLiveGraph().move_list->Look(u);
   auto *vMoves = liveGraphFactory->GetLiveGraph().move_list->Look(v);
@@ -374,6 +431,7 @@ void RegAllocator::AssignColorsToNodes() {
     for (int c = 0; c < reg_manager->RegisterCount(); ++c) {
       availableColors.insert(c);
     }
+    availableColors.erase(stackPointerColor);
 
     for (live::INode *w : n->AdjacentList()->GetList()) {
       live::INode *alias = GetAlias(w);
@@ -387,7 +445,7 @@ void RegAllocator::AssignColorsToNodes() {
       spilledNodes = spilledNodes->Union(singleN);
     } else {
       coloredNodes = coloredNodes->Union(singleN);
-      colorMap[n] = *availableColors.begin();
+      colorMap[n] = SelectNodeColor(n, availableColors);
     }
   }
 
@@ -396,48 +454,344 @@ void RegAllocator::AssignColorsToNodes() {
   }
 }
 
-void RegAllocator::RewriteProgram() {
-  auto *nodeInstrMap = liveGraphFactory->GetNodeInstrMap().get();
+int RegAllocator::SelectNodeColor(live::INode *n,
+                                  const std::set<int> &availableColors) {
+  // Biased coloring: take the color of an already colored move partner so
+  // that the move becomes redundant
+  auto *nodeMoves = liveGraphFactory->GetLiveGraph().move_list->Look(n);
+  for (const auto &move : nodeMoves->GetList()) {
+    live::INode *src = GetAlias(move.first);
+    live::INode *dst = GetAlias(move.second);
+    live::INode *partner = src == n ? dst : src;
+    if (partner == n || (src != n && dst != n))
+      continue;
+    if ((IsPrecolored(partner) || coloredNodes->Contain(partner)) &&
+        availableColors.count(colorMap[partner]))
+      return colorMap[partner];
+  }
 
+  // Temporaries live across a call go to callee-saved registers, which are
+  // only saved once per procedure; the others stay in caller-saved ones
+  bool preferCalleeSave = callCrossingNodes.count(n) > 0;
+  for (int color : availableColors) {
+    if ((calleeSaveColors.count(color) > 0) == preferCalleeSave)
+      return color;
+  }
+  return *availableColors.begin();
+}
+
+void RegAllocator::RewriteProgram() {
   for (live::INode *v : spilledNodes->GetList()) {
+    assem::OperInstr *def = FindRematerializableDef(v);
+    if (def) {
+      Rematerialize(v, def);
+      continue;
+    }
+
+    // A range is split first and only goes to memory once splitting it did
+    // not make it colorable
+    if (!splitTemps.count(v->NodeInfo())) {
+      SplitLiveRange(v->NodeInfo());
+      continue;
+    }
+
     frame::Access *acc = frame->AllocateLocal(true);
-    std::string memPos = acc->ConsumeAccess(frame);
-
-    auto nodeInstrs = nodeInstrMap->at(v);
-    for (auto instrIt = nodeInstrs->begin(); instrIt != nodeInstrs->end();
-         ++instrIt) {
-      auto instrPos = *instrIt;
-      assem::Instr *instr = *instrPos;
-      temp::Temp *newReg = temp::TempFactory::NewTemp();
-
-      // If the spilled temporary is used in the instruction
-      if (instr->Use()->ContainsElement(v->NodeInfo())) {
-        ReplaceInUseList(instr, v->NodeInfo(), newReg);
-
-        // Insert a fetch instruction before the current instruction
-        std::string fetchInstrStr = "movq " + memPos + ", `d0";
-        auto *fetchInstr = new assem::OperInstr(
-            fetchInstrStr, new temp::TempList(newReg),
-            new temp::TempList(reg_manager->StackPointer()), nullptr);
-        assemblyInstruction->GetInstrList()->Insert(instrPos, fetchInstr);
+    spillSlots.push_back(acc->ConsumeAccess(frame, 0));
+    spillSlotOwners.push_back(v->NodeInfo());
+    SpillEverywhere(v, spillSlots.size() - 1);
+  }
+
+  // Clear all the lists and maps
+  ClearAllListsAndMaps();
+}
+
+assem::OperInstr *RegAllocator::FindRematerializableDef(live::INode *v) {
+  auto *nodeInstrMap = liveGraphFactory->GetNodeInstrMap().get();
+
+  assem::OperInstr *def = nullptr;
+  for (auto instrPos : *nodeInstrMap->at(v)) {
+    assem::Instr *instr = *instrPos;
+    if (!instr->Def()->ContainsElement(v->NodeInfo()))
+      continue;
+    if (def != nullptr || !IsRematerializable(instr))
+      return nullptr;
+    def = static_cast<assem::OperInstr *>(instr);
+  }
+  return def;
+}
+
+void RegAllocator::Rematerialize(live::INode *v, assem::OperInstr *def) {
+  auto *nodeInstrMap = liveGraphFactory->GetNodeInstrMap().get();
+
+  for (auto instrPos : *nodeInstrMap->at(v)) {
+    assem::Instr *instr = *instrPos;
+    if (instr == def) {
+      assemblyInstruction->GetInstrList()->Erase(instrPos);
+      continue;
+    }
+
+    // Recompute the value right before every use instead of reloading it
+    temp::Temp *newReg = temp::TempFactory::NewTemp();
+    auto *srcRegs = new temp::TempList();
+    srcRegs->AppendTempList(def->Use());
+    auto *remat = new assem::OperInstr(*def);
+    remat->dst_ = new temp::TempList(newReg);
+    remat->src_ = srcRegs;
+    assemblyInstruction->GetInstrList()->Insert(instrPos, remat);
+    while (instr->Use()->ContainsElement(v->NodeInfo()))
+      ReplaceInUseList(instr, v->NodeInfo(), newReg);
+  }
+}
+
+assem::OperInstr *RegAllocator::NewSpillFetch(int slot, temp::Temp *reg) {
+  return new assem::OperInstr(
+      assem::Opcode::MOVQ, {spillSlots[slot], assem::Operand::Dst(0)},
+      new temp::TempList(reg), new temp::TempList(reg_manager->StackPointer()),
+      nullptr);
+}
+
+// The slot is addressed from the stack pointer, the second source
+assem::OperInstr *RegAllocator::NewSpillStore(int slot, temp::Temp *reg) {
+  assem::Operand mem = spillSlots[slot];
+  mem.reg = 1;
+  return new assem::OperInstr(
+      assem::Opcode::MOVQ, {assem::Operand::Src(0), mem}, nullptr,
+      new temp::TempList({reg, reg_manager->StackPointer()}), nullptr);
+}
+
+void RegAllocator::SpillEverywhere(live::INode *v, int slot) {
+  auto *nodeInstrMap = liveGraphFactory->GetNodeInstrMap().get();
+
+  auto nodeInstrs = nodeInstrMap->at(v);
+  for (auto instrIt = nodeInstrs->begin(); instrIt != nodeInstrs->end();
+       ++instrIt) {
+    auto instrPos = *instrIt;
+    assem::Instr *instr = *instrPos;
+    temp::Temp *newReg = temp::TempFactory::NewTemp();
+
+    // If the spilled temporary is used in the instruction
+    if (instr->Use()->ContainsElement(v->NodeInfo())) {
+      ReplaceInUseList(instr, v->NodeInfo(), newReg);
+
+      // Insert a fetch instruction before the current instruction
+      auto *fetchInstr = NewSpillFetch(slot, newReg);
+      assemblyInstruction->GetInstrList()->Insert(instrPos, fetchInstr);
+      spillSlotAccesses[fetchInstr] = slot;
+    }
+
+    // If the spilled temporary is defined in the instruction
+    if (instr->Def()->ContainsElement(v->NodeInfo())) {
+      ReplaceInDefList(instr, v->NodeInfo(), newReg);
+
+      // Insert a store instruction after the current instruction
+      auto *storeInstr = NewSpillStore(slot, newReg);
+      assemblyInstruction->GetInstrList()->Insert(++instrPos, storeInstr);
+      spillSlotAccesses[storeInstr] = slot;
+    }
+  }
+}
+
+void RegAllocator::SplitLiveRange(temp::Temp *spilled) {
+  assem::InstrList *instrList = assemblyInstruction->GetInstrList();
+
+  // The live range is cut at every label, jump and call. Inside one region
+  // the spilled temporary lives in a fresh temporary, copied from the
+  // original one before the first use and back after the last definition.
+  // The original one is left holding the value only between the regions,
+  // across the calls and loop edges, and the coalescer joins the pieces
+  // again wherever they still color together
+  splitTemps.insert(spilled);
+  temp::Temp *regionReg = nullptr;
+  bool defined = false;
+  auto lastDef = instrList->GetList().cend();
+
+  auto closeRegion = [&]() {
+    if (regionReg && defined)
+      instrList->Insert(std::next(lastDef),
+                        new assem::MoveInstr(new temp::TempList(spilled),
+                                             new temp::TempList(regionReg)));
+    regionReg = nullptr;
+    defined = false;
+  };
+
+  for (auto instrPos = instrList->GetList().cbegin();
+       instrPos != instrList->GetList().cend(); ++instrPos) {
+    assem::Instr *instr = *instrPos;
+    if (typeid(*instr) == typeid(assem::LabelInstr)) {
+      closeRegion();
+      continue;
+    }
+
+    if (instr->Use()->ContainsElement(spilled)) {
+      if (!regionReg) {
+        regionReg = temp::TempFactory::NewTemp();
+        splitTemps.insert(regionReg);
+
+        // Copy the value in before the first use in the region
+        instrList->Insert(instrPos,
+                          new assem::MoveInstr(new temp::TempList(regionReg),
+                                               new temp::TempList(spilled)));
+      }
+      while (instr->Use()->ContainsElement(spilled))
+        ReplaceInUseList(instr, spilled, regionReg);
+    }
+
+    if (instr->Def()->ContainsElement(spilled)) {
+      if (!regionReg) {
+        regionReg = temp::TempFactory::NewTemp();
+        splitTemps.insert(regionReg);
       }
+      while (instr->Def()->ContainsElement(spilled))
+        ReplaceInDefList(instr, spilled, regionReg);
+      defined = true;
+      lastDef = instrPos;
+    }
 
-      // If the spilled temporary is defined in the instruction
-      if (instr->Def()->ContainsElement(v->NodeInfo())) {
-        ReplaceInDefList(instr, v->NodeInfo(), newReg);
+    if (IsCallInstr(instr) || IsJumpInstr(instr))
+      closeRegion();
+  }
+  closeRegion();
+}
 
-        // Insert a store instruction after the current instruction
-        std::string storeInstrStr = "movq `s0, " + memPos;
-        auto *storeInstr = new assem::OperInstr(
-            storeInstrStr, nullptr,
-            new temp::TempList({newReg, reg_manager->StackPointer()}), nullptr);
-        assemblyInstruction->GetInstrList()->Insert(++instrPos, storeInstr);
+void RegAllocator::ColorSpillSlots() {
+  if (spillSlots.empty())
+    return;
+
+  fg::FlowGraphFactory slotFlowGraph(assemblyInstruction->GetInstrList());
+  slotFlowGraph.AssemFlowGraph();
+  auto &nodes = slotFlowGraph.GetFlowGraph()->Nodes()->GetList();
+
+  // Liveness of the spill slots: a load uses its slot, a store defines it
+  std::map<fg::FNode *, std::set<int>> slotIn, slotOut;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto nodeIt = nodes.rbegin(); nodeIt != nodes.rend(); ++nodeIt) {
+      fg::FNode *node = *nodeIt;
+      std::set<int> out;
+      for (fg::FNode *succ : node->Succ()->GetList())
+        out.insert(slotIn[succ].begin(), slotIn[succ].end());
+
+      std::set<int> in = out;
+      auto access = spillSlotAccesses.find(node->NodeInfo());
+      if (access != spillSlotAccesses.end()) {
+        if (node->NodeInfo()->Def()->GetList().empty())
+          in.erase(access->second);
+        else
+          in.insert(access->second);
+      }
+
+      if (in != slotIn[node] || out != slotOut[node]) {
+        slotIn[node] = in;
+        slotOut[node] = out;
+        changed = true;
       }
     }
   }
 
-  // Clear all the lists and maps
-  ClearAllListsAndMaps();
+  // A stored slot interferes with every other slot live after the store
+  std::vector<std::set<int>> interference(spillSlots.size());
+  for (fg::FNode *node : nodes) {
+    auto access = spillSlotAccesses.find(node->NodeInfo());
+    if (access == spillSlotAccesses.end() ||
+        !node->NodeInfo()->Def()->GetList().empty())
+      continue;
+    for (int other : slotOut[node]) {
+      if (other == access->second)
+        continue;
+      interference[access->second].insert(other);
+      interference[other].insert(access->second);
+    }
+  }
+
+  // Greedy coloring in allocation order, so a slot is only ever moved down
+  // into a slot that was handed out before it
+  std::vector<int> slotColor(spillSlots.size());
+  int colorCount = 0;
+  for (size_t slot = 0; slot < spillSlots.size(); ++slot) {
+    std::set<int> usedColors;
+    for (int other : interference[slot]) {
+      if (static_cast<size_t>(other) < slot)
+        usedColors.insert(slotColor[other]);
+    }
+    int color = 0;
+    while (usedColors.count(color))
+      color++;
+    slotColor[slot] = color;
+    colorCount = std::max(colorCount, color + 1);
+  }
+
+  for (fg::FNode *node : nodes)
+    if (IsCallInstr(node->NodeInfo()))
+      slotsAcrossCalls[node->NodeInfo()] = slotOut[node];
+  for (size_t slot = 0; slot < spillSlots.size(); ++slot)
+    spillSlotOffsets.push_back(-spillSlots[slotColor[slot]].value);
+
+  for (const auto &access : spillSlotAccesses) {
+    int slot = access.second;
+    if (slotColor[slot] == slot)
+      continue;
+    auto *instr = static_cast<assem::OperInstr *>(access.first);
+    for (assem::Operand &operand : instr->operands_) {
+      if (operand.kind == assem::OperandKind::MEM)
+        operand.value = spillSlots[slotColor[slot]].value;
+    }
+  }
+
+  // The frame size is computed from the compacted layout
+  frame->localVariableCount_ = firstSpillSlot + colorCount;
+}
+
+void RegAllocator::RecordRoots() {
+  auto *liveOut = liveGraphFactory->GetLiveOut();
+  for (fg::FNode *fnode :
+       flowGraphFactory->GetFlowGraph()->Nodes()->GetList()) {
+    assem::Instr *instr = fnode->NodeInfo();
+    if (!IsCallInstr(instr))
+      continue;
+    temp::TempList *crossing =
+        liveOut->Look(fnode)->CreateDifferenceWithList(instr->Def());
+    const std::set<int> &slots = slotsAcrossCalls[instr];
+    std::vector<cg::Root> &roots = callRoots[instr];
+
+    // A pointer into the middle of an object keeps the start of the object
+    // across the call as well
+    auto addRoot = [&](temp::Temp *reg, int place) {
+      if (!reg->IsPointer())
+        return;
+      int base =
+          reg->Base() ? PlaceAcrossCall(reg->Base(), crossing, slots) : place;
+      assert(base != 0);
+      roots.emplace_back(place, base);
+    };
+    for (temp::Temp *reg : crossing->GetList())
+      if (reg->IsPointer())
+        addRoot(reg, PlaceAcrossCall(reg, crossing, slots));
+    for (int slot : slots)
+      addRoot(spillSlotOwners[slot], spillSlotOffsets[slot]);
+  }
+}
+
+// The callee-saved register a temporary live across a call is colored with,
+// as -1 minus its index, or the offset of the spill slot it lives in; 0 when
+// it is kept in neither
+int RegAllocator::PlaceAcrossCall(temp::Temp *reg, temp::TempList *crossing,
+                                  const std::set<int> &slots) {
+  if (crossing->ContainsElement(reg)) {
+    temp::Temp *colorReg = reg_manager->Registers()->NthTemp(
+        colorMap[liveGraphFactory->GetTempNodeMap()->Look(reg)]);
+    int index = 0;
+    for (temp::Temp *saved : reg_manager->CalleeSaves()->GetList()) {
+      if (saved == colorReg)
+        return -1 - index;
+      index++;
+    }
+    assert(false);
+  }
+  for (int slot : slots)
+    if (spillSlotOwners[slot] == reg)
+      return spillSlotOffsets[slot];
+  return 0;
 }
 
 void RegAllocator::InitializeNodeColors() {
@@ -450,6 +804,24 @@ void RegAllocator::InitializeNodeColors() {
   }
 }
 
+void RegAllocator::FindCallCrossingNodes() {
+  auto *liveOut = liveGraphFactory->GetLiveOut();
+  auto tnMap = liveGraphFactory->GetTempNodeMap();
+  for (fg::FNode *fnode :
+       flowGraphFactory->GetFlowGraph()->Nodes()->GetList()) {
+    assem::Instr *instr = fnode->NodeInfo();
+    if (!IsCallInstr(instr))
+      continue;
+    temp::TempList *crossing =
+        liveOut->Look(fnode)->CreateDifferenceWithList(instr->Def());
+    for (temp::Temp *reg : crossing->GetList()) {
+      live::INode *node = tnMap->Look(reg);
+      if (!IsPrecolored(node))
+        callCrossingNodes.insert(node);
+    }
+  }
+}
+
 void RegAllocator::InitializeNodeAliases() {
   auto *allNodes = liveGraphFactory->GetLiveGraph().interf_graph->Nodes();
   for (live::INode *n : allNodes->GetList()) {
@@ -489,6 +861,7 @@ void RegAllocator::ClearAllListsAndMaps() {
   activeMoves->Clear();
   colorMap.clear();
   aliasMap.clear();
+  callCrossingNodes.clear();
 
   flowGraphFactory = nullptr;
   liveGraphFactory = nullptr;
@@ -3,12 +3,14 @@
 
 #include "tiger/codegen/assem.h"
 #include "tiger/codegen/codegen.h"
+#include "tiger/codegen/stackmap.h"
 #include "tiger/frame/frame.h"
 #include "tiger/frame/temp.h"
 #include "tiger/liveness/liveness.h"
 #include "tiger/regalloc/color.h"
 #include "tiger/util/graph.h"
 #include <map>
+#include <set>
 
 namespace ra {
 
@@ -16,6 +18,8 @@ class Result {
 public:
   temp::Map *coloring_;
   assem::InstrList *il_;
+  // The pointers kept across each call and where they are kept
+  cg::CallRoots roots_;
 
   Result() : coloring_(nullptr), il_(nullptr) {}
   Result(temp::Map *coloring, assem::InstrList *il)
@@ -62,6 +66,30 @@ private:
   std::map<live::INode *, int> colorMap;
   std::unordered_map<live::INode *, live::INode *> aliasMap;
 
+  // Temporaries live across at least one call; they should prefer
+  // callee-saved colors, every other node prefers caller-saved ones
+  std::set<live::INode *> callCrossingNodes;
+  std::set<int> calleeSaveColors;
+  int stackPointerColor;
+
+  // Temporaries whose live range was already split, and the pieces split
+  // off them; if one of them has to be spilled it is spilled everywhere
+  std::set<temp::Temp *> splitTemps;
+
+  // Frame slots handed out to spilled temporaries and the slot accessed by
+  // every spill load and store, compacted once allocation is done
+  std::vector<assem::Operand> spillSlots;
+  std::map<assem::Instr *, int> spillSlotAccesses;
+  int firstSpillSlot;
+
+  // The temporary spilled to each slot, the offset below the frame address
+  // each slot ends up at and the slots live across every call, for the
+  // stack maps of the collector
+  std::vector<temp::Temp *> spillSlotOwners;
+  std::vector<int> spillSlotOffsets;
+  std::map<assem::Instr *, std::set<int>> slotsAcrossCalls;
+  cg::CallRoots callRoots;
+
   std::unique_ptr<fg::FlowGraphFactory> flowGraphFactory;
   std::unique_ptr<live::LiveGraphFactory> liveGraphFactory;
   live::INodeList *initialNodes;
@@ -71,6 +99,7 @@ private:
 
   void InitializeNodeColors();
   void InitializeNodeAliases();
+  void FindCallCrossingNodes();
 
   void InitializeWorkLists();
   live::INodeList *GetAdjacentNodes(live::INode *n);
@@ -98,7 +127,18 @@ private:
   void SelectNodeForSpilling();
   live::INode *SelectSpillCandidateHeuristically();
   void AssignColorsToNodes();
+  int SelectNodeColor(live::INode *n, const std::set<int> &availableColors);
   void RewriteProgram();
+  assem::OperInstr *FindRematerializableDef(live::INode *v);
+  void Rematerialize(live::INode *v, assem::OperInstr *def);
+  void SpillEverywhere(live::INode *v, int slot);
+  void SplitLiveRange(temp::Temp *spilled);
+  assem::OperInstr *NewSpillFetch(int slot, temp::Temp *reg);
+  assem::OperInstr *NewSpillStore(int slot, temp::Temp *reg);
+  void ColorSpillSlots();
+  void RecordRoots();
+  int PlaceAcrossCall(temp::Temp *reg, temp::TempList *crossing,
+                      const std::set<int> &slots);
 
   void PrintMovePairList();
   void PrintNodeAliases();
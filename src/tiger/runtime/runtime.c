@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 extern int tigermain();
 
@@ -9,28 +10,360 @@ int sum_seven(int v1, int v2, int v3, int v4, int v5, int v6, int v7) {
   return v1 + v2 + v3 + v4 + v5 + v6 + v7;
 }
 
-long *init_array(int size, long init) {
+struct string {
+  int length;
+  unsigned char chars[1];
+};
+
+// The heap is collected by a generational copying collector. Objects are
+// bump-allocated behind a header of two words: the pointer map of a record,
+// then the size of the object in words and its kind. The compiler describes
+// every record and array it allocates, and emits a stack map for every call
+// giving the frame slots and callee-saved registers holding pointers, so the
+// roots are found precisely. Objects are allocated into a nursery; whatever
+// survives a collection of the nursery is promoted into the old space, which
+// is one half of a semispace copied into the other when it grows past its
+// threshold. The compiled code marks the card of every pointer it stores
+// into an object, so the old objects pointing into the nursery are found by
+// the cards marked since the last collection.
+#define PAGE_SIZE 4096
+#define PAGE_WORDS (PAGE_SIZE / (long)sizeof(long))
+// Address space reserved for each half of the old space, in pages
+#define OLD_PAGES (1 << 18)
+// Pages of the nursery
+#ifndef NURSERY_PAGES
+#define NURSERY_PAGES 256
+#endif
+// Pages the old space grows to before the first collection of all of it
+#ifndef MIN_HEAP_PAGES
+#define MIN_HEAP_PAGES 256
+#endif
+#define NURSERY_WORDS (NURSERY_PAGES * PAGE_WORDS)
+#define OLD_WORDS ((long)OLD_PAGES * PAGE_WORDS)
+// Cards of 512 bytes, the shift is the one the compiler emits
+#define CARD_SHIFT 9
+#define CARD_COUNT ((NURSERY_WORDS + 2 * OLD_WORDS) * (long)sizeof(long) >> CARD_SHIFT)
+
+enum { RAW, POINTERS, RECORD, FORWARDED };
+
+#define KIND(header) ((header)[1] & 3)
+#define WORDS(header) ((header)[1] >> 2)
+
+// The nursery, then both halves of the old space
+static long *arena;
+static long *young_ptr, *young_limit;
+static long *old_base, *old_top, *old_limit;
+static long gc_threshold = MIN_HEAP_PAGES * PAGE_WORDS;
+
+// A word per card, set by the compiled code through tiger_card_base to the
+// card of an address, and the object covering the start of each card of the
+// old space
+static long *cards;
+static long **card_object;
+long tiger_card_base;
+
+// The objects the collection condemns, one or two ranges of headers
+static long *condemned_lo[2], *condemned_hi[2];
+
+// The runtime functions that allocate save the callee-saved registers and
+// keep the stack pointer here, the stack maps start from it
+long *tiger_gc_frame;
+
+// Locals of the runtime holding pointers while it allocates
+static long *c_roots[2];
+static int c_root_count;
+
+static long card_of(long *address) {
+  return ((long)address - (long)arena) >> CARD_SHIFT;
+}
+
+static int condemned(long pointer) {
+  long *header = (long *)pointer - 2;
+  return (header >= condemned_lo[0] && header < condemned_hi[0]) ||
+         (header >= condemned_lo[1] && header < condemned_hi[1]);
+}
+
+// Room for an object and its header in the old space
+static long *old_place(long words) {
+  long *header = old_top, *end = header + words + 2, c;
+  if (end > old_limit) {
+    printf("out of memory\n");
+    exit(1);
+  }
+  old_top = end;
+  // The cards starting within the object
+  for (c = card_of(header + (1 << CARD_SHIFT) / sizeof(long) - 1);
+       c <= card_of(end - 1); c++)
+    card_object[c] = header;
+  return header;
+}
+
+static long forward(long pointer) {
+  long *header = (long *)pointer - 2, *copy;
+  if (!condemned(pointer))
+    return pointer;
+  if (KIND(header) == FORWARDED)
+    return header[0];
+  copy = old_place(WORDS(header));
+  memcpy(copy, header, (WORDS(header) + 2) * sizeof(long));
+  header[0] = (long)(copy + 2);
+  header[1] = WORDS(header) << 2 | FORWARDED;
+  return (long)(copy + 2);
+}
+
+// Whether a field of an object holds a pointer
+static int holds_pointer(long *header, long i) {
+  struct string *map = (struct string *)header[0];
+  if (KIND(header) == POINTERS)
+    return 1;
+  return KIND(header) == RECORD && i < map->length && map->chars[i] == '1';
+}
+
+// Forward the pointers an object holds between two addresses, returning the
+// header after it
+static long *scan_fields(long *header, long *from, long *to) {
+  long *fields = header + 2;
+  long i, words = WORDS(header);
+  if (KIND(header) != RAW)
+    for (i = from > fields ? from - fields : 0; i < words && fields + i < to;
+         i++)
+      if (holds_pointer(header, i))
+        fields[i] = forward(fields[i]);
+  return fields + words;
+}
+
+static long *scan_object(long *header) {
+  return scan_fields(header, header, header + WORDS(header) + 2);
+}
+
+// The stack maps of the program, sorted by the address each call returns to
+extern long __start_tiger_gc_maps[] __attribute__((weak));
+extern long __stop_tiger_gc_maps[] __attribute__((weak));
+static long **maps;
+static long map_count;
+
+static int compare_maps(const void *a, const void *b) {
+  long x = (*(long *const *)a)[0], y = (*(long *const *)b)[0];
+  return x < y ? -1 : x > y;
+}
+
+static long *find_map(long ret) {
+  long lo = 0, hi = map_count;
+  while (lo < hi) {
+    long mid = (lo + hi) / 2;
+    if (maps[mid][0] < ret)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < map_count && maps[lo][0] == ret ? maps[lo] : NULL;
+}
+
+static void read_maps() {
+  long *entry;
+  for (entry = __start_tiger_gc_maps; entry < __stop_tiger_gc_maps;
+       entry += 9 + 2 * entry[8])
+    map_count++;
+  maps = (long **)malloc((map_count + 1) * sizeof(long *));
+  map_count = 0;
+  for (entry = __start_tiger_gc_maps; entry < __stop_tiger_gc_maps;
+       entry += 9 + 2 * entry[8])
+    maps[map_count++] = entry;
+  qsort(maps, map_count, sizeof(long *), compare_maps);
+}
+
+// A pointer into the middle of an object, moved along with the start
+struct derived {
+  long *place, *base;
+  long offset;
+};
+
+static long **roots;
+static struct derived *deriveds;
+static long root_capacity, derived_capacity;
+
+// Forward the pointers the frames of the program hold. A place of a stack map
+// is an offset from the stack pointer of the frame, or the callee-saved
+// register of that index counted from -1 down
+static void scan_roots() {
+  long *saved = tiger_gc_frame, *sp = saved + 7, ret = saved[6], *map;
+  long *registers[6];
+  long root_count = 0, derived_count = 0, i;
+  for (i = 0; i < 6; i++)
+    registers[i] = saved + i;
+
+  while ((map = find_map(ret))) {
+    long *places = map + 9;
+    for (i = 0; i < map[8]; i++) {
+      long *place = places[2 * i] < 0 ? registers[-1 - places[2 * i]]
+                                      : (long *)((char *)sp + places[2 * i]);
+      long *base = places[2 * i + 1] < 0
+                       ? registers[-1 - places[2 * i + 1]]
+                       : (long *)((char *)sp + places[2 * i + 1]);
+      if (root_count == root_capacity) {
+        root_capacity = root_capacity ? 2 * root_capacity : 256;
+        roots = (long **)realloc(roots, root_capacity * sizeof(long *));
+      }
+      if (derived_count == derived_capacity) {
+        derived_capacity = derived_capacity ? 2 * derived_capacity : 64;
+        deriveds = (struct derived *)realloc(
+            deriveds, derived_capacity * sizeof(struct derived));
+      }
+      if (place == base) {
+        roots[root_count++] = place;
+      } else {
+        deriveds[derived_count].place = place;
+        deriveds[derived_count].base = base;
+        deriveds[derived_count++].offset = *place - *base;
+      }
+    }
+    // The registers the frame saved hold the values of its caller
+    for (i = 0; i < 6; i++)
+      if (map[2 + i] >= 0)
+        registers[i] = (long *)((char *)sp + map[2 + i]);
+    ret = *(long *)((char *)sp + map[1]);
+    sp = (long *)((char *)sp + map[1] + 8);
+  }
+
+  // The starts are moved first, then the pointers into their middle follow
+  for (i = 0; i < root_count; i++)
+    *roots[i] = forward(*roots[i]);
+  for (i = 0; i < c_root_count; i++)
+    *c_roots[i] = forward(*c_roots[i]);
+  for (i = 0; i < derived_count; i++)
+    *deriveds[i].place = *deriveds[i].base + deriveds[i].offset;
+}
+
+// Promote what survives in the nursery, starting from the old objects on a
+// marked card as well
+static void collect_nursery() {
+  long *scan = old_top, *limit = old_top, c;
+  condemned_lo[0] = arena;
+  condemned_hi[0] = young_ptr;
+  condemned_lo[1] = condemned_hi[1] = NULL;
+  scan_roots();
+
+  for (c = card_of(old_base); limit > old_base && c <= card_of(limit - 1); c++)
+    if (cards[c]) {
+      long *start = (long *)((char *)arena + (c << CARD_SHIFT));
+      long *end = start + (1 << CARD_SHIFT) / sizeof(long), *header;
+      cards[c] = 0;
+      for (header = card_object[c]; header < end && header < limit;)
+        header = scan_fields(header, start, end);
+    }
+  while (scan < old_top)
+    scan = scan_object(scan);
+  young_ptr = arena;
+}
+
+// Copy what survives in the nursery and the old space into the other half of
+// the old space
+static void collect_all() {
+  long *from = old_base, *from_top = old_top, *scan;
+  old_base = from == arena + NURSERY_WORDS ? from + OLD_WORDS
+                                           : arena + NURSERY_WORDS;
+  old_top = scan = old_base;
+  old_limit = old_base + OLD_WORDS;
+  condemned_lo[0] = arena;
+  condemned_hi[0] = young_ptr;
+  condemned_lo[1] = from;
+  condemned_hi[1] = from_top;
+  scan_roots();
+  while (scan < old_top)
+    scan = scan_object(scan);
+  young_ptr = arena;
+
+  memset(cards + card_of(from), 0,
+         (card_of(from_top) - card_of(from) + 1) * sizeof(long));
+  madvise(from, (char *)from_top - (char *)from, MADV_DONTNEED);
+  gc_threshold = 2 * (old_top - old_base) > MIN_HEAP_PAGES * PAGE_WORDS
+                     ? 2 * (old_top - old_base)
+                     : MIN_HEAP_PAGES * PAGE_WORDS;
+}
+
+static void *gc_alloc(long words, int kind, struct string *map) {
+  long *header;
+  if (!maps)
+    read_maps();
+  if (words + 2 > NURSERY_WORDS / 4) {
+    // A large object goes to the old space, its fields may point into the
+    // nursery once it is filled
+    if (old_top - old_base + words + 2 > gc_threshold)
+      collect_all();
+    header = old_place(words);
+    if (kind != RAW) {
+      long c;
+      for (c = card_of(header); c <= card_of(header + words + 1); c++)
+        cards[c] = 1;
+    }
+  } else {
+    if (young_ptr + words + 2 > young_limit) {
+      // The whole nursery may survive, so it must fit in the old space
+      if (old_top - old_base > gc_threshold ||
+          old_limit - old_top < young_ptr - arena)
+        collect_all();
+      else
+        collect_nursery();
+    }
+    header = young_ptr;
+    young_ptr += words + 2;
+  }
+  header[0] = (long)map;
+  header[1] = words << 2 | kind;
+  return header + 2;
+}
+
+// The entries the compiled code calls save the callee-saved registers where
+// the stack maps find them and call the collecting function of their name
+#define GC_ENTRY(name)                                                         \
+  __asm__(".text\n"                                                            \
+          ".globl " #name "\n"                                                 \
+          ".type " #name ", @function\n" #name ":\n"                           \
+          "pushq %r15\n"                                                       \
+          "pushq %r14\n"                                                       \
+          "pushq %r13\n"                                                       \
+          "pushq %r12\n"                                                       \
+          "pushq %rbp\n"                                                       \
+          "pushq %rbx\n"                                                       \
+          "movq %rsp, tiger_gc_frame(%rip)\n"                                  \
+          "movq %rsp, %rbx\n"                                                  \
+          "andq $-16, %rsp\n"                                                  \
+          "call gc_" #name "\n"                                                \
+          "movq %rbx, %rsp\n"                                                  \
+          "popq %rbx\n"                                                        \
+          "popq %rbp\n"                                                        \
+          "popq %r12\n"                                                        \
+          "popq %r13\n"                                                        \
+          "popq %r14\n"                                                        \
+          "popq %r15\n"                                                        \
+          "ret\n"                                                              \
+          ".size " #name ", .-" #name "\n")
+
+GC_ENTRY(init_array);
+GC_ENTRY(alloc_record);
+GC_ENTRY(concat);
+GC_ENTRY(substring);
+
+long *gc_init_array(int size, long init, int pointers) {
   int i;
-  long *a = (long *)malloc(size * sizeof(long));
+  long *a;
+  if (pointers) {
+    c_roots[0] = &init;
+    c_root_count = 1;
+  }
+  a = (long *)gc_alloc(size, pointers ? POINTERS : RAW, NULL);
+  c_root_count = 0;
   for (i = 0; i < size; i++)
     a[i] = init;
   return a;
 }
 
-int *alloc_record(int size) {
-  int i;
-  int *p, *a;
-  p = a = (int *)malloc(size);
-  for (i = 0; i < size; i += sizeof(int))
-    *p++ = 0;
+long *gc_alloc_record(int size, struct string *map) {
+  long *a = (long *)gc_alloc(size / sizeof(long), RECORD, map);
+  memset(a, 0, size);
   return a;
 }
 
-struct string {
-  int length;
-  unsigned char chars[1];
-};
-
 int string_equal(struct string *s, struct string *t) {
   int i;
   if (s == t)
@@ -57,12 +390,55 @@ void flush() { fflush(stdout); }
 struct string consts[256];
 struct string empty = {0, ""};
 
+// Defined by a program compiled with --instrument only
+extern long tiger_counters[] __attribute__((weak));
+extern const long tiger_counter_count __attribute__((weak));
+extern const char tiger_counter_names[] __attribute__((weak));
+
+// Write the counters to $TIGER_PROFILE, tiger.prof by default
+void dump_profile() {
+  const char *path = getenv("TIGER_PROFILE");
+  FILE *out = fopen(path ? path : "tiger.prof", "wb");
+  const char *end = tiger_counter_names;
+  long i, length;
+  if (!out)
+    return;
+  for (i = 0; i < tiger_counter_count; i++)
+    end += strlen(end) + 1;
+  length = end - tiger_counter_names;
+  fwrite("TGPROF1", 1, 8, out);
+  fwrite(&tiger_counter_count, sizeof(long), 1, out);
+  fwrite(tiger_counters, sizeof(long), tiger_counter_count, out);
+  fwrite(&length, sizeof(long), 1, out);
+  fwrite(tiger_counter_names, 1, length, out);
+  fclose(out);
+}
+
 int main() {
   int i;
+  arena = (long *)mmap(NULL, (NURSERY_WORDS + 2 * OLD_WORDS) * sizeof(long),
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  cards = (long *)mmap(NULL, CARD_COUNT * sizeof(long), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  card_object = (long **)mmap(NULL, CARD_COUNT * sizeof(long *),
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (arena == MAP_FAILED || cards == MAP_FAILED || card_object == MAP_FAILED) {
+    printf("out of memory\n");
+    exit(1);
+  }
+  tiger_card_base = (long)cards - ((long)arena >> CARD_SHIFT) * sizeof(long);
+  young_ptr = arena;
+  young_limit = arena + NURSERY_WORDS;
+  old_base = old_top = young_limit;
+  old_limit = old_base + OLD_WORDS;
   for (i = 0; i < 256; i++) {
     consts[i].length = 1;
     consts[i].chars[0] = i;
   }
+  if (&tiger_counter_count)
+    atexit(dump_profile);
   return tigermain(0 /* static link */);
 }
 
@@ -83,38 +459,46 @@ struct string *chr(int i) {
 
 int size(struct string *s) { return s->length; }
 
-struct string *substring(struct string *s, int first, int n) {
-  if (first < 0 || first + n > s->length) {
-    printf("substring([%d],%d,%d) out of range\n", s->length, first, n);
+struct string *gc_substring(long s, int first, int n) {
+  struct string *t;
+  int i;
+  if (first < 0 || first + n > ((struct string *)s)->length) {
+    printf("substring([%d],%d,%d) out of range\n",
+           ((struct string *)s)->length, first, n);
     exit(1);
   }
   if (n == 1)
-    return consts + s->chars[first];
-  {
-    struct string *t = (struct string *)malloc(sizeof(int) + n);
-    int i;
-    t->length = n;
-    for (i = 0; i < n; i++)
-      t->chars[i] = s->chars[first + i];
-    return t;
-  }
+    return consts + ((struct string *)s)->chars[first];
+  c_roots[0] = &s;
+  c_root_count = 1;
+  t = (struct string *)gc_alloc(
+      (sizeof(int) + n + sizeof(long) - 1) / sizeof(long), RAW, NULL);
+  c_root_count = 0;
+  t->length = n;
+  for (i = 0; i < n; i++)
+    t->chars[i] = ((struct string *)s)->chars[first + i];
+  return t;
 }
 
-struct string *concat(struct string *a, struct string *b) {
-  if (a->length == 0)
-    return b;
-  else if (b->length == 0)
-    return a;
-  else {
-    int i, n = a->length + b->length;
-    struct string *t = (struct string *)malloc(sizeof(int) + n);
-    t->length = n;
-    for (i = 0; i < a->length; i++)
-      t->chars[i] = a->chars[i];
-    for (i = 0; i < b->length; i++)
-      t->chars[i + a->length] = b->chars[i];
-    return t;
-  }
+struct string *gc_concat(long a, long b) {
+  struct string *t;
+  int i, n = ((struct string *)a)->length + ((struct string *)b)->length;
+  if (((struct string *)a)->length == 0)
+    return (struct string *)b;
+  if (((struct string *)b)->length == 0)
+    return (struct string *)a;
+  c_roots[0] = &a;
+  c_roots[1] = &b;
+  c_root_count = 2;
+  t = (struct string *)gc_alloc(
+      (sizeof(int) + n + sizeof(long) - 1) / sizeof(long), RAW, NULL);
+  c_root_count = 0;
+  t->length = n;
+  for (i = 0; i < ((struct string *)a)->length; i++)
+    t->chars[i] = ((struct string *)a)->chars[i];
+  for (i = 0; i < ((struct string *)b)->length; i++)
+    t->chars[i + ((struct string *)a)->length] = ((struct string *)b)->chars[i];
+  return t;
 }
 
 int not(int i) { return !i; }
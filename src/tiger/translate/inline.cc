@@ -0,0 +1,207 @@
+#include "tiger/translate/inline.h"
+
+#include <vector>
+
+#include "tiger/translate/translate.h"
+
+namespace {
+
+// Bodies up to this many nodes are expanded when they call nothing
+constexpr int SMALL_LEAF_SIZE = 32;
+// and up to this many when they are called from a single site
+constexpr int SINGLE_SITE_SIZE = 256;
+
+using Bound = std::set<sym::Symbol *>;
+
+// The names an expression uses without declaring them
+class Scan {
+public:
+  int size_ = 0;
+  bool leaf_ = true;
+  // Whether no function or type is declared inside
+  bool closed_ = true;
+  std::set<sym::Symbol *> vars_;
+  std::set<sym::Symbol *> types_;
+  std::map<sym::Symbol *, int> calls_;
+
+  void ScanExp(absyn::Exp *exp, const Bound &bound);
+
+private:
+  void ScanVar(absyn::Var *var, const Bound &bound);
+  void ScanDecs(absyn::DecList *decs, Bound *bound);
+  void UseType(sym::Symbol *type) {
+    if (type)
+      types_.insert(type);
+  }
+};
+
+void Scan::ScanVar(absyn::Var *var, const Bound &bound) {
+  ++size_;
+  if (typeid(*var) == typeid(absyn::SimpleVar)) {
+    sym::Symbol *name = static_cast<absyn::SimpleVar *>(var)->sym_;
+    if (!bound.count(name))
+      vars_.insert(name);
+  } else if (typeid(*var) == typeid(absyn::FieldVar)) {
+    ScanVar(static_cast<absyn::FieldVar *>(var)->var_, bound);
+  } else {
+    auto *subscript = static_cast<absyn::SubscriptVar *>(var);
+    ScanVar(subscript->var_, bound);
+    ScanExp(subscript->subscript_, bound);
+  }
+}
+
+void Scan::ScanExp(absyn::Exp *exp, const Bound &bound) {
+  ++size_;
+  if (typeid(*exp) == typeid(absyn::VarExp)) {
+    ScanVar(static_cast<absyn::VarExp *>(exp)->var_, bound);
+  } else if (typeid(*exp) == typeid(absyn::CallExp)) {
+    auto *call = static_cast<absyn::CallExp *>(exp);
+    leaf_ = false;
+    calls_[call->func_]++;
+    if (!bound.count(call->func_))
+      vars_.insert(call->func_);
+    for (absyn::Exp *arg : call->args_->GetList())
+      ScanExp(arg, bound);
+  } else if (typeid(*exp) == typeid(absyn::OpExp)) {
+    auto *op = static_cast<absyn::OpExp *>(exp);
+    ScanExp(op->left_, bound);
+    ScanExp(op->right_, bound);
+  } else if (typeid(*exp) == typeid(absyn::RecordExp)) {
+    auto *record = static_cast<absyn::RecordExp *>(exp);
+    UseType(record->typ_);
+    for (absyn::EField *field : record->fields_->GetList())
+      ScanExp(field->exp_, bound);
+  } else if (typeid(*exp) == typeid(absyn::SeqExp)) {
+    for (absyn::Exp *item : static_cast<absyn::SeqExp *>(exp)->seq_->GetList())
+      ScanExp(item, bound);
+  } else if (typeid(*exp) == typeid(absyn::AssignExp)) {
+    auto *assign = static_cast<absyn::AssignExp *>(exp);
+    ScanVar(assign->var_, bound);
+    ScanExp(assign->exp_, bound);
+  } else if (typeid(*exp) == typeid(absyn::IfExp)) {
+    auto *ifExp = static_cast<absyn::IfExp *>(exp);
+    ScanExp(ifExp->test_, bound);
+    ScanExp(ifExp->then_, bound);
+    if (ifExp->elsee_)
+      ScanExp(ifExp->elsee_, bound);
+  } else if (typeid(*exp) == typeid(absyn::WhileExp)) {
+    auto *whileExp = static_cast<absyn::WhileExp *>(exp);
+    ScanExp(whileExp->test_, bound);
+    ScanExp(whileExp->body_, bound);
+  } else if (typeid(*exp) == typeid(absyn::ForExp)) {
+    auto *forExp = static_cast<absyn::ForExp *>(exp);
+    ScanExp(forExp->lo_, bound);
+    ScanExp(forExp->hi_, bound);
+    Bound inner = bound;
+    inner.insert(forExp->var_);
+    ScanExp(forExp->body_, inner);
+  } else if (typeid(*exp) == typeid(absyn::LetExp)) {
+    auto *let = static_cast<absyn::LetExp *>(exp);
+    Bound inner = bound;
+    ScanDecs(let->decs_, &inner);
+    ScanExp(let->body_, inner);
+  } else if (typeid(*exp) == typeid(absyn::ArrayExp)) {
+    auto *array = static_cast<absyn::ArrayExp *>(exp);
+    UseType(array->typ_);
+    ScanExp(array->size_, bound);
+    ScanExp(array->init_, bound);
+  }
+}
+
+void Scan::ScanDecs(absyn::DecList *decs, Bound *bound) {
+  for (absyn::Dec *dec : decs->GetList()) {
+    if (typeid(*dec) == typeid(absyn::VarDec)) {
+      auto *var = static_cast<absyn::VarDec *>(dec);
+      UseType(var->typ_);
+      ScanExp(var->init_, *bound);
+      bound->insert(var->var_);
+    } else if (typeid(*dec) == typeid(absyn::FunctionDec)) {
+      // Still scanned for the call sites in the nested bodies
+      closed_ = false;
+      auto *functions = static_cast<absyn::FunctionDec *>(dec)->functions_;
+      for (absyn::FunDec *function : functions->GetList())
+        bound->insert(function->name_);
+      for (absyn::FunDec *function : functions->GetList()) {
+        Bound inner = *bound;
+        for (absyn::Field *param : function->params_->GetList())
+          inner.insert(param->name_);
+        ScanExp(function->body_, inner);
+      }
+    } else {
+      closed_ = false;
+    }
+  }
+}
+
+} // namespace
+
+namespace tr {
+
+Inliner::Inliner(absyn::Exp *root) {
+  Scan scan;
+  scan.ScanExp(root, Bound());
+  sites_ = scan.calls_;
+}
+
+void Inliner::Record(absyn::FunDec *function, env::FunEntry *entry,
+                     env::VEnvPtr venv, env::TEnvPtr tenv) {
+  Bound formals;
+  for (absyn::Field *param : function->params_->GetList())
+    formals.insert(param->name_);
+  Scan scan;
+  scan.ScanExp(function->body_, formals);
+  if (!scan.closed_)
+    return;
+
+  Body body{function, scan.size_, scan.leaf_, {}, {}};
+  for (sym::Symbol *name : scan.vars_)
+    body.vars_[name] = venv->Look(name);
+  for (sym::Symbol *name : scan.types_)
+    body.types_[name] = tenv->Look(name);
+  bodies_[entry] = body;
+}
+
+absyn::FunDec *Inliner::Candidate(env::FunEntry *entry, env::VEnvPtr venv,
+                                  env::TEnvPtr tenv) {
+  auto it = bodies_.find(entry);
+  if (it == bodies_.end() || expanding_.count(entry))
+    return nullptr;
+  const Body &body = it->second;
+  bool small = body.leaf_ && body.size_ <= SMALL_LEAF_SIZE;
+  bool single = sites_[body.function_->name_] == 1 &&
+                body.size_ <= SINGLE_SITE_SIZE;
+  if (!small && !single)
+    return nullptr;
+
+  // A declaration at the call site may hide what the body refers to
+  for (auto &[name, var] : body.vars_)
+    if (venv->Look(name) != var)
+      return nullptr;
+  for (auto &[name, type] : body.types_)
+    if (tenv->Look(name) != type)
+      return nullptr;
+  return body.function_;
+}
+
+void Inliner::CountCall(env::FunEntry *entry, bool expanded) {
+  calls_[entry].translated_++;
+  if (expanded)
+    calls_[entry].expanded_++;
+}
+
+void Inliner::DropUnused(frame::Frags *frags) {
+  std::set<frame::Frame *> unused;
+  for (auto &[entry, calls] : calls_)
+    if (calls.expanded_ == calls.translated_)
+      unused.insert(entry->level_->frame_);
+
+  std::vector<frame::Frag *> dropped;
+  for (frame::Frag *frag : frags->GetList())
+    if (typeid(*frag) == typeid(frame::ProcFrag) &&
+        unused.count(static_cast<frame::ProcFrag *>(frag)->frame_))
+      dropped.push_back(frag);
+  for (frame::Frag *frag : dropped)
+    frags->Remove(frag);
+}
+
+} // namespace tr
@@ -0,0 +1,70 @@
+#ifndef TIGER_TRANSLATE_INLINE_H_
+#define TIGER_TRANSLATE_INLINE_H_
+
+#include <map>
+#include <set>
+
+#include "tiger/absyn/absyn.h"
+#include "tiger/env/env.h"
+#include "tiger/frame/frame.h"
+
+namespace tr {
+
+class Inliner {
+public:
+  /**
+   * @param root the whole program, to count the call sites of every name
+   */
+  explicit Inliner(absyn::Exp *root);
+
+  /**
+   * Remember the body of a translated function, so that calls translated
+   * later may expand it. Bodies declaring functions or types of their own
+   * are never expanded
+   * @param venv the scope the body was translated in, with the formals
+   * @param tenv the types of that scope
+   */
+  void Record(absyn::FunDec *function, env::FunEntry *entry,
+              env::VEnvPtr venv, env::TEnvPtr tenv);
+
+  /**
+   * @return the declaration to expand at a call in the given scope, nullptr
+   * to call the function. It is only expanded when it is small and calls
+   * nothing, or has a single call site, and every name it uses but does not
+   * declare still means what it meant at the declaration
+   */
+  absyn::FunDec *Candidate(env::FunEntry *entry, env::VEnvPtr venv,
+                           env::TEnvPtr tenv);
+
+  // The calls in a body being expanded may not expand it again
+  void BeginExpansion(env::FunEntry *entry) { expanding_.insert(entry); }
+  void EndExpansion(env::FunEntry *entry) { expanding_.erase(entry); }
+
+  void CountCall(env::FunEntry *entry, bool expanded);
+
+  // Drop the procedures every translated call expanded
+  void DropUnused(frame::Frags *frags);
+
+private:
+  struct Body {
+    absyn::FunDec *function_;
+    int size_;
+    bool leaf_;
+    // What the free names meant at the declaration
+    std::map<sym::Symbol *, env::EnvEntry *> vars_;
+    std::map<sym::Symbol *, type::Ty *> types_;
+  };
+  struct Calls {
+    int translated_ = 0;
+    int expanded_ = 0;
+  };
+
+  std::map<sym::Symbol *, int> sites_;
+  std::map<env::FunEntry *, Body> bodies_;
+  std::map<env::FunEntry *, Calls> calls_;
+  std::set<env::FunEntry *> expanding_;
+};
+
+} // namespace tr
+
+#endif
@@ -2,21 +2,23 @@
 
 #include <tiger/absyn/absyn.h>
 
+#include "tiger/codegen/stackmap.h"
 #include "tiger/env/env.h"
 #include "tiger/errormsg/errormsg.h"
 #include "tiger/frame/frame.h"
 #include "tiger/frame/temp.h"
 #include "tiger/frame/x64frame.h"
+#include "tiger/translate/inline.h"
 
 extern frame::Frags *frags;
 extern frame::RegManager *reg_manager;
 
 namespace tr {
 
-Access *Access::AllocLocal(Level *level, bool escape) {
+Access *Access::AllocLocal(Level *level, bool escape, bool pointer) {
   /* TODO: Put your lab5 code here */
   frame::Frame *frm = level->frame_;
-  frame::Access *acs = frm->AllocateLocal(escape);
+  frame::Access *acs = frm->AllocateLocal(escape, pointer);
   return new Access(level, acs);
 }
 
@@ -130,6 +132,107 @@ public:
     return cx_;
   }
 };
+
+// Whether the value of an expression is already known at translation time
+static bool IsConstant(Exp *exp, int *value) {
+  if (typeid(*exp) != typeid(ExExp))
+    return false;
+  tree::Exp *treeExp = static_cast<ExExp *>(exp)->exp_;
+  if (typeid(*treeExp) != typeid(tree::ConstExp))
+    return false;
+  *value = static_cast<tree::ConstExp *>(treeExp)->consti_;
+  return true;
+}
+
+// Expands the calls while the program is translated
+static Inliner *inliner = nullptr;
+
+// A function body being translated and the calls whose value it returns,
+// those calling the function itself restart the body instead
+struct TailContext {
+  env::FunEntry *entry_;
+  std::set<const absyn::CallExp *> calls_;
+  temp::Label *start_;
+  bool restarted_ = false;
+};
+static TailContext *tailContext = nullptr;
+
+static void FindTailCalls(absyn::Exp *exp,
+                          std::set<const absyn::CallExp *> *calls) {
+  if (typeid(*exp) == typeid(absyn::CallExp)) {
+    calls->insert(static_cast<absyn::CallExp *>(exp));
+  } else if (typeid(*exp) == typeid(absyn::SeqExp)) {
+    auto *seq = static_cast<absyn::SeqExp *>(exp);
+    if (!seq->seq_->GetList().empty())
+      FindTailCalls(seq->seq_->GetList().back(), calls);
+  } else if (typeid(*exp) == typeid(absyn::IfExp)) {
+    auto *ifExp = static_cast<absyn::IfExp *>(exp);
+    FindTailCalls(ifExp->then_, calls);
+    if (ifExp->elsee_)
+      FindTailCalls(ifExp->elsee_, calls);
+  } else if (typeid(*exp) == typeid(absyn::LetExp)) {
+    FindTailCalls(static_cast<absyn::LetExp *>(exp)->body_, calls);
+  }
+}
+
+static bool IsSimpleTest(absyn::Exp *exp);
+
+static bool IsSimpleVar(absyn::Var *var) {
+  if (typeid(*var) == typeid(absyn::SimpleVar))
+    return true;
+  if (typeid(*var) == typeid(absyn::FieldVar))
+    return IsSimpleVar(static_cast<absyn::FieldVar *>(var)->var_);
+  auto *subscript = static_cast<absyn::SubscriptVar *>(var);
+  return IsSimpleVar(subscript->var_) && IsSimpleTest(subscript->subscript_);
+}
+
+// Whether a loop test only reads and compares, so it costs little to
+// translate it once more for the test in front of the loop
+static bool IsSimpleTest(absyn::Exp *exp) {
+  if (typeid(*exp) == typeid(absyn::IntExp) ||
+      typeid(*exp) == typeid(absyn::NilExp))
+    return true;
+  if (typeid(*exp) == typeid(absyn::VarExp))
+    return IsSimpleVar(static_cast<absyn::VarExp *>(exp)->var_);
+  if (typeid(*exp) == typeid(absyn::OpExp)) {
+    auto *op = static_cast<absyn::OpExp *>(exp);
+    return IsSimpleTest(op->left_) && IsSimpleTest(op->right_);
+  }
+  if (typeid(*exp) == typeid(absyn::IfExp)) {
+    // The form of & and |
+    auto *ifExp = static_cast<absyn::IfExp *>(exp);
+    return IsSimpleTest(ifExp->test_) && IsSimpleTest(ifExp->then_) &&
+           (!ifExp->elsee_ || IsSimpleTest(ifExp->elsee_));
+  }
+  return false;
+}
+
+// Whether a value of the type may point to an object the collector moves
+static bool IsHeapPointer(type::Ty *ty) {
+  type::Ty *actual = ty->ActualTy();
+  return typeid(*actual) == typeid(type::RecordTy) ||
+         typeid(*actual) == typeid(type::ArrayTy) ||
+         typeid(*actual) == typeid(type::StringTy);
+}
+
+// The collector marks the stores of pointers into cards of 512 bytes
+constexpr int CARD_SHIFT = 9;
+
+// The descriptor the runtime finds the pointers of a record by: a string
+// with a '1' for each field holding one and a '0' for each other field
+static tree::Exp *PointerMap(type::RecordTy *record) {
+  static std::map<type::RecordTy *, temp::Label *> maps;
+  temp::Label *&map = maps[record];
+  if (!map) {
+    std::string fields;
+    for (type::Field *field : record->fields_->GetList())
+      fields += IsHeapPointer(field->ty_) ? '1' : '0';
+    map = temp::LabelFactory::NewLabel();
+    frags->PushBack(new frame::StringFrag(map, fields));
+  }
+  return new tree::NameExp(map);
+}
+
 void ProcEntryExit(Level *level, Exp *body) {
   frame::ProcFrag *fragments = new frame::ProcFrag(body->UnNx(), level->frame_);
   frags->PushBack(fragments);
@@ -140,9 +243,13 @@ void ProgTr::Translate() {
   temp::Label *mainLabel = temp::LabelFactory::NamedLabel("tigermain");
   frame::Frame *newFrame = frame::NewFrame(mainLabel, std::vector<bool>());
   Level *mainLevel = new Level(newFrame, main_level_.get());
+  Inliner programInliner(absyn_tree_->Root());
+  inliner = &programInliner;
   tr::ExpAndTy *treeExpAndTy = absyn_tree_->Translate(
       venv_.get(), tenv_.get(), mainLevel, nullptr, errormsg_.get());
   ProcEntryExit(mainLevel, treeExpAndTy->exp_);
+  programInliner.DropUnused(frags);
+  inliner = nullptr;
 }
 
 } // namespace tr
@@ -220,10 +327,11 @@ tr::ExpAndTy *FieldVar::Translate(env::VEnvPtr varEnvironment,
   int fieldIndex = 0;
   for (type::Field *field : recordType->fields_->GetList()) {
     if (field->name_->Name() == sym_->Name()) {
-      tree::Exp *fieldExp = new tree::MemExp(new tree::BinopExp(
-          tree::PLUS_OP, variableExp,
-          new tree::ConstExp(fieldIndex *
-                             currentLevel->frame_->GetWordSize())));
+      tree::Exp *fieldExp = new tree::MemExp(
+          tree::Binop(tree::PLUS_OP, variableExp,
+                      new tree::ConstExp(fieldIndex *
+                                         currentLevel->frame_->GetWordSize())),
+          tr::IsHeapPointer(field->ty_));
       return new tr::ExpAndTy(new tr::ExExp(fieldExp), field->ty_->ActualTy());
     }
     fieldIndex++;
@@ -262,11 +370,12 @@ tr::ExpAndTy *SubscriptVar::Translate(env::VEnvPtr varEnvironment,
 
   type::ArrayTy *arrayType =
       static_cast<type::ArrayTy *>(variableType->ActualTy());
-  tree::Exp *arrayExp = new tree::MemExp(new tree::BinopExp(
-      tree::PLUS_OP, variableExp,
-      new tree::BinopExp(
-          tree::MUL_OP, subscriptExp,
-          new tree::ConstExp(currentLevel->frame_->GetWordSize()))));
+  tree::Exp *arrayExp = new tree::MemExp(
+      tree::Binop(
+          tree::PLUS_OP, variableExp,
+          tree::Binop(tree::MUL_OP, subscriptExp,
+                      new tree::ConstExp(currentLevel->frame_->GetWordSize()))),
+      tr::IsHeapPointer(arrayType->ty_));
   return new tr::ExpAndTy(new tr::ExExp(arrayExp), arrayType->ty_);
 }
 
@@ -303,6 +412,91 @@ tr::ExpAndTy *StringExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
                           type::StringTy::Instance());
 }
 
+static tr::ExpAndTy *RestartBody(const CallExp *call, env::FunEntry *funcEntry,
+                                 env::VEnvPtr venv, env::TEnvPtr tenv,
+                                 tr::Level *level, err::ErrorMsg *errormsg) {
+  // Every argument is evaluated before any formal is overwritten
+  tree::Stm *restartStm = nullptr;
+  std::vector<temp::Temp *> values;
+  for (Exp *arg : call->args_->GetList()) {
+    temp::Temp *value = temp::TempFactory::NewTemp();
+    tree::Stm *moveStm = new tree::MoveStm(
+        new tree::TempExp(value),
+        arg->Translate(venv, tenv, level, nullptr, errormsg)->exp_->UnEx());
+    restartStm = restartStm ? new tree::SeqStm(restartStm, moveStm) : moveStm;
+    values.push_back(value);
+  }
+  auto accessIterator =
+      level->frame_->formalAccesses_.cbegin() + 1; // The static link stays
+  for (temp::Temp *value : values) {
+    tree::Stm *moveStm = new tree::MoveStm(
+        frame::GetCurrentAccessExpression(*accessIterator, level->frame_),
+        new tree::TempExp(value));
+    restartStm = restartStm ? new tree::SeqStm(restartStm, moveStm) : moveStm;
+    accessIterator++;
+  }
+
+  temp::Label *start = tr::tailContext->start_;
+  tr::tailContext->restarted_ = true;
+  tree::Stm *jumpStm = new tree::JumpStm(
+      new tree::NameExp(start), new std::vector<temp::Label *>{start});
+  restartStm = restartStm ? new tree::SeqStm(restartStm, jumpStm) : jumpStm;
+  if (typeid(*funcEntry->result_->ActualTy()) == typeid(type::VoidTy))
+    return new tr::ExpAndTy(new tr::NxExp(restartStm), funcEntry->result_);
+  return new tr::ExpAndTy(
+      new tr::ExExp(new tree::EseqExp(restartStm, new tree::ConstExp(0))),
+      funcEntry->result_);
+}
+
+static tr::ExpAndTy *ExpandCall(const CallExp *call, FunDec *function,
+                                env::FunEntry *funcEntry, env::VEnvPtr venv,
+                                env::TEnvPtr tenv, tr::Level *level,
+                                err::ErrorMsg *errormsg) {
+  // The arguments are evaluated in order in the scope of the call, each into
+  // a local of the caller standing for its formal
+  tree::Stm *argStm = nullptr;
+  std::vector<tr::Access *> formalAccesses;
+  auto paramIterator = function->params_->GetList().cbegin();
+  auto formalTypeIterator = funcEntry->formals_->GetList().cbegin();
+  for (Exp *arg : call->args_->GetList()) {
+    tr::Access *access =
+        tr::Access::AllocLocal(level, (*paramIterator)->escape_,
+                               tr::IsHeapPointer(*formalTypeIterator++));
+    tree::Stm *moveStm = new tree::MoveStm(
+        frame::GetCurrentAccessExpression(access->access_, level->frame_),
+        arg->Translate(venv, tenv, level, nullptr, errormsg)->exp_->UnEx());
+    argStm = argStm ? new tree::SeqStm(argStm, moveStm) : moveStm;
+    formalAccesses.push_back(access);
+    paramIterator++;
+  }
+
+  venv->BeginScope();
+  paramIterator = function->params_->GetList().cbegin();
+  formalTypeIterator = funcEntry->formals_->GetList().cbegin();
+  for (tr::Access *access : formalAccesses) {
+    venv->Enter((*paramIterator)->name_,
+                new env::VarEntry(access, *formalTypeIterator));
+    paramIterator++;
+    formalTypeIterator++;
+  }
+  tr::inliner->BeginExpansion(funcEntry);
+  tr::ExpAndTy *bodyExpTy =
+      function->body_->Translate(venv, tenv, level, nullptr, errormsg);
+  tr::inliner->EndExpansion(funcEntry);
+  venv->EndScope();
+
+  if (typeid(*funcEntry->result_->ActualTy()) == typeid(type::VoidTy)) {
+    tree::Stm *bodyStm = bodyExpTy->exp_->UnNx();
+    return new tr::ExpAndTy(
+        new tr::NxExp(argStm ? new tree::SeqStm(argStm, bodyStm) : bodyStm),
+        funcEntry->result_);
+  }
+  tree::Exp *bodyExp = bodyExpTy->exp_->UnEx();
+  return new tr::ExpAndTy(
+      new tr::ExExp(argStm ? new tree::EseqExp(argStm, bodyExp) : bodyExp),
+      funcEntry->result_);
+}
+
 tr::ExpAndTy *CallExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
                                  tr::Level *level, temp::Label *label,
                                  err::ErrorMsg *errormsg) const {
@@ -319,6 +513,19 @@ tr::ExpAndTy *CallExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
   // Cast the found entry to FunEntry
   env::FunEntry *funcEntry = static_cast<env::FunEntry *>(entry);
 
+  // A function returning what it returns itself loops instead of recursing
+  if (tr::tailContext && tr::tailContext->entry_ == funcEntry &&
+      tr::tailContext->calls_.count(this))
+    return RestartBody(this, funcEntry, venv, tenv, level, errormsg);
+
+  // Expand the body in place of small or once called functions
+  if (funcEntry->label_) {
+    absyn::FunDec *function = tr::inliner->Candidate(funcEntry, venv, tenv);
+    tr::inliner->CountCall(funcEntry, function != nullptr);
+    if (function)
+      return ExpandCall(this, function, funcEntry, venv, tenv, level, errormsg);
+  }
+
   // Prepare the arguments list for the function call
   tree::ExpList *args = new tree::ExpList();
   tree::Exp *funcExp;
@@ -330,6 +537,7 @@ tr::ExpAndTy *CallExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
       // The calling function is the parent of the called function; use the
       // current frame pointer
       args->Append(level->frame_->GetFrameAddress());
+      level->frame_->frameAddressCallees_.insert(funcEntry->label_);
     } else {
       // The calling function is not the parent; follow static links to find the
       // correct frame
@@ -376,7 +584,8 @@ tr::ExpAndTy *CallExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
                    static_cast<int>(reg_manager->ArgRegs()->GetList().size()));
 
   // Create the call expression
-  tree::Exp *callExp = new tree::CallExp(funcExp, args);
+  tree::Exp *callExp = new tree::CallExp(
+      funcExp, args, tr::IsHeapPointer(funcEntry->result_));
   return new tr::ExpAndTy(new tr::ExExp(callExp), funcEntry->result_);
 }
 
@@ -387,76 +596,82 @@ tr::ExpAndTy *OpExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
       left_->Translate(venv, tenv, level, label, errormsg);
   tr::ExpAndTy *rightExpressionType =
       right_->Translate(venv, tenv, level, label, errormsg);
-  tree::Exp *leftExpression = leftExpressionType->exp_->UnEx();
-  tree::Exp *rightExpression = rightExpressionType->exp_->UnEx();
+  if (oper_ == absyn::AND_OP || oper_ == absyn::OR_OP) {
+    bool isAnd = oper_ == absyn::AND_OP;
+    // A known left operand decides on its own whether the right one runs
+    int leftValue;
+    if (tr::IsConstant(leftExpressionType->exp_, &leftValue)) {
+      if (isAnd == (leftValue != 0))
+        return new tr::ExpAndTy(rightExpressionType->exp_,
+                                type::IntTy::Instance());
+      return new tr::ExpAndTy(new tr::ExExp(new tree::ConstExp(isAnd ? 0 : 1)),
+                              type::IntTy::Instance());
+    }
 
-  if (oper_ == absyn::AND_OP) {
-    tr::Cx conditionalExp = leftExpressionType->exp_->UnCx(errormsg);
-    tr::ExpAndTy *falseExpressionType = new tr::ExpAndTy(
-        new tr::ExExp(new tree::ConstExp(0)), type::IntTy::Instance());
-    temp::Label *convergenceLabel = temp::LabelFactory::NewLabel();
-    std::vector<temp::Label *> *convergenceJumps =
-        new std::vector<temp::Label *>{convergenceLabel};
-    temp::Temp *resultRegister = temp::TempFactory::NewTemp();
-    tree::Exp *resultRegisterExp = new tree::TempExp(resultRegister);
-    tree::Exp *conditionalExpression = new tree::EseqExp(
-        conditionalExp.stm_,
-        new tree::EseqExp(
-            new tree::LabelStm(*(conditionalExp.trues_.GetFront())),
-            new tree::EseqExp(
-                new tree::MoveStm(resultRegisterExp, rightExpression),
-                new tree::EseqExp(
-                    new tree::JumpStm(new tree::NameExp(convergenceLabel),
-                                      convergenceJumps),
-                    new tree::EseqExp(
-                        new tree::LabelStm(
-                            *(conditionalExp.falses_.GetFront())),
-                        new tree::EseqExp(
-                            new tree::MoveStm(
-                                resultRegisterExp,
-                                falseExpressionType->exp_->UnEx()),
-                            new tree::EseqExp(
-                                new tree::LabelStm(convergenceLabel),
-                                resultRegisterExp)))))));
-    return new tr::ExpAndTy(new tr::ExExp(conditionalExpression),
-                            rightExpressionType->ty_);
-  }
+    tr::Cx leftCx = leftExpressionType->exp_->UnCx(errormsg);
+    temp::Label *rightLabel = temp::LabelFactory::NewLabel();
+    tr::PatchList &runsRight = isAnd ? leftCx.trues_ : leftCx.falses_;
+    tr::PatchList &decided = isAnd ? leftCx.falses_ : leftCx.trues_;
+    runsRight.DoPatch(rightLabel);
+
+    // Conditions stay jumps, so a test branches on each comparison once
+    int rightValue;
+    bool rightIsCondition =
+        typeid(*rightExpressionType->exp_) == typeid(tr::CxExp) ||
+        (tr::IsConstant(rightExpressionType->exp_, &rightValue) &&
+         (rightValue == 0 || rightValue == 1));
+    if (rightIsCondition) {
+      tr::Cx rightCx = rightExpressionType->exp_->UnCx(errormsg);
+      tree::Stm *stm = new tree::SeqStm(
+          leftCx.stm_,
+          new tree::SeqStm(new tree::LabelStm(rightLabel), rightCx.stm_));
+      if (isAnd)
+        return new tr::ExpAndTy(
+            new tr::CxExp(rightCx.trues_,
+                          tr::PatchList::JoinPatch(decided, rightCx.falses_),
+                          stm),
+            type::IntTy::Instance());
+      return new tr::ExpAndTy(
+          new tr::CxExp(tr::PatchList::JoinPatch(decided, rightCx.trues_),
+                        rightCx.falses_, stm),
+          type::IntTy::Instance());
+    }
 
-  if (oper_ == absyn::OR_OP) {
-    tr::Cx conditionalExp = leftExpressionType->exp_->UnCx(errormsg);
-    tr::ExpAndTy *falseExpressionType = new tr::ExpAndTy(
-        new tr::ExExp(new tree::ConstExp(1)), type::IntTy::Instance());
+    // Any other right operand is the value of the whole expression when it
+    // runs
+    temp::Label *decidedLabel = temp::LabelFactory::NewLabel();
     temp::Label *convergenceLabel = temp::LabelFactory::NewLabel();
-    std::vector<temp::Label *> *convergenceJumps =
-        new std::vector<temp::Label *>{convergenceLabel};
-    temp::Temp *resultRegister = temp::TempFactory::NewTemp();
-    tree::Exp *resultRegisterExp = new tree::TempExp(resultRegister);
+    decided.DoPatch(decidedLabel);
+    tree::Exp *resultRegisterExp =
+        new tree::TempExp(temp::TempFactory::NewTemp());
     tree::Exp *conditionalExpression = new tree::EseqExp(
-        conditionalExp.stm_,
+        leftCx.stm_,
         new tree::EseqExp(
-            new tree::LabelStm(*(conditionalExp.trues_.GetFront())),
+            new tree::LabelStm(rightLabel),
             new tree::EseqExp(
-                new tree::MoveStm(
-                    resultRegisterExp,
-                    falseExpressionType->exp_->UnEx()), // represents 1
+                new tree::MoveStm(resultRegisterExp,
+                                  rightExpressionType->exp_->UnEx()),
                 new tree::EseqExp(
-                    new tree::JumpStm(new tree::NameExp(convergenceLabel),
-                                      convergenceJumps),
+                    new tree::JumpStm(
+                        new tree::NameExp(convergenceLabel),
+                        new std::vector<temp::Label *>{convergenceLabel}),
                     new tree::EseqExp(
-                        new tree::LabelStm(
-                            *(conditionalExp.falses_.GetFront())),
+                        new tree::LabelStm(decidedLabel),
                         new tree::EseqExp(
                             new tree::MoveStm(
                                 resultRegisterExp,
-                                rightExpression), //  falseExpressionType->exp_->UnEx()
+                                new tree::ConstExp(isAnd ? 0 : 1)),
                             new tree::EseqExp(
                                 new tree::LabelStm(convergenceLabel),
                                 resultRegisterExp)))))));
     return new tr::ExpAndTy(new tr::ExExp(conditionalExpression),
-                            falseExpressionType->ty_);
+                            type::IntTy::Instance());
   }
-  tree::CjumpStm *conditionalJumpStatement;
-  tr::Exp *finalExpression;
+
+  tree::Exp *leftExpression = leftExpressionType->exp_->UnEx();
+  tree::Exp *rightExpression = rightExpressionType->exp_->UnEx();
+  tree::CjumpStm *conditionalJumpStatement = nullptr;
+  tr::Exp *finalExpression = nullptr;
 
   // Check for type compatibility between left and right expressions
   if (leftExpressionType->ty_->IsSameType(rightExpressionType->ty_)) {
@@ -474,9 +689,9 @@ tr::ExpAndTy *OpExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
         break;
       case absyn::NEQ_OP:
         finalExpression = new tr::ExExp(
-            new tree::BinopExp(tree::MINUS_OP, new tree::ConstExp(1),
-                               frame::CreateExternalFunctionCall(
-                                   stringComparisonFunction, argumentList)));
+            tree::Binop(tree::MINUS_OP, new tree::ConstExp(1),
+                        frame::CreateExternalFunctionCall(
+                            stringComparisonFunction, argumentList)));
         break;
       default:
         errormsg->Error(pos_, "unexpected binary token %d", oper_);
@@ -488,19 +703,19 @@ tr::ExpAndTy *OpExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
       switch (oper_) {
       case absyn::PLUS_OP:
         finalExpression = new tr::ExExp(
-            new tree::BinopExp(tree::PLUS_OP, leftExpression, rightExpression));
+            tree::Binop(tree::PLUS_OP, leftExpression, rightExpression));
         break;
       case absyn::MINUS_OP:
-        finalExpression = new tr::ExExp(new tree::BinopExp(
+        finalExpression = new tr::ExExp(tree::Binop(
             tree::MINUS_OP, leftExpression, rightExpression));
         break;
       case absyn::TIMES_OP:
         finalExpression = new tr::ExExp(
-            new tree::BinopExp(tree::MUL_OP, leftExpression, rightExpression));
+            tree::Binop(tree::MUL_OP, leftExpression, rightExpression));
         break;
       case absyn::DIVIDE_OP:
         finalExpression = new tr::ExExp(
-            new tree::BinopExp(tree::DIV_OP, leftExpression, rightExpression));
+            tree::Binop(tree::DIV_OP, leftExpression, rightExpression));
         break;
       case absyn::EQ_OP:
         conditionalJumpStatement = new tree::CjumpStm(
@@ -565,6 +780,16 @@ tr::ExpAndTy *OpExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
                             type::VoidTy::Instance());
   }
 
+  // A comparison of two constants needs no branch, the enclosing test
+  // folds the value instead
+  if (conditionalJumpStatement &&
+      typeid(*leftExpression) == typeid(tree::ConstExp) &&
+      typeid(*rightExpression) == typeid(tree::ConstExp))
+    finalExpression = new tr::ExExp(new tree::ConstExp(tree::EvalRel(
+        conditionalJumpStatement->op_,
+        static_cast<tree::ConstExp *>(leftExpression)->consti_,
+        static_cast<tree::ConstExp *>(rightExpression)->consti_)));
+
   return new tr::ExpAndTy(finalExpression, type::IntTy::Instance());
 }
 
@@ -589,9 +814,11 @@ tr::ExpAndTy *RecordExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
   int fieldCount = recordFields.size();
   tree::Exp *recordExp = new tree::TempExp(temp::TempFactory::NewTemp());
   tree::ExpList *allocArgs = new tree::ExpList(
-      {new tree::ConstExp(fieldCount * level->frame_->GetWordSize())});
+      {new tree::ConstExp(fieldCount * level->frame_->GetWordSize()),
+       tr::PointerMap(recordType)});
   tree::Stm *allocStm = new tree::MoveStm(
-      recordExp, frame::CreateExternalFunctionCall("alloc_record", allocArgs));
+      recordExp,
+      frame::CreateExternalFunctionCall("alloc_record", allocArgs, true));
 
   if (recordFields.empty() && exprFields.empty()) {
     return new tr::ExpAndTy(
@@ -602,6 +829,19 @@ tr::ExpAndTy *RecordExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
                             type::VoidTy::Instance());
   }
 
+  // The fields are evaluated before the record is allocated, so the record
+  // is still new when they are stored and the stores need no write barrier
+  tree::Stm *evalStm = nullptr;
+  auto fieldValue = [&evalStm](tree::Exp *value) -> tree::Exp * {
+    if (typeid(*value) == typeid(tree::ConstExp) ||
+        typeid(*value) == typeid(tree::NameExp))
+      return value;
+    temp::Temp *reg = temp::TempFactory::NewTemp();
+    tree::Stm *moveStm = new tree::MoveStm(new tree::TempExp(reg), value);
+    evalStm = evalStm ? new tree::SeqStm(moveStm, evalStm) : moveStm;
+    return new tree::TempExp(reg);
+  };
+
   type::Field *lastField = recordFields.back();
   EField *lastEField = exprFields.back();
   tr::ExpAndTy *lastEFieldExpTy =
@@ -613,10 +853,10 @@ tr::ExpAndTy *RecordExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
   }
 
   tree::Stm *stm = new tree::MoveStm(
-      new tree::MemExp(new tree::BinopExp(
+      new tree::MemExp(tree::Binop(
           tree::PLUS_OP, recordExp,
           new tree::ConstExp((--fieldCount) * level->frame_->GetWordSize()))),
-      lastEFieldExpTy->exp_->UnEx());
+      fieldValue(lastEFieldExpTy->exp_->UnEx()));
   auto fieldIt = ++recordFields.rbegin();
   auto eFieldIt = ++exprFields.rbegin();
   for (; fieldIt != recordFields.rend() && eFieldIt != exprFields.rend();
@@ -631,11 +871,11 @@ tr::ExpAndTy *RecordExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
     tree::Exp *eFieldExp = eFieldExpTy->exp_->UnEx();
     stm = new tree::SeqStm(
         new tree::MoveStm(
-            new tree::MemExp(new tree::BinopExp(
+            new tree::MemExp(tree::Binop(
                 tree::PLUS_OP, recordExp,
                 new tree::ConstExp((--fieldCount) *
                                    level->frame_->GetWordSize()))),
-            eFieldExpTy->exp_->UnEx()),
+            fieldValue(eFieldExpTy->exp_->UnEx())),
         stm);
   }
 
@@ -646,6 +886,8 @@ tr::ExpAndTy *RecordExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
   }
 
   stm = new tree::SeqStm(allocStm, stm);
+  if (evalStm)
+    stm = new tree::SeqStm(evalStm, stm);
   tree::Exp *resultExp = new tree::EseqExp(stm, recordExp);
 
   return new tr::ExpAndTy(new tr::ExExp(resultExp), recordType);
@@ -685,6 +927,32 @@ tr::ExpAndTy *AssignExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
   tree::Exp *varExp = varExpAndTy->exp_->UnEx();
   tree::Exp *expExp = expExpAndTy->exp_->UnEx();
   tree::Stm *assignStm = new tree::MoveStm(varExp, expExp);
+
+  // A pointer stored into an object marks the card of the field, so a
+  // collection of the nursery finds it in an object promoted before
+  if (cg::StackMaps::Emitting() && typeid(*var_) != typeid(SimpleVar) &&
+      tr::IsHeapPointer(varExpAndTy->ty_) &&
+      typeid(*expExp) != typeid(tree::ConstExp) &&
+      typeid(*varExp) == typeid(tree::MemExp)) {
+    auto *fieldExp = static_cast<tree::MemExp *>(varExp);
+    temp::Temp *address = temp::TempFactory::NewTemp();
+    tree::Exp *card = tree::Binop(
+        tree::PLUS_OP,
+        new tree::MemExp(new tree::NameExp(
+            temp::LabelFactory::NamedLabel("tiger_card_base"))),
+        tree::Binop(tree::MUL_OP,
+                    new tree::BinopExp(tree::RSHIFT_OP,
+                                       new tree::TempExp(address),
+                                       new tree::ConstExp(tr::CARD_SHIFT)),
+                    new tree::ConstExp(level->frame_->GetWordSize())));
+    assignStm = new tree::SeqStm(
+        new tree::MoveStm(new tree::TempExp(address), fieldExp->exp_),
+        new tree::SeqStm(
+            new tree::MoveStm(new tree::MemExp(new tree::TempExp(address),
+                                               fieldExp->pointer_),
+                              expExp),
+            new tree::MoveStm(new tree::MemExp(card), new tree::ConstExp(1))));
+  }
   return new tr::ExpAndTy(new tr::NxExp(assignStm), type::VoidTy::Instance());
 }
 
@@ -695,6 +963,8 @@ tr::ExpAndTy *IfExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
       test_->Translate(venv, tenv, level, label, errormsg);
   tr::ExpAndTy *thenExpTy =
       then_->Translate(venv, tenv, level, label, errormsg);
+  int testValue;
+  bool constantTest = tr::IsConstant(testExpTy->exp_, &testValue);
   tr::Cx testCx = testExpTy->exp_->UnCx(errormsg);
 
   temp::Label *trueLabel = temp::LabelFactory::NewLabel();
@@ -710,6 +980,13 @@ tr::ExpAndTy *IfExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
                               type::VoidTy::Instance());
     }
 
+    // Drop the arm that can never run
+    if (constantTest)
+      return new tr::ExpAndTy(
+          new tr::NxExp(testValue ? thenExpTy->exp_->UnNx()
+                                  : new tree::ExpStm(new tree::ConstExp(0))),
+          type::VoidTy::Instance());
+
     tree::Stm *stm = new tree::SeqStm(
         testCx.stm_,
         new tree::SeqStm(new tree::LabelStm(trueLabel),
@@ -726,6 +1003,10 @@ tr::ExpAndTy *IfExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
                               type::VoidTy::Instance());
     }
 
+    if (constantTest)
+      return new tr::ExpAndTy(testValue ? thenExpTy->exp_ : elseExpTy->exp_,
+                              thenExpTy->ty_);
+
     temp::Label *convergeLabel = temp::LabelFactory::NewLabel();
     std::vector<temp::Label *> *convergeJumps =
         new std::vector<temp::Label *>{convergeLabel};
@@ -777,9 +1058,10 @@ tr::ExpAndTy *WhileExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
                                   err::ErrorMsg *errormsg) const {
   tr::ExpAndTy *testExpTy =
       test_->Translate(venv, tenv, level, label, errormsg);
+  int testValue;
+  bool constantTest = tr::IsConstant(testExpTy->exp_, &testValue);
   tr::Cx testCx = testExpTy->exp_->UnCx(errormsg);
 
-  temp::Label *testLabel = temp::LabelFactory::NewLabel();
   temp::Label *bodyLabel = temp::LabelFactory::NewLabel();
   temp::Label *doneLabel = temp::LabelFactory::NewLabel();
   tr::ExpAndTy *bodyExpTy =
@@ -791,6 +1073,51 @@ tr::ExpAndTy *WhileExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
                             type::VoidTy::Instance());
   }
 
+  // A loop that never runs is dropped, one that never stops skips the test
+  if (constantTest && !testValue)
+    return new tr::ExpAndTy(
+        new tr::NxExp(new tree::ExpStm(new tree::ConstExp(0))),
+        type::VoidTy::Instance());
+  if (constantTest) {
+    tree::Stm *loopStm = new tree::SeqStm(
+        new tree::LabelStm(bodyLabel),
+        new tree::SeqStm(
+            bodyExpTy->exp_->UnNx(),
+            new tree::SeqStm(
+                new tree::JumpStm(new tree::NameExp(bodyLabel),
+                                  new std::vector<temp::Label *>{bodyLabel}),
+                new tree::LabelStm(doneLabel))));
+    return new tr::ExpAndTy(new tr::NxExp(loopStm), type::VoidTy::Instance());
+  }
+
+  if (tr::IsSimpleTest(test_)) {
+    // Test once in front of the loop and again at the bottom, where the
+    // test branches back to the body while it holds
+    tr::Cx bottomCx = test_->Translate(venv, tenv, level, label, errormsg)
+                          ->exp_->UnCx(errormsg);
+    bottomCx.trues_.DoPatch(bodyLabel);
+    bottomCx.falses_.DoPatch(doneLabel);
+    // A single comparison in front is negated, so the body follows it
+    if (typeid(*testCx.stm_) == typeid(tree::CjumpStm)) {
+      auto *guard = static_cast<tree::CjumpStm *>(testCx.stm_);
+      guard->op_ = tree::NotRel(guard->op_);
+      testCx.trues_.DoPatch(doneLabel);
+      testCx.falses_.DoPatch(bodyLabel);
+    } else {
+      testCx.trues_.DoPatch(bodyLabel);
+      testCx.falses_.DoPatch(doneLabel);
+    }
+    tree::Stm *loopStm = new tree::SeqStm(
+        testCx.stm_,
+        new tree::SeqStm(
+            new tree::LabelStm(bodyLabel),
+            new tree::SeqStm(bodyExpTy->exp_->UnNx(),
+                             new tree::SeqStm(bottomCx.stm_,
+                                              new tree::LabelStm(doneLabel)))));
+    return new tr::ExpAndTy(new tr::NxExp(loopStm), type::VoidTy::Instance());
+  }
+
+  temp::Label *testLabel = temp::LabelFactory::NewLabel();
   testCx.trues_.DoPatch(bodyLabel);
   testCx.falses_.DoPatch(doneLabel);
 
@@ -814,20 +1141,22 @@ tr::ExpAndTy *WhileExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
 tr::ExpAndTy *ForExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
                                 tr::Level *level, temp::Label *label,
                                 err::ErrorMsg *errormsg) const {
-  sym::Symbol *limitSymbol = sym::Symbol::UniqueSymbol("limit");
-
   DecList *declarations = new DecList();
-  VarDec *hiDec = new VarDec(hi_->pos_, limitSymbol, nullptr, hi_);
-  hiDec->escape_ = false;
-  declarations->Prepend(hiDec);
+  // A constant limit is compared with directly, the loop tests it twice
+  Exp *limitExp = hi_;
+  if (typeid(*hi_) != typeid(IntExp)) {
+    sym::Symbol *limitSymbol = sym::Symbol::UniqueSymbol("limit");
+    VarDec *hiDec = new VarDec(hi_->pos_, limitSymbol, nullptr, hi_);
+    hiDec->escape_ = false;
+    declarations->Prepend(hiDec);
+    limitExp = new VarExp(pos_, new SimpleVar(pos_, limitSymbol));
+  }
   VarDec *loDec = new VarDec(lo_->pos_, var_, nullptr, lo_);
   loDec->escape_ = escape_;
   declarations->Prepend(loDec);
 
   SimpleVar *iteratorVar = new SimpleVar(pos_, var_);
-  SimpleVar *limitVar = new SimpleVar(pos_, limitSymbol);
   VarExp *iteratorExp = new VarExp(pos_, iteratorVar);
-  VarExp *limitExp = new VarExp(pos_, limitVar);
 
   OpExp *testExp = new OpExp(pos_, LE_OP, iteratorExp, limitExp);
   ExpList *bodyExps = new ExpList();
@@ -856,6 +1185,9 @@ tr::ExpAndTy *LetExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
                                 err::ErrorMsg *errormsg) const {
   venv->BeginScope();
   tenv->BeginScope();
+  // Escaping variables of this scope are dead once the body is evaluated, so
+  // their frame slots can be shared with the following scopes
+  int liveLocals = level->frame_->liveLocalCount_;
 
   auto decIterator = decs_->GetList().begin();
   if (decIterator == decs_->GetList().end()) {
@@ -864,11 +1196,13 @@ tr::ExpAndTy *LetExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
     if (typeid(*bodyExpTy->exp_) == typeid(tr::NxExp)) {
       venv->EndScope();
       tenv->EndScope();
+      level->frame_->liveLocalCount_ = liveLocals;
       return new tr::ExpAndTy(bodyExpTy->exp_, type::VoidTy::Instance());
     } else {
       tree::Exp *bodyExp = bodyExpTy->exp_->UnEx();
       venv->EndScope();
       tenv->EndScope();
+      level->frame_->liveLocalCount_ = liveLocals;
       return new tr::ExpAndTy(new tr::ExExp(bodyExp), bodyExpTy->ty_);
     }
   }
@@ -889,12 +1223,14 @@ tr::ExpAndTy *LetExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
     tree::Stm *seqStm = new tree::SeqStm(decStm, bodyStm);
     venv->EndScope();
     tenv->EndScope();
+    level->frame_->liveLocalCount_ = liveLocals;
     return new tr::ExpAndTy(new tr::NxExp(seqStm), type::VoidTy::Instance());
   } else {
     tree::Exp *bodyExp = bodyExpTy->exp_->UnEx();
     tree::Exp *eseqExp = new tree::EseqExp(decStm, bodyExp);
     venv->EndScope();
     tenv->EndScope();
+    level->frame_->liveLocalCount_ = liveLocals;
     return new tr::ExpAndTy(new tr::ExExp(eseqExp), bodyExpTy->ty_);
   }
 }
@@ -929,10 +1265,12 @@ tr::ExpAndTy *ArrayExp::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
   }
 
   tree::Exp *registerExp = new tree::TempExp(temp::TempFactory::NewTemp());
-  tree::ExpList *callArgs =
-      new tree::ExpList({sizeExpTy->exp_->UnEx(), initExpTy->exp_->UnEx()});
+  tree::ExpList *callArgs = new tree::ExpList(
+      {sizeExpTy->exp_->UnEx(), initExpTy->exp_->UnEx(),
+       new tree::ConstExp(tr::IsHeapPointer(arrayType->ty_))});
   tree::Stm *initStm = new tree::MoveStm(
-      registerExp, frame::CreateExternalFunctionCall("init_array", callArgs));
+      registerExp,
+      frame::CreateExternalFunctionCall("init_array", callArgs, true));
   tree::Exp *resultExp = new tree::EseqExp(initStm, registerExp);
   return new tr::ExpAndTy(new tr::ExExp(resultExp), arrayType);
 }
@@ -970,8 +1308,11 @@ tr::Exp *FunctionDec::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
     std::vector<bool> formalEscapes = std::vector<bool>{true};
     for (auto param : function->params_->GetList())
       formalEscapes.push_back(param->escape_);
+    std::vector<bool> formalPointers = std::vector<bool>{false};
+    for (type::Ty *formalType : formalTypes->GetList())
+      formalPointers.push_back(tr::IsHeapPointer(formalType));
 
-    newFrame = frame::NewFrame(functionLabel, formalEscapes);
+    newFrame = frame::NewFrame(functionLabel, formalEscapes, formalPointers);
     newLevel = new tr::Level(newFrame, level);
     formalAccesses = newFrame->formalAccesses_;
 
@@ -1004,8 +1345,14 @@ tr::Exp *FunctionDec::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
                                     *formalTypeIterator));
     }
 
+    tr::TailContext tailContext{functionEntry, {},
+                                temp::LabelFactory::NewLabel()};
+    tr::FindTailCalls(function->body_, &tailContext.calls_);
+    tr::TailContext *enclosingContext = tr::tailContext;
+    tr::tailContext = &tailContext;
     tr::ExpAndTy *bodyExpTy =
         function->body_->Translate(venv, tenv, newLevel, label, errormsg);
+    tr::tailContext = enclosingContext;
     if (!function->result_ && typeid(*bodyExpTy->ty_) != typeid(type::VoidTy)) {
       errormsg->Error(function->body_->pos_, "procedure returns value");
     } else if (function->result_ && !(bodyExpTy->ty_->IsSameType(resultType))) {
@@ -1015,10 +1362,15 @@ tr::Exp *FunctionDec::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
     }
 
     tree::Exp *result = bodyExpTy->exp_->UnEx();
-    tree::Stm *bodyStm = frame::GenerateProcedureEntryExitSequence(
-        newFrame, new tree::MoveStm(
-                      new tree::TempExp(reg_manager->ReturnValue()), result));
+    tree::Stm *returnStm = new tree::MoveStm(
+        new tree::TempExp(reg_manager->ReturnValue()), result);
+    if (tailContext.restarted_)
+      returnStm =
+          new tree::SeqStm(new tree::LabelStm(tailContext.start_), returnStm);
+    tree::Stm *bodyStm =
+        frame::GenerateProcedureEntryExitSequence(newFrame, returnStm);
     tr::ProcEntryExit(newLevel, new tr::NxExp(bodyStm));
+    tr::inliner->Record(function, functionEntry, venv, tenv);
 
     venv->EndScope();
   }
@@ -1040,7 +1392,8 @@ tr::Exp *VarDec::Translate(env::VEnvPtr venv, env::TEnvPtr tenv,
 
   tr::ExpAndTy *initExpTy =
       init_->Translate(venv, tenv, level, label, errormsg);
-  tr::Access *varAccess = tr::Access::AllocLocal(level, escape_);
+  tr::Access *varAccess = tr::Access::AllocLocal(
+      level, escape_, tr::IsHeapPointer(typ_ ? typeInfo : initExpTy->ty_));
   env::EnvEntry *entry = new env::VarEntry(varAccess, initExpTy->ty_);
   venv->Enter(var_, entry);
 
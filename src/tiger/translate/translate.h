@@ -32,6 +32,14 @@ public:
   }
   // Method to add a label pointer to the patch list
   // void AddLabel(temp::Label **labelPtr) { patch_list_.push_back(labelPtr); }
+  // The labels of both lists, patched together
+  static PatchList JoinPatch(const PatchList &first, const PatchList &second) {
+    PatchList joined(first.GetList());
+    joined.patch_list_.insert(joined.patch_list_.end(),
+                              second.patch_list_.begin(),
+                              second.patch_list_.end());
+    return joined;
+  }
   explicit PatchList(std::list<temp::Label **> patch_list)
       : patch_list_(patch_list) {}
   PatchList() = default;
@@ -51,7 +59,7 @@ public:
 
   Access(Level *level, frame::Access *access)
       : level_(level), access_(access) {}
-  static Access *AllocLocal(Level *level, bool escape);
+  static Access *AllocLocal(Level *level, bool escape, bool pointer = false);
 };
 
 class Level {
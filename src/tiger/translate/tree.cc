@@ -1,7 +1,9 @@
 #include "tiger/translate/tree.h"
 
 #include <cassert>
+#include <climits>
 #include <cstdio>
+#include <utility>
 
 namespace {
 
@@ -10,6 +12,24 @@ void Indent(FILE *out, int d) {
     fprintf(out, " ");
 }
 
+tree::ConstExp *AsConst(tree::Exp *exp) {
+  if (typeid(*exp) != typeid(tree::ConstExp))
+    return nullptr;
+  return static_cast<tree::ConstExp *>(exp);
+}
+
+// Expressions that may be dropped without losing a side effect
+bool IsPure(tree::Exp *exp) {
+  return typeid(*exp) == typeid(tree::ConstExp) ||
+         typeid(*exp) == typeid(tree::TempExp) ||
+         typeid(*exp) == typeid(tree::NameExp);
+}
+
+bool FitsConst(long long value) {
+  return value >= INT_MIN && value <= INT_MAX;
+}
+
+
 } // namespace
 
 namespace tree {
@@ -199,6 +219,104 @@ RelOp NotRel(RelOp r) {
   }
 }
 
+bool EvalRel(RelOp op, int left, int right) {
+  auto uleft = static_cast<unsigned int>(left);
+  auto uright = static_cast<unsigned int>(right);
+  switch (op) {
+  case EQ_OP:
+    return left == right;
+  case NE_OP:
+    return left != right;
+  case LT_OP:
+    return left < right;
+  case GT_OP:
+    return left > right;
+  case LE_OP:
+    return left <= right;
+  case GE_OP:
+    return left >= right;
+  case ULT_OP:
+    return uleft < uright;
+  case ULE_OP:
+    return uleft <= uright;
+  case UGT_OP:
+    return uleft > uright;
+  case UGE_OP:
+    return uleft >= uright;
+  default:
+    assert(false);
+  }
+}
+
+bool EvalBinop(BinOp op, int left, int right, int *result) {
+  long long wide;
+  switch (op) {
+  case PLUS_OP:
+    wide = static_cast<long long>(left) + right;
+    break;
+  case MINUS_OP:
+    wide = static_cast<long long>(left) - right;
+    break;
+  case MUL_OP:
+    wide = static_cast<long long>(left) * right;
+    break;
+  case DIV_OP:
+    if (right == 0)
+      return false;
+    wide = static_cast<long long>(left) / right;
+    break;
+  default:
+    return false;
+  }
+  if (!FitsConst(wide))
+    return false;
+  *result = static_cast<int>(wide);
+  return true;
+}
+
+Exp *Binop(BinOp op, Exp *left, Exp *right) {
+  ConstExp *leftConst = AsConst(left);
+  ConstExp *rightConst = AsConst(right);
+  int folded;
+  if (leftConst && rightConst &&
+      EvalBinop(op, leftConst->consti_, rightConst->consti_, &folded))
+    return new ConstExp(folded);
+
+  // Keep the constant of a commutative operation on the right, constants
+  // have no side effect to reorder
+  if (leftConst && !rightConst && (op == PLUS_OP || op == MUL_OP)) {
+    std::swap(left, right);
+    std::swap(leftConst, rightConst);
+  }
+  if (!rightConst)
+    return new BinopExp(op, left, right);
+
+  int value = rightConst->consti_;
+  if ((op == PLUS_OP || op == MINUS_OP) && value == 0)
+    return left;
+  if ((op == MUL_OP || op == DIV_OP) && value == 1)
+    return left;
+  if (op == MUL_OP && value == 0 && IsPure(left))
+    return right;
+
+  // (x + c1) + c2  =>  x + (c1 + c2)
+  if ((op == PLUS_OP || op == MINUS_OP) && typeid(*left) == typeid(BinopExp)) {
+    auto *inner = static_cast<BinopExp *>(left);
+    ConstExp *innerConst = AsConst(inner->right_);
+    if (innerConst && (inner->op_ == PLUS_OP || inner->op_ == MINUS_OP)) {
+      long long sum =
+          (inner->op_ == PLUS_OP ? 1LL : -1LL) * innerConst->consti_ +
+          (op == PLUS_OP ? 1LL : -1LL) * value;
+      if (FitsConst(sum) && FitsConst(-sum))
+        return sum < 0 ? Binop(MINUS_OP, inner->left_,
+                               new ConstExp(static_cast<int>(-sum)))
+                       : Binop(PLUS_OP, inner->left_,
+                               new ConstExp(static_cast<int>(sum)));
+    }
+  }
+  return new BinopExp(op, left, right);
+}
+
 RelOp Commute(RelOp r) {
   switch (r) {
   case EQ_OP:
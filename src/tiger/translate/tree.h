@@ -103,10 +103,11 @@ public:
 
 class JumpStm : public Stm {
 public:
-  NameExp *exp_;
+  // A NameExp, or the address of an indirect jump to one of jumps_
+  Exp *exp_;
   std::vector<temp::Label *> *jumps_;
 
-  JumpStm(NameExp *exp, std::vector<temp::Label *> *jumps)
+  JumpStm(Exp *exp, std::vector<temp::Label *> *jumps)
       : exp_(exp), jumps_(jumps) {}
   ~JumpStm() override;
 
@@ -186,8 +187,11 @@ public:
 class MemExp : public Exp {
 public:
   Exp *exp_;
+  // The word holds a pointer to an object the collector moves
+  bool pointer_;
 
-  explicit MemExp(Exp *exp) : exp_(exp) {}
+  explicit MemExp(Exp *exp, bool pointer = false)
+      : exp_(exp), pointer_(pointer) {}
   ~MemExp() override;
 
   void Print(FILE *out, int d) const override;
@@ -248,8 +252,11 @@ class CallExp : public Exp {
 public:
   Exp *fun_;
   ExpList *args_;
+  // The result is a pointer to an object the collector moves
+  bool pointer_;
 
-  CallExp(Exp *fun, ExpList *args) : fun_(fun), args_(args) {}
+  CallExp(Exp *fun, ExpList *args, bool pointer = false)
+      : fun_(fun), args_(args), pointer_(pointer) {}
   ~CallExp() override;
 
   void Print(FILE *out, int d) const override;
@@ -279,6 +286,7 @@ public:
   StmList() = default;
 
   const std::list<Stm *> &GetList() { return stm_list_; }
+  std::list<Stm *> &GetNonConstList() { return stm_list_; }
   void Linear(Stm *stm);
   void Print(FILE *out) const;
 
@@ -289,6 +297,19 @@ private:
 RelOp NotRel(RelOp);  // a op b == not(a NotRel(op) b)
 RelOp Commute(RelOp); // a op b == b Commute(op) a
 
+// Whether a op b holds for two constants
+bool EvalRel(RelOp op, int left, int right);
+
+// a op b for two constants, false when it cannot be known at compile time
+bool EvalBinop(BinOp op, int left, int right, int *result);
+
+/**
+ * Build a BinopExp, folding constant operands and algebraic identities
+ * (x + 0, x * 1, (x + c1) + c2) while the tree is constructed. Divisions by
+ * zero and results that do not fit in a ConstExp are left to run time.
+ */
+Exp *Binop(BinOp op, Exp *left, Exp *right);
+
 } // namespace tree
 
 #endif // TIGER_TRANSLATE_TREE_H_